@@ -0,0 +1,125 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <cstdint>
+
+namespace hf
+{
+	/*
+		A fixed set of worker threads that pull jobs off a shared queue.
+	*/
+	class ThreadPool
+	{
+	public:
+
+		static const uint32_t NotAWorker = UINT32_MAX;
+
+		void Initialise(uint32_t workerCount)
+		{
+			if (workerCount == 0)
+				workerCount = 1;
+
+			m_Running = true;
+
+			for (uint32_t i = 0; i < workerCount; i++)
+				m_Workers.emplace_back([this, i]() { WorkerLoop(i); });
+		}
+
+		void Dispose()
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Running = false;
+			}
+
+			m_JobAvailable.notify_all();
+
+			for (auto& worker : m_Workers)
+				worker.join();
+
+			m_Workers.clear();
+		}
+
+		uint32_t GetWorkerCount() const { return (uint32_t)m_Workers.size(); }
+
+		// Index of the calling thread within the pool that runs it, always below that pool's worker count. NotAWorker for any other thread
+		static uint32_t GetWorkerIndex() { return WorkerIndex(); }
+
+		void Enqueue(std::function<void()> job)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Jobs.push(std::move(job));
+			}
+
+			m_JobAvailable.notify_one();
+		}
+
+		// Runs func for every index in [0, count) across the workers and blocks until all have finished
+		void ParallelFor(uint32_t count, std::function<void(uint32_t)> func)
+		{
+			uint32_t remaining = count;
+			std::mutex doneMutex;
+			std::condition_variable done;
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				Enqueue([&, i]()
+					{
+						func(i);
+
+						// The counter is only touched under the lock so the caller can't return while we still hold it
+						std::unique_lock<std::mutex> lock(doneMutex);
+						if (--remaining == 0)
+							done.notify_one();
+					});
+			}
+
+			std::unique_lock<std::mutex> lock(doneMutex);
+			done.wait(lock, [&]() { return remaining == 0; });
+		}
+
+	private:
+
+		std::vector<std::thread> m_Workers;
+		std::queue<std::function<void()>> m_Jobs;
+
+		std::mutex m_Mutex;
+		std::condition_variable m_JobAvailable;
+		bool m_Running = false;
+
+		static uint32_t& WorkerIndex()
+		{
+			thread_local uint32_t index = NotAWorker;
+			return index;
+		}
+
+		void WorkerLoop(uint32_t index)
+		{
+			WorkerIndex() = index;
+
+			while (true)
+			{
+				std::function<void()> job;
+
+				{
+					std::unique_lock<std::mutex> lock(m_Mutex);
+					m_JobAvailable.wait(lock, [this]() { return !m_Running || !m_Jobs.empty(); });
+
+					if (!m_Running && m_Jobs.empty())
+						return;
+
+					job = std::move(m_Jobs.front());
+					m_Jobs.pop();
+				}
+
+				job();
+			}
+		}
+	};
+}
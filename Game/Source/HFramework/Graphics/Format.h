@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 
 
 namespace hf
@@ -37,4 +38,31 @@ namespace hf
 
 		BGRA8_SRGB
 	};
+
+	// Size of one element in bytes
+	constexpr uint32_t GetFormatSize(Format format)
+	{
+		switch (format)
+		{
+		case Format::R8U: case Format::R8S: case Format::R8_SRGB:
+			return 1;
+		case Format::RG8U: case Format::RG8S: case Format::RG8_SRGB: case Format::R16F:
+			return 2;
+		case Format::RGB8U: case Format::RGB8S: case Format::RGB8_SRGB:
+			return 3;
+		case Format::RGBA8U: case Format::RGBA8S: case Format::RGBA8_SRGB: case Format::BGRA8_SRGB:
+		case Format::RG16F: case Format::R32F: case Format::D32: case Format::D24_S8:
+			return 4;
+		case Format::RGB16F:
+			return 6;
+		case Format::RGBA16F: case Format::RG32F:
+			return 8;
+		case Format::RGB32F:
+			return 12;
+		case Format::RGBA32F:
+			return 16;
+		default:
+			return 0;
+		}
+	}
 }
\ No newline at end of file
@@ -6,7 +6,8 @@ namespace hf
 	{
 		Vertex,
 		Fragment,
-		Compute
+		Compute,
+		All		/* Every stage, for bindings shared by the whole pipeline */
 	};
 
 	enum class IndexType
@@ -11,17 +11,26 @@ namespace hf
 		char* mem = (char*)m_MappedBuffer;
 		mem += offset;
 
-		if (m_CpuVisible)
+		// Writing under a frame still reading the buffer would change what it sees, stage those instead.
+		// Buffers created CPU visible can't be staged, keeping them out of use is up to the caller
+		vulkan::Device& device = m_Renderer->m_Device;
+		bool canWrite = !m_CanStage || (!m_Buffer.IsInFlight() && device.HasCompletedFrame(m_StagedFrame));
+
+		if (m_CpuVisible && canWrite)
 		{
 
 			memcpy(mem, data, size);
 
+			// Memory that isn't host coherent needs flushing before the device sees the write
+			m_Buffer.Flush(offset, size);
+
 			return;
 		}
 
-		// We need to queue a copy operation in the renderer
+		// We need to queue a copy operation in the renderer, it is flushed before the next frame and that frame's submit waits on it
 
-		m_Renderer->QueueBufferCopy(data, size, &m_Buffer);
+		m_Renderer->QueueBufferCopy(data, size, &m_Buffer, offset);
+		m_StagedFrame = device.GetFrame() + 1;
 
 	}
 }
\ No newline at end of file
@@ -20,6 +20,13 @@ namespace hf
 
 		void* m_MappedBuffer;
 		bool m_CpuVisible = false;
+
+		// Device buffers that landed in host visible memory, they can fall back to a staged copy while in use
+		bool m_CanStage = false;
+
+		// Direct writes wait for the frame a staged copy lands in so they can't be overwritten by it
+		uint64_t m_StagedFrame = 0;
+
 		vulkan::Buffer m_Buffer;
 
 		RendererVk* m_Renderer;
@@ -0,0 +1,203 @@
+#include "GeometryPool.h"
+#include "RendererVk.h"
+#include <cstring>
+#include <utility>
+
+namespace hf
+{
+	void GeometryPool::Init(RendererVk* renderer, size_t vertexBufferSize, size_t indexBufferSize)
+	{
+		m_Renderer = renderer;
+
+		// Index block counts indices so round its buffer to whole ones
+		indexBufferSize = indexBufferSize / sizeof(uint32_t) * sizeof(uint32_t);
+
+		vulkan::BufferDesc vertexDesc{};
+		vertexDesc.usage = vulkan::BufferUsage::Vertex | vulkan::BufferUsage::TransferDst;
+		vertexDesc.visibility = vulkan::BufferVisibility::DevicePreferHostWrite;
+		vertexDesc.bufferSize = vertexBufferSize;
+
+		vulkan::BufferDesc indexDesc{};
+		indexDesc.usage = vulkan::BufferUsage::Index | vulkan::BufferUsage::TransferDst;
+		indexDesc.visibility = vulkan::BufferVisibility::DevicePreferHostWrite;
+		indexDesc.bufferSize = indexBufferSize;
+
+		m_VertexBuffer = m_Renderer->m_Device.CreateBuffer(vertexDesc);
+		m_IndexBuffer = m_Renderer->m_Device.CreateBuffer(indexDesc);
+
+		VmaVirtualBlockCreateInfo vertexBlockInfo{};
+		vertexBlockInfo.size = vertexBufferSize;
+
+		VmaVirtualBlockCreateInfo indexBlockInfo{};
+		indexBlockInfo.size = indexBufferSize / sizeof(uint32_t);
+
+		if (vmaCreateVirtualBlock(&vertexBlockInfo, &m_VertexBlock) != VK_SUCCESS || vmaCreateVirtualBlock(&indexBlockInfo, &m_IndexBlock) != VK_SUCCESS)
+		{
+			Log::Fatal("Failed to create geometry pool");
+		}
+
+		// Host visible memory (ReBAR, UMA) is written directly, everything else goes through the upload queue
+		if (m_VertexBuffer.IsHostWritable())
+			m_VertexBuffer.Map();
+
+		if (m_IndexBuffer.IsHostWritable())
+			m_IndexBuffer.Map();
+
+		Log::Info("Created Geometry Pool (%zu KB vertices, %zu KB indices)", vertexBufferSize / 1024, indexBufferSize / 1024);
+	}
+
+	void GeometryPool::Dispose()
+	{
+		// Meshes still alive are the owner's problem, the blocks are cleared so VMA doesn't assert on them
+		vmaClearVirtualBlock(m_VertexBlock);
+		vmaClearVirtualBlock(m_IndexBlock);
+
+		vmaDestroyVirtualBlock(m_VertexBlock);
+		vmaDestroyVirtualBlock(m_IndexBlock);
+
+		m_VertexBuffer.Dispose();
+		m_IndexBuffer.Dispose();
+	}
+
+	void GeometryPool::BeginFrame()
+	{
+		PendingFrees frees;
+
+		{
+			// Frees made from here on belong to the new frame, so take the old ones out before anything else can add to the slot
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			m_Frame = (m_Frame + 1) % vulkan::MaxImagesInFlight;
+			std::swap(frees, m_PendingFrees[m_Frame]);
+		}
+
+		m_Renderer->m_Device.WaitForSubmit(vulkan::Queue::Graphics, frees.retireValue);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		for (auto& allocation : frees.vertices)
+			vmaVirtualFree(m_VertexBlock, allocation);
+
+		for (auto& allocation : frees.indices)
+			vmaVirtualFree(m_IndexBlock, allocation);
+	}
+
+	void GeometryPool::EndFrame(uint64_t graphicsSubmitValue)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingFrees[m_Frame].retireValue = graphicsSubmitValue;
+	}
+
+	MeshAllocation GeometryPool::Allocate(const void* vertices, uint32_t vertexStride, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount)
+	{
+		MeshAllocation mesh{};
+
+		// Virtual alignments have to be powers of two, other strides are padded so the range can start on a whole vertex
+		bool powerOfTwo = (vertexStride & (vertexStride - 1)) == 0;
+
+		VmaVirtualAllocationCreateInfo vertexInfo{};
+		vertexInfo.size = (VkDeviceSize)vertexStride * vertexCount + (powerOfTwo ? 0 : vertexStride - 1);
+		vertexInfo.alignment = powerOfTwo ? vertexStride : 1;
+
+		VmaVirtualAllocationCreateInfo indexInfo{};
+		indexInfo.size = indexCount;
+
+		VkDeviceSize vertexOffset = 0;
+		VkDeviceSize indexOffset = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			if (vmaVirtualAllocate(m_VertexBlock, &vertexInfo, &mesh.vertexAllocation, &vertexOffset) != VK_SUCCESS)
+			{
+				Log::Error("Geometry pool is out of vertex memory (%u vertices requested)", vertexCount);
+				return MeshAllocation();
+			}
+
+			// Non-indexed meshes take no index range, VMA doesn't allow empty allocations
+			if (indexCount > 0 && vmaVirtualAllocate(m_IndexBlock, &indexInfo, &mesh.indexAllocation, &indexOffset) != VK_SUCCESS)
+			{
+				Log::Error("Geometry pool is out of index memory (%u indices requested)", indexCount);
+
+				vmaVirtualFree(m_VertexBlock, mesh.vertexAllocation);
+				return MeshAllocation();
+			}
+
+			m_MeshCount++;
+		}
+
+		mesh.firstVertex = (uint32_t)((vertexOffset + vertexStride - 1) / vertexStride);
+		mesh.vertexCount = vertexCount;
+		mesh.firstIndex = (uint32_t)indexOffset;
+		mesh.indexCount = indexCount;
+
+		Write(m_VertexBuffer, vertices, (size_t)vertexStride * vertexCount, (size_t)mesh.firstVertex * vertexStride);
+
+		if (indexCount > 0)
+			Write(m_IndexBuffer, indices, sizeof(uint32_t) * indexCount, sizeof(uint32_t) * mesh.firstIndex);
+
+		return mesh;
+	}
+
+	MeshAllocation GeometryPool::Allocate(const void* vertices, uint32_t vertexStride, uint32_t vertexCount, const uint16_t* indices, uint32_t indexCount)
+	{
+		std::vector<uint32_t> wideIndices(indices, indices + indexCount);
+
+		return Allocate(vertices, vertexStride, vertexCount, wideIndices.data(), indexCount);
+	}
+
+	void GeometryPool::Free(MeshAllocation& mesh)
+	{
+		if (!mesh.IsValid())
+			return;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		m_PendingFrees[m_Frame].vertices.push_back(mesh.vertexAllocation);
+
+		if (mesh.indexAllocation)
+			m_PendingFrees[m_Frame].indices.push_back(mesh.indexAllocation);
+		m_MeshCount--;
+
+		mesh = MeshAllocation();
+	}
+
+	void GeometryPool::Bind(vulkan::CommandList& cmd, uint32_t bindPoint)
+	{
+		cmd.BindVertexBuffer(&m_VertexBuffer, bindPoint);
+		cmd.BindIndexBuffer(&m_IndexBuffer, IndexType::Uint32);
+	}
+
+	GeometryPoolStats GeometryPool::GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		VmaStatistics vertexStats{};
+		VmaStatistics indexStats{};
+
+		vmaGetVirtualBlockStatistics(m_VertexBlock, &vertexStats);
+		vmaGetVirtualBlockStatistics(m_IndexBlock, &indexStats);
+
+		GeometryPoolStats stats{};
+		stats.meshes = m_MeshCount;
+		stats.vertexBytesUsed = vertexStats.allocationBytes;
+		stats.vertexBytesTotal = vertexStats.blockBytes;
+		stats.indexBytesUsed = indexStats.allocationBytes * sizeof(uint32_t);
+		stats.indexBytesTotal = indexStats.blockBytes * sizeof(uint32_t);
+
+		return stats;
+	}
+
+	void GeometryPool::Write(vulkan::Buffer& buffer, const void* data, size_t size, size_t offset)
+	{
+		if (buffer.IsHostWritable())
+		{
+			// The range was free so nothing on the GPU is reading it
+			memcpy((uint8_t*)buffer.Map() + offset, data, size);
+			buffer.Flush(offset, size);
+			return;
+		}
+
+		m_Renderer->QueueBufferCopy((void*)data, size, &buffer, offset);
+	}
+}
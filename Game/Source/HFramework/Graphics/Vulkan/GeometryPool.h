@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../../Vulkan/Device.h"
+#include <mutex>
+
+namespace hf
+{
+	class RendererVk;
+
+	// Where a mesh lives in the pool, feeds straight into DrawIndexed
+	struct MeshAllocation
+	{
+		uint32_t firstVertex = 0;
+		uint32_t vertexCount = 0;
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+
+		VmaVirtualAllocation vertexAllocation = VK_NULL_HANDLE;
+		VmaVirtualAllocation indexAllocation = VK_NULL_HANDLE;
+
+		bool IsValid() const { return vertexAllocation != VK_NULL_HANDLE; }
+	};
+
+	struct GeometryPoolStats
+	{
+		uint32_t meshes = 0;
+		uint64_t vertexBytesUsed = 0;
+		uint64_t vertexBytesTotal = 0;
+		uint64_t indexBytesUsed = 0;
+		uint64_t indexBytesTotal = 0;
+
+		void Print()
+		{
+			Log::Info("Geometry Pool Stats:");
+			Log::Info(" - Meshes: %d", meshes);
+			Log::Info(" - Vertex Memory: %llu / %llu KB", vertexBytesUsed / 1024, vertexBytesTotal / 1024);
+			Log::Info(" - Index Memory: %llu / %llu KB", indexBytesUsed / 1024, indexBytesTotal / 1024);
+		}
+	};
+
+	/*
+		Every mesh's vertices and indices sub-allocated out of one vertex buffer and one index buffer, so geometry is bound once per pass
+		and each draw just offsets into it with firstVertex and firstIndex. Ranges are managed by VMA virtual blocks so freeing
+		never touches device memory. Meshes with different vertex formats can share the pool, ranges are aligned to their stride.
+	*/
+	class GeometryPool
+	{
+	public:
+
+		void Init(RendererVk* renderer, size_t vertexBufferSize, size_t indexBufferSize);
+
+		void Dispose();
+
+		// Frees from the frame's last time round can be reused once its graphics submit has finished
+		void BeginFrame();
+
+		void EndFrame(uint64_t graphicsSubmitValue);
+
+		// Thread safe. Returns an invalid allocation if the pool is full
+		MeshAllocation Allocate(const void* vertices, uint32_t vertexStride, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount);
+
+		// The pool's indices are 32 bit, these are widened on the way in
+		MeshAllocation Allocate(const void* vertices, uint32_t vertexStride, uint32_t vertexCount, const uint16_t* indices, uint32_t indexCount);
+
+		// The ranges are released once the GPU work of the current frame has finished
+		void Free(MeshAllocation& mesh);
+
+		void Bind(vulkan::CommandList& cmd, uint32_t bindPoint = 0);
+
+		static void Draw(vulkan::CommandList& cmd, const MeshAllocation& mesh, uint32_t instanceCount = 1, uint32_t firstInstance = 0)
+		{
+			if (mesh.indexCount == 0)
+			{
+				cmd.Draw(mesh.vertexCount, mesh.firstVertex, instanceCount, firstInstance);
+				return;
+			}
+
+			cmd.DrawIndexed(mesh.indexCount, mesh.firstIndex, mesh.firstVertex, instanceCount, firstInstance);
+		}
+
+		GeometryPoolStats GetStats();
+
+	private:
+
+		RendererVk* m_Renderer;
+
+		vulkan::Buffer m_VertexBuffer;
+		vulkan::Buffer m_IndexBuffer;
+
+		// Vertex block is in bytes, index block is in indices
+		VmaVirtualBlock m_VertexBlock = VK_NULL_HANDLE;
+		VmaVirtualBlock m_IndexBlock = VK_NULL_HANDLE;
+
+		std::mutex m_Mutex;
+		uint32_t m_MeshCount = 0;
+
+		// Guarded by m_Mutex along with the pending frees
+		uint32_t m_Frame = 0;
+
+		struct PendingFrees
+		{
+			std::vector<VmaVirtualAllocation> vertices;
+			std::vector<VmaVirtualAllocation> indices;
+			uint64_t retireValue = 0;
+		};
+
+		PendingFrees m_PendingFrees[vulkan::MaxImagesInFlight];
+
+		void Write(vulkan::Buffer& buffer, const void* data, size_t size, size_t offset);
+	};
+}
@@ -11,26 +11,36 @@ namespace hf
 #else 
 		deviceInfo.validationLayers = false;
 #endif
+		deviceInfo.pipelineCachePath = "PipelineCache.bin";
 
 		m_Device.Create(deviceInfo);
 
-		// Create the staging buffer
+		// Leave a core free for the main thread
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		m_Workers.Initialise(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
 
-		vulkan::BufferDesc stagingDesc{};
-		stagingDesc.usage = vulkan::BufferUsage::TransferSrc;
-		stagingDesc.visibility = vulkan::BufferVisibility::HostVisible;
-		stagingDesc.bufferSize = m_StagingBuffer.size;
+		// Create the staging ring and transfer command lists
 
-		m_StagingBuffer.buffer = m_Device.CreateBuffer(stagingDesc);
-		m_StagingBuffer.m_Mapped = m_StagingBuffer.buffer.Map();
-		m_StagingBuffer.semaphore = m_Device.CreateSemaphores(1)[0];
+		m_Uploads.Init(&m_Device);
+
+		m_UniformRing.Init(&m_Device, 1024 * 1024);
+
+		m_Transient.Init(&m_Device, 4 * 1024 * 1024);
+
+		m_Geometry.Init(this, 32 * 1024 * 1024, 16 * 1024 * 1024);
 	}
 
 	void RendererVk::Destroy()
 	{
+		m_Workers.Dispose();
+
+		m_Uploads.Dispose();
 
-		m_StagingBuffer.buffer.Dispose();
-		m_StagingBuffer.semaphore.Dispose();
+		m_UniformRing.Dispose();
+
+		m_Transient.Dispose();
+
+		m_Geometry.Dispose();
 		
 		for (auto& [wnd, data] : m_WindowData)
 		{
@@ -70,6 +80,10 @@ namespace hf
 		windowData.baseCommandLists = m_Device.AllocateCommandLists(hf::vulkan::Queue::Graphics, hf::vulkan::CommandListType::Primary, windowData.swapchain.GetImageCount());
 		windowData.imageAvailable = m_Device.CreateSemaphores(windowData.swapchain.GetImageCount());
 		windowData.workFinished = m_Device.CreateSemaphores(windowData.swapchain.GetImageCount());
+
+		windowData.threadCommandLists.resize(windowData.swapchain.GetImageCount());
+		for (auto& frameLists : windowData.threadCommandLists)
+			frameLists.resize(m_Workers.GetWorkerCount());
 	}
 
 	Format RendererVk::GetSwapchainFormat(Window* window)
@@ -87,41 +101,30 @@ namespace hf
 		if (!window->IsOpen())
 			return false;
 
-		// Upload Using staging
-
-		if (m_StagingBuffer.dataUploaded)
-		{
-			m_Device.ExecuteSingleUsageCommandList(hf::vulkan::Queue::Graphics, [&](hf::vulkan::CommandList& cmdList)
-				{
-
-					while (!m_CopyData.empty())
-					{
-						CopyData& data = m_CopyData.front();
-
-						switch (data.op)
-						{
-						case CopyData::CopyOp::Buffer:
-
-							cmdList.CopyBuffer(&m_StagingBuffer.buffer, data.buffer, data.size, data.stagingOffset);
-
-							break;
-						case CopyData::CopyOp::Texture: 
-							break;
-						}
+		// Kick off any staged copies on the transfer queue, the frame's submit waits on them
 
-						m_CopyData.pop();
-					}
+		m_Uploads.Flush();
 
-					m_StagingBuffer.offset = 0;
-
-				}, &m_StagingBuffer.semaphore);
-		}
+		// Everything recorded last frame is submitted so moved resources can take their new handles
+		m_Device.GetDefragmenter().BeginFrame();
+		m_Device.GetResidency().BeginFrame();
 		
 
 		WindowData& windowData = m_WindowData[window];
 
 		windowData.currentFrameIndex = windowData.swapchain.GetCurrentImageIndex();
 
+		// Transient descriptor sets from the last time round this frame are released in bulk
+		m_Device.BeginDescriptorFrame();
+		m_UniformRing.BeginFrame();
+		m_Transient.BeginFrame();
+		m_Geometry.BeginFrame();
+		m_Device.GetTransientAttachments().BeginFrame();
+
+		// The secondary lists for this frame can be reused once the frame's command list has finished
+		for (auto& threadLists : windowData.threadCommandLists[windowData.currentFrameIndex])
+			threadLists.used = 0;
+
 		if (!windowData.swapchain.AquireNextFrame(&windowData.imageAvailable[windowData.currentFrameIndex]))
 			return false;
 
@@ -137,17 +140,35 @@ namespace hf
 
 		wait.push_back(&windowData.imageAvailable[windowData.currentFrameIndex]);
 
+		std::vector<vulkan::CommandList*> cmdLists = { &GetCurrentFrameCmdList(window) };
+		std::vector<vulkan::TimelineWait> timelineWaits;
+
 		// If we have uploaded something using the staging buffer
 		// We want to wait for that to finish execution before beginning execution of this command list
-		if (m_StagingBuffer.dataUploaded)
-		{
-			wait.push_back(&m_StagingBuffer.semaphore);
-			m_StagingBuffer.dataUploaded = false;
-		}
+		m_Uploads.AddGraphicsDependencies(cmdLists, timelineWaits);
 
-		m_Device.QueueSubmit(hf::vulkan::Queue::Graphics, { &GetCurrentFrameCmdList(window) }, wait, &windowData.workFinished[windowData.currentFrameIndex]);
+		// Anything else this frame depends on such as async compute work
+		timelineWaits.insert(timelineWaits.end(), m_FrameWaits.begin(), m_FrameWaits.end());
+		m_FrameWaits.clear();
+
+		m_UniformRing.Flush();
+		m_Transient.Flush();
+
+		uint64_t submitValue = m_Device.QueueSubmit(hf::vulkan::Queue::Graphics, cmdLists, wait, &windowData.workFinished[windowData.currentFrameIndex], timelineWaits);
+		m_Device.EndDescriptorFrame(submitValue);
+		m_UniformRing.EndFrame(submitValue);
+		m_Transient.EndFrame(submitValue);
+		m_Geometry.EndFrame(submitValue);
+		m_Device.GetTransientAttachments().EndFrame(submitValue);
 
 		windowData.swapchain.Present(&windowData.workFinished[windowData.currentFrameIndex]);
+
+		// By the first frame every startup pipeline has been created so report how well the cache did
+		if (!m_PresentedFirstFrame)
+		{
+			m_Device.GetPipelineCacheStats().Print();
+			m_PresentedFirstFrame = true;
+		}
 	}
 	 
 	void RendererVk::WaitIdle()
@@ -161,7 +182,7 @@ namespace hf
 
 		vulkan::BufferDesc bufDesc{};
 		bufDesc.bufferSize = desc.size;
-		bufDesc.visibility = desc.cpuVisible ? vulkan::BufferVisibility::HostVisible : vulkan::BufferVisibility::Device;
+		bufDesc.visibility = desc.cpuVisible ? vulkan::BufferVisibility::HostVisible : vulkan::BufferVisibility::DevicePreferHostWrite;
 
 		switch (desc.bufferType)
 		{
@@ -177,12 +198,14 @@ namespace hf
 		}
 
 		// if its device only we need to have set it as a transfer destination 
-		if (bufDesc.visibility == vulkan::BufferVisibility::Device)
+		if (bufDesc.visibility != vulkan::BufferVisibility::HostVisible)
 			bufDesc.usage = bufDesc.usage | vulkan::BufferUsage::TransferDst;
 
-		buf->m_Buffer = m_Device.CreateBuffer(bufDesc);
+		m_Device.CreateBuffer(bufDesc, &buf->m_Buffer);
 
-		buf->m_CpuVisible = desc.cpuVisible;
+		// Device buffers that landed in host visible memory (ReBAR, UMA) are written directly and skip the staging copy
+		buf->m_CpuVisible = buf->m_Buffer.IsHostWritable();
+		buf->m_CanStage = !desc.cpuVisible;
 		if (buf->m_CpuVisible)
 			buf->m_MappedBuffer = buf->m_Buffer.Map();
 
@@ -191,6 +214,74 @@ namespace hf
 		return buf;
 	}
 
+	uint64_t RendererVk::SubmitCompute(std::vector<hf::vulkan::CommandList*> cmdLists, VkPipelineStageFlags waitStages)
+	{
+		// Compute work can read what has been allocated from the rings so far this frame
+		m_UniformRing.Flush();
+		m_Transient.Flush();
+
+		uint64_t submitValue = m_Device.QueueSubmit(vulkan::Queue::Compute, cmdLists, std::vector<vulkan::Semaphore*>{}, nullptr);
+
+		vulkan::TimelineWait wait{};
+		wait.queue = vulkan::Queue::Compute;
+		wait.value = submitValue;
+		wait.stages = waitStages;
+		m_FrameWaits.push_back(wait);
+
+		return submitValue;
+	}
+
+	bool RendererVk::RecordParallel(Window* window, hf::vulkan::RenderpassInfo& renderpass, uint32_t jobCount, std::function<void(hf::vulkan::CommandList&, uint32_t)> func)
+	{
+		WindowData& windowData = m_WindowData[window];
+		auto& frameLists = windowData.threadCommandLists[windowData.currentFrameIndex];
+
+		std::vector<vulkan::CommandList*> recorded(jobCount);
+		std::atomic<bool> failed = false;
+
+		m_Workers.ParallelFor(jobCount, [&](uint32_t job)
+			{
+				// Bounded by the worker count, unlike the device's thread index which grows with every thread ever seen
+				uint32_t workerIndex = ThreadPool::GetWorkerIndex();
+
+				if (workerIndex >= frameLists.size())
+				{
+					Log::Error("Recording job %u ran outside the renderer's workers", job);
+					failed = true;
+					return;
+				}
+
+				// Only this thread touches its slot so no locking is needed
+				WindowData::ThreadCommandLists& threadLists = frameLists[workerIndex];
+
+				if (threadLists.used == threadLists.lists.size())
+				{
+					// Allocated from this thread so it comes from this thread's command pool
+					threadLists.lists.push_back(m_Device.AllocateCommandLists(vulkan::Queue::Graphics, vulkan::CommandListType::Secondary, 1)[0]);
+				}
+
+				vulkan::CommandList& cmdList = threadLists.lists[threadLists.used++];
+
+				cmdList.Begin(&renderpass);
+				func(cmdList, job);
+				cmdList.End();
+
+				recorded[job] = &cmdList;
+			});
+
+		// A partial pass would draw with holes in it, leave it out entirely
+		if (failed)
+		{
+			Log::Error("Failed to record the pass in parallel");
+			return false;
+		}
+
+		// Execute in job order so the result doesn't depend on which thread ran which job
+		GetCurrentFrameCmdList(window).ExecuteCommandLists(recorded);
+
+		return true;
+	}
+
 	void RendererVk::AddRenderpass( std::function<void(CommandEncoder&)> func)
 	{
 		
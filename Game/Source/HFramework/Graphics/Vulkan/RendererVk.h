@@ -3,7 +3,13 @@
 #include "../Renderer.h"
 #include "../../Vulkan/Device.h"
 #include <mutex>
+#include <deque>
 #include "BufferVk.h"
+#include "UploadQueue.h"
+#include "UniformRing.h"
+#include "TransientAllocator.h"
+#include "GeometryPool.h"
+#include "../../Core/ThreadPool.h"
 
 namespace hf
 {
@@ -32,9 +38,40 @@ namespace hf
 
 		hf::vulkan::CommandList& GetCurrentFrameCmdList(Window* window);
 
+		/// <summary>
+		/// Records jobCount secondary command lists across the worker threads and executes them in the current frame's command list.
+		/// Must be called between BeginRenderpass and EndRenderpass of a renderpass with useSecondaryListsForRendering set.
+		/// Returns false and executes nothing if any job couldn't be recorded
+		/// </summary>
+		bool RecordParallel(Window* window, hf::vulkan::RenderpassInfo& renderpass, uint32_t jobCount, std::function<void(hf::vulkan::CommandList&, uint32_t)> func);
+
+		/// <summary>
+		/// Submits command lists to the compute queue. The next frame submitted to the graphics queue waits for them at waitStages
+		/// </summary>
+		uint64_t SubmitCompute(std::vector<hf::vulkan::CommandList*> cmdLists, VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+		// Extra waits for the next graphics submit, consumed by EndFrame
+		std::vector<vulkan::TimelineWait> m_FrameWaits;
+
+		ThreadPool m_Workers;
+
 
 		hf::vulkan::Device m_Device;
 
+		// Per frame uniform data, allocations are only valid between BeginFrame and EndFrame
+		UniformRing m_UniformRing;
+
+		// Per frame vertex, index, uniform and storage data, same lifetime as the uniform ring
+		TransientAllocator m_Transient;
+
+		TransientAllocation AllocateTransient(size_t size, size_t align, vulkan::BufferUsage usage)
+		{
+			return m_Transient.Allocate(size, align, usage);
+		}
+
+		// Shared vertex and index buffers for mesh geometry, bind once per pass and draw meshes by offset
+		GeometryPool m_Geometry;
+
 		struct WindowData
 		{
 			hf::vulkan::Surface surface;
@@ -45,6 +82,16 @@ namespace hf
 			std::vector<hf::vulkan::Semaphore> imageAvailable;
 
 			std::vector<hf::vulkan::CommandList> baseCommandLists;
+
+			// Secondary command lists are thread affine so each thread keeps its own per frame
+			struct ThreadCommandLists
+			{
+				std::deque<hf::vulkan::CommandList> lists;
+				uint32_t used = 0;
+			};
+
+			// Indexed by frame and then by worker index
+			std::vector<std::vector<ThreadCommandLists>> threadCommandLists;
 		};
 
 		std::unordered_map<Window*, WindowData> m_WindowData;
@@ -54,72 +101,32 @@ namespace hf
 			return m_WindowData[wnd];
 		}
 
-		struct CopyData
+		void QueueBufferCopy(void* data, size_t size, vulkan::Buffer* dst, size_t dstOffset = 0)
 		{
-			enum class CopyOp
-			{
-				Buffer, 
-				Texture
-			};
-
-			CopyOp op;
-			size_t stagingOffset;
-			size_t size;
-
-			union
-			{
-				vulkan::Buffer* buffer;
-				vulkan::Texture* texture;
-			};
-		};
-
-		void QueueBufferCopy(void* data, size_t size, vulkan::Buffer* dst)
-		{
-			CopyData copyData{};
-			copyData.op = CopyData::CopyOp::Buffer;
-			copyData.size = size;
-			copyData.stagingOffset = m_StagingBuffer.offset;
-			copyData.buffer = dst;
-
-			if (m_StagingBuffer.offset + size > m_StagingBuffer.size)
-			{
-				Log::Fatal("Staging Buffer run out of memory");
-				return;
-			}
-
-			// We then copy the data to the staging buffer
-			char* mem = (char*)m_StagingBuffer.m_Mapped;
-			mem += m_StagingBuffer.offset;
-
-			memcpy(mem, data, size);
-
-			m_StagingBuffer.offset += size;
-
-			m_CopyData.push(copyData);
-
-			m_StagingBuffer.dataUploaded = true;
-			
+			m_Uploads.QueueBufferCopy(data, size, dst, dstOffset);
 		}
 
-		void QueueTextureCopy(void* data)
+		void QueueTextureCopy(void* data, size_t size, vulkan::Texture* dst, const vulkan::BufferImageCopy& region)
 		{
-
+			m_Uploads.QueueTextureCopy(data, size, dst, region);
 		}
 
-		std::queue<CopyData> m_CopyData;
-
-		struct
+		/// <summary>
+		/// Fills a texture from CPU memory, straight into the image with VK_EXT_host_image_copy when the texture supports it,
+		/// no frame using it is still in flight and no staged upload to it is pending. Otherwise every region is staged together
+		/// and copied on the transfer queue at the next flush. Each region's bufferOffset is an offset into data
+		/// </summary>
+		void UploadTexture(vulkan::Texture* dst, const void* data, size_t size, const std::vector<vulkan::BufferImageCopy>& regions)
 		{
+			if (dst->SupportsHostCopy() && !dst->IsInFlight() && m_Uploads.CopyFromHost(data, dst, regions))
+				return;
 
-			const size_t size = 1 * 1024 * 1024 * 1024;		// 1 MB Staging Buffer
-			vulkan::Buffer buffer;
-			void* m_Mapped;
-			size_t offset;
-			vulkan::Semaphore semaphore;
-			bool dataUploaded = false;
+			m_Uploads.QueueTextureCopies(data, size, dst, regions);
+		}
 
-		} m_StagingBuffer;
+		UploadQueue m_Uploads;
 
+		bool m_PresentedFirstFrame = false;
 
 		std::mutex m_Mutex;
 	};
@@ -0,0 +1,106 @@
+#include "TransientAllocator.h"
+#include <algorithm>
+#include <cstring>
+
+namespace hf
+{
+	void TransientAllocator::Init(vulkan::Device* device, size_t frameSize)
+	{
+		m_Device = device;
+
+		const vulkan::SupportedFeatures& features = m_Device->GetSupportedFeatures();
+
+		m_UniformAlignment = std::max<size_t>(features.minUniformBufferOffsetAlignment, 4);
+		m_StorageAlignment = std::max<size_t>(features.minStorageBufferOffsetAlignment, 4);
+
+		// Keep each region aligned for the largest binding alignment
+		size_t regionAlignment = std::max(m_UniformAlignment, m_StorageAlignment);
+		m_FrameSize = (frameSize + regionAlignment - 1) & ~(regionAlignment - 1);
+
+		vulkan::BufferDesc bufferDesc{};
+		bufferDesc.usage = vulkan::BufferUsage::Vertex | vulkan::BufferUsage::Index | vulkan::BufferUsage::Uniform | vulkan::BufferUsage::ShaderStorage;
+		bufferDesc.visibility = vulkan::BufferVisibility::HostVisible;
+		bufferDesc.bufferSize = m_FrameSize * vulkan::MaxImagesInFlight;
+
+		m_Buffer = m_Device->CreateBuffer(bufferDesc);
+		m_Mapped = (uint8_t*)m_Buffer.Map();
+	}
+
+	void TransientAllocator::Dispose()
+	{
+		m_Buffer.Dispose();
+	}
+
+	void TransientAllocator::BeginFrame()
+	{
+		m_Frame = (m_Frame + 1) % vulkan::MaxImagesInFlight;
+
+		m_Device->WaitForSubmit(vulkan::Queue::Graphics, m_RetireValues[m_Frame]);
+
+		m_Offset = 0;
+	}
+
+	void TransientAllocator::Flush()
+	{
+		// A failed allocation still bumps the offset past the end of the region
+		size_t used = std::min(m_Offset.load(), m_FrameSize);
+
+		if (used > 0)
+			m_Buffer.Flush(m_FrameSize * m_Frame, used);
+	}
+
+	void TransientAllocator::EndFrame(uint64_t graphicsSubmitValue)
+	{
+		m_RetireValues[m_Frame] = graphicsSubmitValue;
+	}
+
+	TransientAllocation TransientAllocator::Allocate(size_t size, size_t align, vulkan::BufferUsage usage)
+	{
+		TransientAllocation allocation{};
+
+		if ((int)usage & (int)vulkan::BufferUsage::Uniform)
+			align = std::max(align, m_UniformAlignment);
+
+		if ((int)usage & (int)vulkan::BufferUsage::ShaderStorage)
+			align = std::max(align, m_StorageAlignment);
+
+		// Index buffer offsets must be a multiple of the index size
+		if ((int)usage & (int)vulkan::BufferUsage::Index)
+			align = std::max<size_t>(align, 4);
+
+		align = std::max<size_t>(align, 1);
+
+		// Other threads may bump the offset between the load and the exchange so retry until ours lands
+		size_t current = m_Offset.load();
+		size_t start;
+
+		do
+		{
+			start = (current + align - 1) / align * align;
+		} while (!m_Offset.compare_exchange_weak(current, start + size));
+
+		if (start + size > m_FrameSize)
+		{
+			Log::Error("Transient allocator is out of space for this frame (%zu bytes requested)", size);
+			return allocation;
+		}
+
+		size_t ringOffset = m_FrameSize * m_Frame + start;
+
+		allocation.buffer = &m_Buffer;
+		allocation.offset = ringOffset;
+		allocation.data = m_Mapped + ringOffset;
+
+		return allocation;
+	}
+
+	TransientAllocation TransientAllocator::Allocate(const void* data, size_t size, size_t align, vulkan::BufferUsage usage)
+	{
+		TransientAllocation allocation = Allocate(size, align, usage);
+
+		if (allocation.data)
+			memcpy(allocation.data, data, size);
+
+		return allocation;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../../Vulkan/Device.h"
+#include <atomic>
+
+namespace hf
+{
+	struct TransientAllocation
+	{
+		vulkan::Buffer* buffer = nullptr;
+		size_t offset = 0;
+
+		// Where to write the data, nullptr if the allocation failed
+		void* data = nullptr;
+	};
+
+	/*
+		Linear arenas for data that only lives for one frame, dynamic geometry, debug lines, per draw constants.
+		One persistently mapped buffer usable as vertex, index, uniform and storage data is split into a region per frame in flight,
+		allocating is a pointer bump and the whole region is reclaimed once the graphics submit that read it has finished.
+	*/
+	class TransientAllocator
+	{
+	public:
+
+		void Init(vulkan::Device* device, size_t frameSize);
+
+		void Dispose();
+
+		// Moves on to the next frame's region, waiting for the GPU to finish with it if needed
+		void BeginFrame();
+
+		// Makes this frame's writes visible to the device, the memory isn't guaranteed to be coherent. Call before submitting work that reads them
+		void Flush();
+
+		// The graphics submit that reads this frame's region
+		void EndFrame(uint64_t graphicsSubmitValue);
+
+		// Thread safe. The offset is aligned to align and to whatever the usage needs as a binding offset
+		TransientAllocation Allocate(size_t size, size_t align, vulkan::BufferUsage usage);
+
+		TransientAllocation Allocate(const void* data, size_t size, size_t align, vulkan::BufferUsage usage);
+
+	private:
+
+		vulkan::Device* m_Device;
+
+		vulkan::Buffer m_Buffer;
+		uint8_t* m_Mapped = nullptr;
+
+		size_t m_FrameSize = 0;
+
+		size_t m_UniformAlignment = 256;
+		size_t m_StorageAlignment = 256;
+
+		uint32_t m_Frame = 0;
+		std::atomic<size_t> m_Offset = 0;
+
+		uint64_t m_RetireValues[vulkan::MaxImagesInFlight] = {};
+	};
+}
@@ -0,0 +1,101 @@
+#include "UniformRing.h"
+#include <algorithm>
+#include <cstring>
+
+namespace hf
+{
+	void UniformRing::Init(vulkan::Device* device, size_t frameSize, size_t maxAllocationSize)
+	{
+		m_Device = device;
+
+		const vulkan::SupportedFeatures& features = m_Device->GetSupportedFeatures();
+
+		m_Alignment = std::max<size_t>(features.minUniformBufferOffsetAlignment, 16);
+		m_Range = std::min(maxAllocationSize, features.maxUniformBufferRange);
+
+		// Keep every region aligned so the offsets handed out are too
+		m_FrameSize = (frameSize + m_Alignment - 1) & ~(m_Alignment - 1);
+
+		// The range past the last region means an allocation at the very end still has a whole range behind it
+		vulkan::BufferDesc bufferDesc{};
+		bufferDesc.usage = vulkan::BufferUsage::Uniform;
+		bufferDesc.visibility = vulkan::BufferVisibility::HostVisible;
+		bufferDesc.bufferSize = m_FrameSize * vulkan::MaxImagesInFlight + m_Range;
+
+		m_Buffer = m_Device->CreateBuffer(bufferDesc);
+		m_Mapped = (uint8_t*)m_Buffer.Map();
+
+		m_Layout.AddDynamicUniformBuffer(ShaderStage::All, 0, 1);
+
+		m_Set = m_Device->AllocateDescriptorSet(m_Layout);
+		m_Set.BindDynamicUniformBuffer(m_Buffer, 0, m_Range);
+		m_Set.Write();
+	}
+
+	void UniformRing::Dispose()
+	{
+		m_Set.Dispose();
+		m_Buffer.Dispose();
+	}
+
+	void UniformRing::BeginFrame()
+	{
+		m_Frame = (m_Frame + 1) % vulkan::MaxImagesInFlight;
+
+		m_Device->WaitForSubmit(vulkan::Queue::Graphics, m_RetireValues[m_Frame]);
+
+		m_Offset = 0;
+	}
+
+	void UniformRing::Flush()
+	{
+		// A failed allocation still bumps the offset past the end of the region
+		size_t used = std::min(m_Offset.load(), m_FrameSize);
+
+		if (used > 0)
+			m_Buffer.Flush(m_FrameSize * m_Frame, used);
+	}
+
+	void UniformRing::EndFrame(uint64_t graphicsSubmitValue)
+	{
+		m_RetireValues[m_Frame] = graphicsSubmitValue;
+	}
+
+	UniformAllocation UniformRing::Allocate(size_t size)
+	{
+		UniformAllocation allocation{};
+
+		if (size > m_Range)
+		{
+			Log::Error("Uniform allocation of %zu bytes is bigger than the ring's range (%zu bytes)", size, m_Range);
+			return allocation;
+		}
+
+		size_t alignedSize = (size + m_Alignment - 1) & ~(m_Alignment - 1);
+		size_t offset = m_Offset.fetch_add(alignedSize);
+
+		if (offset + alignedSize > m_FrameSize)
+		{
+			Log::Error("Uniform ring is out of space for this frame");
+			return allocation;
+		}
+
+		size_t ringOffset = m_FrameSize * m_Frame + offset;
+
+		allocation.set = &m_Set;
+		allocation.dynamicOffset = (uint32_t)ringOffset;
+		allocation.data = m_Mapped + ringOffset;
+
+		return allocation;
+	}
+
+	UniformAllocation UniformRing::Allocate(const void* data, size_t size)
+	{
+		UniformAllocation allocation = Allocate(size);
+
+		if (allocation.data)
+			memcpy(allocation.data, data, size);
+
+		return allocation;
+	}
+}
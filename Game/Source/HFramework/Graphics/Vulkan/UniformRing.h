@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../../Vulkan/Device.h"
+#include <atomic>
+
+namespace hf
+{
+	struct UniformAllocation
+	{
+		// Bind with dynamicOffset as the set's dynamic offset
+		vulkan::DescriptorSet* set = nullptr;
+		uint32_t dynamicOffset = 0;
+
+		// Where to write the uniform data, nullptr if the allocation failed
+		void* data = nullptr;
+	};
+
+	/*
+		A persistently mapped uniform buffer split into one region per frame in flight.
+		Allocations are a bump of the current frame's offset and every allocation shares the same
+		dynamic uniform buffer set, only the dynamic offset changes between draws.
+		A region is only reused once the graphics submit of the frame that filled it has finished.
+	*/
+	class UniformRing
+	{
+	public:
+
+		// maxAllocationSize is the range every draw sees through the set so no single allocation can be bigger
+		void Init(vulkan::Device* device, size_t frameSize, size_t maxAllocationSize = 16 * 1024);
+
+		void Dispose();
+
+		// Moves on to the next frame's region, waiting for the GPU to finish with it if needed
+		void BeginFrame();
+
+		// Makes this frame's writes visible to the device, the memory isn't guaranteed to be coherent. Call before submitting work that reads them
+		void Flush();
+
+		// The graphics submit that reads this frame's region
+		void EndFrame(uint64_t graphicsSubmitValue);
+
+		// Thread safe
+		UniformAllocation Allocate(size_t size);
+
+		UniformAllocation Allocate(const void* data, size_t size);
+
+		// For building your own sets with a dynamic uniform buffer that points into the ring
+		vulkan::Buffer& GetBuffer() { return m_Buffer; }
+
+		size_t GetRange() const { return m_Range; }
+
+		// The layout of the ring's own set, a single dynamic uniform buffer at binding 0 visible to all stages
+		const vulkan::DescriptorSetLayout& GetLayout() const { return m_Layout; }
+
+	private:
+
+		vulkan::Device* m_Device;
+
+		vulkan::Buffer m_Buffer;
+		uint8_t* m_Mapped = nullptr;
+
+		vulkan::DescriptorSetLayout m_Layout;
+		vulkan::DescriptorSet m_Set;
+
+		size_t m_FrameSize = 0;
+		size_t m_Range = 0;
+		size_t m_Alignment = 256;
+
+		uint32_t m_Frame = 0;
+		std::atomic<size_t> m_Offset = 0;
+
+		uint64_t m_RetireValues[vulkan::MaxImagesInFlight] = {};
+	};
+}
@@ -0,0 +1,637 @@
+#include "UploadQueue.h"
+#include <algorithm>
+#include <map>
+
+namespace hf
+{
+	struct StagedWrite
+	{
+		size_t end;
+		size_t srcOffset;
+	};
+
+	// Later writes win. Returns non overlapping regions in destination order with touching ones joined
+	static std::vector<vulkan::BufferCopy> ResolveBufferWrites(const std::vector<vulkan::BufferCopy>& writes)
+	{
+		// Keyed by destination offset
+		std::map<size_t, StagedWrite> resolved;
+
+		for (auto& write : writes)
+		{
+			size_t start = write.dstOffset;
+			size_t end = write.dstOffset + write.size;
+
+			// Start from the last range beginning before this write as it may reach into it
+			auto it = resolved.upper_bound(start);
+			if (it != resolved.begin())
+				it--;
+
+			while (it != resolved.end() && it->first < end)
+			{
+				size_t rangeStart = it->first;
+				StagedWrite range = it->second;
+
+				if (range.end <= start)
+				{
+					it++;
+					continue;
+				}
+
+				it = resolved.erase(it);
+
+				// Keep whatever sticks out either side
+				if (rangeStart < start)
+					resolved[rangeStart] = { start, range.srcOffset };
+
+				if (range.end > end)
+					it = resolved.insert({ end, { range.end, range.srcOffset + (end - rangeStart) } }).first;
+			}
+
+			resolved[start] = { end, write.srcOffset };
+		}
+
+		std::vector<vulkan::BufferCopy> regions;
+
+		for (auto& [start, range] : resolved)
+		{
+			size_t size = range.end - start;
+
+			if (!regions.empty())
+			{
+				vulkan::BufferCopy& last = regions.back();
+
+				if (last.dstOffset + last.size == start && last.srcOffset + last.size == range.srcOffset)
+				{
+					last.size += size;
+					continue;
+				}
+			}
+
+			regions.push_back({ range.srcOffset, start, size });
+		}
+
+		return regions;
+	}
+
+	void UploadQueue::Init(vulkan::Device* device, size_t stagingSize)
+	{
+		m_Device = device;
+
+		// Every allocation is a multiple of 16 so the ring has to be as well
+		m_Staging.size = (stagingSize + 15) & ~(size_t)15;
+		m_ChunkSize = m_Staging.size / 4;
+
+		vulkan::BufferDesc stagingDesc{};
+		stagingDesc.usage = vulkan::BufferUsage::TransferSrc;
+		stagingDesc.visibility = vulkan::BufferVisibility::HostVisible;
+		stagingDesc.bufferSize = m_Staging.size;
+
+		m_Staging.buffer = m_Device->CreateBuffer(stagingDesc);
+		m_Staging.mapped = (uint8_t*)m_Staging.buffer.Map();
+
+		m_TransferLists = m_Device->AllocateCommandLists(vulkan::Queue::Transfer, vulkan::CommandListType::Primary, ListCount);
+		m_AcquireLists = m_Device->AllocateCommandLists(vulkan::Queue::Graphics, vulkan::CommandListType::Primary, ListCount);
+		m_ReleaseLists = m_Device->AllocateCommandLists(vulkan::Queue::Graphics, vulkan::CommandListType::Primary, ListCount);
+
+		// The lists come from this thread's command pools so only it can record them
+		m_FlushThread = std::this_thread::get_id();
+	}
+
+	void UploadQueue::Dispose()
+	{
+		m_Staging.buffer.Dispose();
+	}
+
+	void UploadQueue::QueueBufferCopy(void* data, size_t size, vulkan::Buffer* dst, size_t dstOffset)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		CopyData copyData{};
+		copyData.op = CopyData::CopyOp::Buffer;
+		copyData.buffer = dst;
+
+		m_Stats.copiesQueued++;
+
+		if (size <= m_ChunkSize)
+		{
+			if (MergeIntoPendingCopy(data, size, dst, dstOffset))
+				return;
+
+			copyData.size = size;
+			copyData.dstOffset = dstOffset;
+
+			QueueCopy(copyData, data);
+			return;
+		}
+
+		m_Streaming.insert(dst);
+
+		for (size_t done = 0; done < size; done += m_ChunkSize)
+		{
+			copyData.size = std::min(m_ChunkSize, size - done);
+			copyData.dstOffset = dstOffset + done;
+
+			QueueCopy(copyData, (char*)data + done);
+		}
+
+		m_Streaming.erase(dst);
+	}
+
+	void UploadQueue::QueueTextureCopy(void* data, size_t size, vulkan::Texture* dst, const vulkan::BufferImageCopy& region)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		QueueTextureRegion(data, size, dst, region);
+	}
+
+	void UploadQueue::QueueTextureCopies(const void* data, size_t size, vulkan::Texture* dst, const std::vector<vulkan::BufferImageCopy>& regions)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Small enough to stage in one go, every region then copies out of the same allocation
+		if (size <= m_ChunkSize)
+		{
+			CopyData copyData{};
+			copyData.op = CopyData::CopyOp::Texture;
+			copyData.texture = dst;
+
+			size_t stagingOffset;
+			if (!WriteStaging(data, size, &stagingOffset))
+				return;
+
+			m_Stats.bytesStaged += size;
+
+			for (auto& region : regions)
+			{
+				m_Stats.copiesQueued++;
+
+				copyData.size = 0;
+				copyData.region = region;
+				copyData.region.bufferOffset += stagingOffset;
+
+				m_CopyData.push_back(copyData);
+			}
+
+			return;
+		}
+
+		// Otherwise each region is staged on its own so the big ones can be split.
+		// A region's data runs up to the next region's or the end of data
+		m_Streaming.insert(dst);
+
+		for (auto& region : regions)
+		{
+			size_t end = size;
+			for (auto& other : regions)
+			{
+				if (other.bufferOffset > region.bufferOffset && other.bufferOffset < end)
+					end = other.bufferOffset;
+			}
+
+			vulkan::BufferImageCopy regionCopy = region;
+			regionCopy.bufferOffset = 0;
+
+			QueueTextureRegion((const uint8_t*)data + region.bufferOffset, end - region.bufferOffset, dst, regionCopy);
+		}
+
+		m_Streaming.erase(dst);
+	}
+
+	void UploadQueue::QueueTextureRegion(const void* data, size_t size, vulkan::Texture* dst, const vulkan::BufferImageCopy& region)
+	{
+		CopyData copyData{};
+		copyData.op = CopyData::CopyOp::Texture;
+		copyData.texture = dst;
+
+		m_Stats.copiesQueued++;
+
+		// Only tightly packed data can be split, anything else has to fit in the ring in one go
+		if (size <= m_ChunkSize || region.bufferRowLength || region.bufferImageHeight)
+		{
+			copyData.size = size;
+			copyData.region = region;
+
+			QueueCopy(copyData, data);
+			return;
+		}
+
+		uint32_t slices = region.layerCount * region.extent.depth;
+		size_t sliceSize = (size - region.bufferOffset) / slices;
+		size_t rowSize = sliceSize / region.extent.height;
+		uint32_t rowsPerChunk = (uint32_t)std::max<size_t>(m_ChunkSize / rowSize, 1);
+
+		const char* texels = (const char*)data + region.bufferOffset;
+
+		// Nested inside QueueTextureCopies the outer call keeps the texture streaming until every region is queued
+		bool outerStream = !m_Streaming.insert(dst).second;
+
+		for (uint32_t slice = 0; slice < slices; slice++)
+		{
+			for (uint32_t row = 0; row < region.extent.height; row += rowsPerChunk)
+			{
+				uint32_t rows = std::min(rowsPerChunk, region.extent.height - row);
+
+				copyData.size = rows * rowSize;
+				copyData.region = region;
+				copyData.region.bufferOffset = 0;
+				copyData.region.baseArrayLayer = region.baseArrayLayer + slice / region.extent.depth;
+				copyData.region.layerCount = 1;
+				copyData.region.offset.z = region.offset.z + slice % region.extent.depth;
+				copyData.region.extent.depth = 1;
+				copyData.region.offset.y = region.offset.y + row;
+				copyData.region.extent.height = rows;
+
+				QueueCopy(copyData, texels + slice * sliceSize + row * rowSize);
+			}
+		}
+
+		if (!outerStream)
+			m_Streaming.erase(dst);
+	}
+
+	bool UploadQueue::CopyFromHost(const void* data, vulkan::Texture* dst, const std::vector<vulkan::BufferImageCopy>& regions)
+	{
+		// Held through the copy so nothing can be queued for the texture in between
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if (HasPendingUpload(dst))
+			return false;
+
+		return dst->CopyFromHost(data, regions);
+	}
+
+	bool UploadQueue::HasPendingUpload(vulkan::Texture* texture)
+	{
+		if (m_Streaming.count(texture) || m_InTransferLayout.count(texture))
+			return true;
+
+		if (std::find(m_PendingAcquireTextures.begin(), m_PendingAcquireTextures.end(), texture) != m_PendingAcquireTextures.end())
+			return true;
+
+		auto transfer = m_TextureTransfers.find(texture);
+		if (transfer != m_TextureTransfers.end())
+		{
+			if (!m_Device->HasCompleted(vulkan::Queue::Transfer, transfer->second))
+				return true;
+
+			m_TextureTransfers.erase(transfer);
+		}
+
+		for (auto& data : m_CopyData)
+		{
+			if (data.op == CopyData::CopyOp::Texture && data.texture == texture)
+				return true;
+		}
+
+		return false;
+	}
+
+	void UploadQueue::Flush()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		Submit();
+	}
+
+	void UploadQueue::QueueCopy(const CopyData& copyData, const void* data)
+	{
+		CopyData queued = copyData;
+
+		if (!WriteStaging(data, copyData.size, &queued.stagingOffset))
+			return;
+
+		m_Stats.bytesStaged += copyData.size;
+
+		if (queued.op == CopyData::CopyOp::Texture)
+			queued.region.bufferOffset += queued.stagingOffset;
+		else
+			m_PendingBufferCopies[queued.buffer].push_back((uint32_t)m_CopyData.size());
+
+		m_CopyData.push_back(queued);
+	}
+
+	bool UploadQueue::MergeIntoPendingCopy(void* data, size_t size, vulkan::Buffer* dst, size_t dstOffset)
+	{
+		auto it = m_PendingBufferCopies.find(dst);
+
+		if (it == m_PendingBufferCopies.end())
+			return false;
+
+		// Newest first, a newer overlapping copy would win over anything written into an older one
+		for (auto index = it->second.rbegin(); index != it->second.rend(); index++)
+		{
+			CopyData& pending = m_CopyData[*index];
+
+			if (dstOffset >= pending.dstOffset && dstOffset + size <= pending.dstOffset + pending.size)
+			{
+				memcpy(m_Staging.mapped + pending.stagingOffset + (dstOffset - pending.dstOffset), data, size);
+
+				m_Stats.writesMergedInPlace++;
+				return true;
+			}
+
+			if (dstOffset < pending.dstOffset + pending.size && pending.dstOffset < dstOffset + size)
+				return false;
+		}
+
+		return false;
+	}
+
+	UploadStats UploadQueue::GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		return m_Stats;
+	}
+
+	void UploadQueue::Submit()
+	{
+		if (m_CopyData.empty())
+			return;
+
+		uint32_t transferFamily = m_Device->GetQueueFamily(vulkan::Queue::Transfer);
+		uint32_t graphicsFamily = m_Device->GetQueueFamily(vulkan::Queue::Graphics);
+
+		// Begin waits for the list's last submit if it is still in flight
+		vulkan::CommandList& transferList = m_TransferLists[m_TransferIndex];
+		m_TransferIndex = (m_TransferIndex + 1) % ListCount;
+
+		// Resources the graphics queue already has are released from it first, recorded as they are found
+		vulkan::CommandList& releaseList = m_ReleaseLists[m_ReleaseIndex];
+		bool releasing = false;
+
+		auto beginRelease = [&]()
+		{
+			if (releasing)
+				return;
+
+			m_ReleaseIndex = (m_ReleaseIndex + 1) % ListCount;
+			releaseList.Begin();
+			releasing = true;
+		};
+
+		// Each resource only needs releasing once no matter how many copies went into it
+		std::vector<vulkan::Buffer*> buffers;
+		std::vector<vulkan::Texture*> textures;
+		std::unordered_set<void*> seen;
+
+		transferList.Begin();
+
+		for (auto& data : m_CopyData)
+		{
+			switch (data.op)
+			{
+			case CopyData::CopyOp::Buffer:
+			{
+				// Every write to the buffer goes into one copy when the buffer is first seen
+				if (!seen.insert(data.buffer).second)
+					break;
+
+				// Released by an earlier submit this frame but graphics hasn't acquired it yet, so it is still the transfer queue's.
+				// Releasing it from graphics now would come before that acquire
+				bool pendingAcquire = std::find(m_PendingAcquireBuffers.begin(), m_PendingAcquireBuffers.end(), data.buffer) != m_PendingAcquireBuffers.end();
+
+				// Handed to graphics by an earlier frame, or written from the host and still being read by frames in flight.
+				// Either way take it back from graphics so the copy lands after those reads
+				uint32_t family = data.buffer->GetQueueFamily();
+				if (!pendingAcquire && (family == graphicsFamily || (family == VK_QUEUE_FAMILY_IGNORED && data.buffer->IsInFlight())))
+				{
+					beginRelease();
+					releaseList.TransferOwnership(data.buffer, graphicsFamily, transferFamily);
+					transferList.TransferOwnership(data.buffer, graphicsFamily, transferFamily);
+				}
+
+				std::vector<vulkan::BufferCopy> writes;
+
+				for (uint32_t index : m_PendingBufferCopies[data.buffer])
+				{
+					CopyData& write = m_CopyData[index];
+					writes.push_back({ write.stagingOffset, write.dstOffset, write.size });
+				}
+
+				std::vector<vulkan::BufferCopy> regions = ResolveBufferWrites(writes);
+
+				transferList.CopyBuffer(&m_Staging.buffer, data.buffer, regions);
+
+				m_Stats.copiesRecorded++;
+				for (auto& region : regions)
+					m_Stats.bytesCopied += region.size;
+
+				buffers.push_back(data.buffer);
+
+				break;
+			}
+			case CopyData::CopyOp::Texture:
+
+				// Only transition on the first copy so earlier regions aren't discarded, including ones from an earlier submit
+				if (seen.insert(data.texture).second)
+				{
+					VkImageLayout layout = data.texture->GetLayout();
+
+					if (m_InTransferLayout.find(data.texture) != m_InTransferLayout.end())
+					{
+						// Still ours from the last submit
+					}
+					else if (std::find(m_PendingAcquireTextures.begin(), m_PendingAcquireTextures.end(), data.texture) != m_PendingAcquireTextures.end())
+					{
+						// Released by an earlier submit this frame and not acquired yet, still ours but already moved to the read layout
+						transferList.TransferOwnership(data.texture, transferFamily, transferFamily, (vulkan::ImageLayout)layout, vulkan::ImageLayout::TransferDst);
+					}
+					else if (layout == VK_IMAGE_LAYOUT_UNDEFINED)
+					{
+						transferList.TransferOwnership(data.texture, transferFamily, transferFamily, vulkan::ImageLayout::Undefined, vulkan::ImageLayout::TransferDst);
+					}
+					else
+					{
+						// Already has contents the graphics queue may be reading, transition from where it is rather than discarding them.
+						// With one family the graphics side does the whole transition and the transfer side has nothing to acquire
+						beginRelease();
+						releaseList.TransferOwnership(data.texture, graphicsFamily, transferFamily, (vulkan::ImageLayout)layout, vulkan::ImageLayout::TransferDst);
+
+						if (transferFamily != graphicsFamily)
+							transferList.TransferOwnership(data.texture, graphicsFamily, transferFamily, (vulkan::ImageLayout)layout, vulkan::ImageLayout::TransferDst);
+					}
+
+					textures.push_back(data.texture);
+				}
+
+				transferList.CopyBufferToTexture(&m_Staging.buffer, data.texture, data.region);
+
+				m_Stats.copiesRecorded++;
+				m_Stats.bytesCopied += data.size;
+
+				break;
+			}
+		}
+
+		m_CopyData.clear();
+		m_PendingBufferCopies.clear();
+
+		// Release to the graphics queue. If the families match buffers need nothing
+		// and textures just get their layout transition. Anything still streaming stays on the transfer queue.
+		// Resources released again before graphics acquired them keep a single acquire, it pairs with the latest release
+		for (auto& buffer : buffers)
+		{
+			if (m_Streaming.count(buffer))
+				continue;
+
+			transferList.TransferOwnership(buffer, transferFamily, graphicsFamily);
+
+			if (std::find(m_PendingAcquireBuffers.begin(), m_PendingAcquireBuffers.end(), buffer) == m_PendingAcquireBuffers.end())
+				m_PendingAcquireBuffers.push_back(buffer);
+		}
+
+		for (auto& texture : textures)
+		{
+			if (m_Streaming.count(texture))
+			{
+				m_InTransferLayout.insert(texture);
+				continue;
+			}
+
+			transferList.TransferOwnership(texture, transferFamily, graphicsFamily, vulkan::ImageLayout::TransferDst, vulkan::ImageLayout::ShaderReadOnlyOptimal);
+			m_InTransferLayout.erase(texture);
+
+			if (std::find(m_PendingAcquireTextures.begin(), m_PendingAcquireTextures.end(), texture) == m_PendingAcquireTextures.end())
+				m_PendingAcquireTextures.push_back(texture);
+		}
+
+		transferList.End();
+
+		// With one family there may be nothing to release but the graphics submit still orders the copies after the frames reading the old contents
+		std::vector<vulkan::TimelineWait> timelineWaits;
+
+		if (releasing)
+		{
+			releaseList.End();
+
+			vulkan::TimelineWait wait{};
+			wait.queue = vulkan::Queue::Graphics;
+			wait.value = m_Device->QueueSubmit(vulkan::Queue::Graphics, { &releaseList }, std::vector<vulkan::Semaphore*>{}, nullptr);
+			timelineWaits.push_back(wait);
+		}
+
+		uint64_t submitValue = m_Device->QueueSubmit(vulkan::Queue::Transfer, { &transferList }, std::vector<vulkan::Semaphore*>{}, nullptr, timelineWaits);
+
+		// Finished ones are only dropped when looked up, so clear them out here too or textures that are never host copied pile up
+		for (auto it = m_TextureTransfers.begin(); it != m_TextureTransfers.end();)
+		{
+			if (m_Device->HasCompleted(vulkan::Queue::Transfer, it->second))
+				it = m_TextureTransfers.erase(it);
+			else
+				it++;
+		}
+
+		for (auto& texture : textures)
+			m_TextureTransfers[texture] = submitValue;
+
+		// Everything written to the ring so far is read by this submit
+		m_Staging.inFlight.push_back({ m_Staging.head, submitValue });
+
+		m_PendingGraphicsWait = true;
+		m_PendingTransferValue = submitValue;
+
+		// Producers waiting on a full ring can wait on the transfer now
+		m_Flushed.notify_all();
+	}
+
+	void UploadQueue::AddGraphicsDependencies(std::vector<vulkan::CommandList*>& cmdLists, std::vector<vulkan::TimelineWait>& timelineWaits)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if (!m_PendingGraphicsWait)
+			return;
+
+		uint32_t transferFamily = m_Device->GetQueueFamily(vulkan::Queue::Transfer);
+		uint32_t graphicsFamily = m_Device->GetQueueFamily(vulkan::Queue::Graphics);
+
+		// One acquire covers every submit since the last frame.
+		// It has to execute before anything that reads the uploaded resources
+		if (transferFamily != graphicsFamily && (!m_PendingAcquireBuffers.empty() || !m_PendingAcquireTextures.empty()))
+		{
+			vulkan::CommandList& acquireList = m_AcquireLists[m_AcquireIndex];
+			m_AcquireIndex = (m_AcquireIndex + 1) % ListCount;
+
+			acquireList.Begin();
+
+			for (auto& buffer : m_PendingAcquireBuffers)
+				acquireList.TransferOwnership(buffer, transferFamily, graphicsFamily);
+
+			for (auto& texture : m_PendingAcquireTextures)
+				acquireList.TransferOwnership(texture, transferFamily, graphicsFamily, vulkan::ImageLayout::TransferDst, vulkan::ImageLayout::ShaderReadOnlyOptimal);
+
+			acquireList.End();
+
+			cmdLists.insert(cmdLists.begin(), &acquireList);
+		}
+
+		m_PendingAcquireBuffers.clear();
+		m_PendingAcquireTextures.clear();
+
+		vulkan::TimelineWait wait{};
+		wait.queue = vulkan::Queue::Transfer;
+		wait.value = m_PendingTransferValue;
+		timelineWaits.push_back(wait);
+
+		m_PendingGraphicsWait = false;
+	}
+
+	bool UploadQueue::WriteStaging(const void* data, size_t size, size_t* stagingOffset)
+	{
+		// Keep every copy aligned so it is a valid image copy offset for any format
+		size_t alignedSize = (size + 15) & ~(size_t)15;
+
+		if (alignedSize > m_Staging.size)
+		{
+			Log::Error("Upload of %zu bytes can't fit in the %zu byte staging ring", size, m_Staging.size);
+			return false;
+		}
+
+		while (true)
+		{
+			ReclaimStaging();
+
+			// Nothing is using the ring so start again from the front rather than padding
+			if (m_Staging.head == m_Staging.tail)
+				m_Staging.head = m_Staging.tail = 0;
+
+			// An allocation can't wrap so skip whatever is left at the end of the ring
+			size_t position = m_Staging.head % m_Staging.size;
+			size_t padding = position + alignedSize > m_Staging.size ? m_Staging.size - position : 0;
+
+			if (m_Staging.size - (m_Staging.head - m_Staging.tail) >= padding + alignedSize)
+			{
+				m_Staging.head += padding;
+				*stagingOffset = m_Staging.head % m_Staging.size;
+				m_Staging.head += alignedSize;
+				break;
+			}
+
+			// Full, wait for the oldest transfer to free its part of the ring
+			if (!m_Staging.inFlight.empty())
+			{
+				m_Device->WaitForSubmit(vulkan::Queue::Transfer, m_Staging.inFlight.front().transferValue);
+				continue;
+			}
+
+			// Everything in the ring is queued but not submitted yet. Only the flushing thread can record, anyone else waits for its next flush
+			if (std::this_thread::get_id() == m_FlushThread)
+				Submit();
+			else
+				m_Flushed.wait(m_Mutex);
+		}
+
+		memcpy(m_Staging.mapped + *stagingOffset, data, size);
+
+		return true;
+	}
+
+	void UploadQueue::ReclaimStaging()
+	{
+		while (!m_Staging.inFlight.empty() && m_Device->HasCompleted(vulkan::Queue::Transfer, m_Staging.inFlight.front().transferValue))
+		{
+			m_Staging.tail = m_Staging.inFlight.front().end;
+			m_Staging.inFlight.pop_front();
+		}
+	}
+}
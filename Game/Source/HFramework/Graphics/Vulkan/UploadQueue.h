@@ -0,0 +1,183 @@
+#pragma once
+
+#include "../../Vulkan/Device.h"
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <unordered_set>
+
+namespace hf
+{
+	struct UploadStats
+	{
+		uint64_t copiesQueued = 0;
+		uint64_t copiesRecorded = 0;
+		uint64_t bytesStaged = 0;
+		uint64_t bytesCopied = 0;
+
+		// Writes that landed inside a copy that hadn't been submitted yet and reused its staging memory
+		uint64_t writesMergedInPlace = 0;
+
+		void Print()
+		{
+			Log::Info("Upload Stats:");
+			Log::Info(" - Copies Queued: %llu", copiesQueued);
+			Log::Info(" - Copies Recorded: %llu", copiesRecorded);
+			Log::Info(" - Bytes Staged: %llu", bytesStaged);
+			Log::Info(" - Bytes Copied: %llu", bytesCopied);
+			Log::Info(" - Writes Merged In Place: %llu", writesMergedInPlace);
+		}
+	};
+
+	/*
+		Records staging copies into buffers and textures on the transfer queue.
+		When the transfer queue is its own family the resources are released by the transfer queue
+		and acquired by the graphics queue before the next frame's work uses them.
+		Resources the graphics queue already has are released back by a graphics submit the transfer submit waits on,
+		so updating part of one keeps the rest of its contents and doesn't race the frames still reading it.
+		Ones released by an earlier submit the graphics queue hasn't acquired them from yet are still the transfer queue's and are written straight away.
+
+		Staging memory is a ring, each flush retires the part of it the transfer submit read once that submit has finished.
+		Copies bigger than a chunk are split so they stream through the ring, when it is full the producer
+		waits for the oldest transfer rather than failing. Only the thread that called Init records and submits, so a producer
+		that fills the ring with copies nobody has submitted yet waits for the next Flush.
+
+		Buffer writes are coalesced per destination. A write inside one that hasn't been submitted yet reuses its staging memory,
+		and at submit later writes replace the parts of earlier ones they cover and touching ranges are joined,
+		so each destination gets a single copy command.
+	*/
+	class UploadQueue
+	{
+	public:
+
+		void Init(vulkan::Device* device, size_t stagingSize = 32 * 1024 * 1024);
+
+		void Dispose();
+
+		void QueueBufferCopy(void* data, size_t size, vulkan::Buffer* dst, size_t dstOffset = 0);
+
+		// The texture is left in ShaderReadOnlyOptimal once the copy has finished.
+		// Tightly packed regions bigger than a chunk are split into rows
+		void QueueTextureCopy(void* data, size_t size, vulkan::Texture* dst, const vulkan::BufferImageCopy& region);
+
+		// Every region of a texture, such as its whole mip chain, staged together. Each region's bufferOffset is an offset into data
+		void QueueTextureCopies(const void* data, size_t size, vulkan::Texture* dst, const std::vector<vulkan::BufferImageCopy>& regions);
+
+		// Writes the regions from the host instead when the texture has no staged copy queued, running on the transfer queue or waiting
+		// for graphics to acquire it. Otherwise the host write would race the transfer or be overwritten by older data, so false is returned
+		bool CopyFromHost(const void* data, vulkan::Texture* dst, const std::vector<vulkan::BufferImageCopy>& regions);
+
+		// Records and submits all queued copies to the transfer queue, only from the thread that called Init
+		void Flush();
+
+		UploadStats GetStats();
+
+		// Adds the acquire command list and the transfer wait the next graphics submit needs
+		void AddGraphicsDependencies(std::vector<vulkan::CommandList*>& cmdLists, std::vector<vulkan::TimelineWait>& timelineWaits);
+
+	private:
+
+		struct CopyData
+		{
+			enum class CopyOp
+			{
+				Buffer,
+				Texture
+			};
+
+			CopyOp op;
+			size_t stagingOffset;
+			size_t size;
+			size_t dstOffset;
+			vulkan::BufferImageCopy region;
+
+			union
+			{
+				vulkan::Buffer* buffer;
+				vulkan::Texture* texture;
+			};
+		};
+
+		vulkan::Device* m_Device;
+
+		// In the order they were queued, which is the order later writes win in
+		std::vector<CopyData> m_CopyData;
+		std::mutex m_Mutex;
+
+		// Waits on m_Mutex, which the producer already holds
+		std::condition_variable_any m_Flushed;
+		std::thread::id m_FlushThread;
+
+		// Indices into m_CopyData of the buffer copies for each destination
+		std::unordered_map<vulkan::Buffer*, std::vector<uint32_t>> m_PendingBufferCopies;
+
+		UploadStats m_Stats;
+
+		struct
+		{
+			size_t size = 0;
+			vulkan::Buffer buffer;
+			uint8_t* mapped = nullptr;
+
+			// Bytes ever allocated and retired, the ring position is head % size
+			size_t head = 0;
+			size_t tail = 0;
+
+			// Everything before end is free once the transfer submit has finished
+			struct Region
+			{
+				size_t end;
+				uint64_t transferValue;
+			};
+
+			std::deque<Region> inFlight;
+
+		} m_Staging;
+
+		// Copies bigger than this are split, small enough that a few can be in flight at once
+		size_t m_ChunkSize = 0;
+
+		// Command lists are cycled so recording doesn't wait on the previous flush
+		static const uint32_t ListCount = vulkan::MaxImagesInFlight;
+
+		std::vector<vulkan::CommandList> m_TransferLists;
+		std::vector<vulkan::CommandList> m_AcquireLists;
+		std::vector<vulkan::CommandList> m_ReleaseLists;
+		uint32_t m_TransferIndex = 0;
+		uint32_t m_AcquireIndex = 0;
+		uint32_t m_ReleaseIndex = 0;
+
+		// Resources being split over several submits keep transfer ownership until the last chunk is queued
+		std::unordered_set<void*> m_Streaming;
+		std::unordered_set<vulkan::Texture*> m_InTransferLayout;
+
+		// The transfer submit that last copied into each texture, dropped once it has finished
+		std::unordered_map<vulkan::Texture*, uint64_t> m_TextureTransfers;
+
+		// Set by submits and consumed by the next graphics submit
+		bool m_PendingGraphicsWait = false;
+		uint64_t m_PendingTransferValue = 0;
+		std::vector<vulkan::Buffer*> m_PendingAcquireBuffers;
+		std::vector<vulkan::Texture*> m_PendingAcquireTextures;
+
+		void QueueCopy(const CopyData& copyData, const void* data);
+
+		void QueueTextureRegion(const void* data, size_t size, vulkan::Texture* dst, const vulkan::BufferImageCopy& region);
+
+		// Writes straight into the staging memory of a queued copy that covers the range, if nothing queued after it overlaps
+		bool MergeIntoPendingCopy(void* data, size_t size, vulkan::Buffer* dst, size_t dstOffset);
+
+		// Records and submits the queued copies, the mutex must be held
+		void Submit();
+
+		// Copies into the staging ring, backing off until there is room. Returns false if it can never fit
+		bool WriteStaging(const void* data, size_t size, size_t* stagingOffset);
+
+		void ReclaimStaging();
+
+		// Queued, streaming, in flight on the transfer queue or waiting to be acquired, the mutex must be held
+		bool HasPendingUpload(vulkan::Texture* texture);
+	};
+}
@@ -0,0 +1,208 @@
+#include "BindlessHeap.h"
+#include "../Core/Log.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void BindlessHeap::Init(VkDevice device, uint32_t textureCount, uint32_t samplerCount, uint32_t storageBufferCount, Timeline* timelines)
+		{
+			m_Device = device;
+			m_Timelines = timelines;
+
+			m_Slots[TextureBinding].capacity = textureCount;
+			m_Slots[SamplerBinding].capacity = samplerCount;
+			m_Slots[StorageBufferBinding].capacity = storageBufferCount;
+
+			VkDescriptorSetLayoutBinding bindings[3]{};
+			bindings[TextureBinding].binding = TextureBinding;
+			bindings[TextureBinding].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			bindings[TextureBinding].descriptorCount = textureCount;
+			bindings[TextureBinding].stageFlags = VK_SHADER_STAGE_ALL;
+
+			bindings[SamplerBinding].binding = SamplerBinding;
+			bindings[SamplerBinding].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+			bindings[SamplerBinding].descriptorCount = samplerCount;
+			bindings[SamplerBinding].stageFlags = VK_SHADER_STAGE_ALL;
+
+			bindings[StorageBufferBinding].binding = StorageBufferBinding;
+			bindings[StorageBufferBinding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[StorageBufferBinding].descriptorCount = storageBufferCount;
+			bindings[StorageBufferBinding].stageFlags = VK_SHADER_STAGE_ALL;
+
+			// Slots can be empty and can be written while the set is bound in command lists still in flight
+			VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+			VkDescriptorBindingFlags bindingFlags[3] = { flags, flags, flags };
+
+			VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+			bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+			bindingFlagsInfo.bindingCount = 3;
+			bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+			VkDescriptorSetLayoutCreateInfo layoutInfo{};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.pNext = &bindingFlagsInfo;
+			layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+			layoutInfo.bindingCount = 3;
+			layoutInfo.pBindings = bindings;
+
+			if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_Layout) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to create bindless descriptor set layout");
+			}
+
+			VkDescriptorPoolSize poolSizes[3]{};
+			poolSizes[0] = { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, textureCount };
+			poolSizes[1] = { VK_DESCRIPTOR_TYPE_SAMPLER, samplerCount };
+			poolSizes[2] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, storageBufferCount };
+
+			VkDescriptorPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+			poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+			poolInfo.maxSets = 1;
+			poolInfo.poolSizeCount = 3;
+			poolInfo.pPoolSizes = poolSizes;
+
+			if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_Pool) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to create bindless descriptor pool");
+			}
+
+			VkDescriptorSetAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = m_Pool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &m_Layout;
+
+			if (vkAllocateDescriptorSets(m_Device, &allocInfo, &m_Set) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to allocate bindless descriptor set");
+			}
+
+			Log::Info("Created Bindless Heap (%d textures, %d samplers, %d storage buffers)", textureCount, samplerCount, storageBufferCount);
+		}
+
+		void BindlessHeap::Dispose()
+		{
+			vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+			vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+		}
+
+		uint32_t BindlessHeap::AddTexture(VkImageView view)
+		{
+			uint32_t index = Allocate(TextureBinding);
+
+			if (index == InvalidIndex)
+				return index;
+
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.imageView = view;
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+			Write(TextureBinding, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &imageInfo, nullptr);
+
+			return index;
+		}
+
+		uint32_t BindlessHeap::AddSampler(VkSampler sampler)
+		{
+			uint32_t index = Allocate(SamplerBinding);
+
+			if (index == InvalidIndex)
+				return index;
+
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.sampler = sampler;
+
+			Write(SamplerBinding, index, VK_DESCRIPTOR_TYPE_SAMPLER, &imageInfo, nullptr);
+
+			return index;
+		}
+
+		uint32_t BindlessHeap::AddStorageBuffer(VkBuffer buffer)
+		{
+			uint32_t index = Allocate(StorageBufferBinding);
+
+			if (index == InvalidIndex)
+				return index;
+
+			VkDescriptorBufferInfo bufferInfo{};
+			bufferInfo.buffer = buffer;
+			bufferInfo.offset = 0;
+			bufferInfo.range = VK_WHOLE_SIZE;
+
+			Write(StorageBufferBinding, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &bufferInfo);
+
+			return index;
+		}
+
+		void BindlessHeap::Release(uint32_t binding, uint32_t index)
+		{
+			if (index == InvalidIndex)
+				return;
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			RetiredSlot slot{};
+			slot.index = index;
+
+			for (uint32_t i = 0; i < 3; i++)
+				slot.submitValues[i] = m_Timelines[i].GetSubmittedValue();
+
+			m_Slots[binding].retired.push(slot);
+		}
+
+		uint32_t BindlessHeap::Allocate(uint32_t binding)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			Slots& slots = m_Slots[binding];
+
+			// Reclaim anything the GPU has finished with, they retire in order so stop at the first that isn't done
+			while (!slots.retired.empty())
+			{
+				RetiredSlot& slot = slots.retired.front();
+
+				bool complete = true;
+				for (uint32_t i = 0; i < 3; i++)
+					complete = complete && m_Timelines[i].IsComplete(slot.submitValues[i]);
+
+				if (!complete)
+					break;
+
+				slots.free.push_back(slot.index);
+				slots.retired.pop();
+			}
+
+			if (!slots.free.empty())
+			{
+				uint32_t index = slots.free.back();
+				slots.free.pop_back();
+				return index;
+			}
+
+			if (slots.next < slots.capacity)
+				return slots.next++;
+
+			Log::Error("Bindless heap is full (binding %d, capacity %d)", binding, slots.capacity);
+			return InvalidIndex;
+		}
+
+		void BindlessHeap::Write(uint32_t binding, uint32_t index, VkDescriptorType type, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo)
+		{
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = m_Set;
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.dstArrayElement = index;
+			descriptorWrite.descriptorType = type;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pImageInfo = imageInfo;
+			descriptorWrite.pBufferInfo = bufferInfo;
+
+			// Update after bind sets still need external synchronisation between writers
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			vkUpdateDescriptorSets(m_Device, 1, &descriptorWrite, 0, nullptr);
+		}
+	}
+}
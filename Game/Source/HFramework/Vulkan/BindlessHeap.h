@@ -0,0 +1,87 @@
+#pragma once
+#include "VulkanInclude.h"
+#include "Timeline.h"
+#include <vector>
+#include <queue>
+#include <mutex>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		/*
+			One global descriptor set holding every texture, sampler and storage buffer in large partially bound arrays.
+			Resources get a stable index into their array when created and shaders pick them by index (usually from a push constant)
+			so nothing needs binding per draw. Pipelines opt in with useBindlessHeap and get the heap at set 0.
+
+			Shader side:
+				layout(set = 0, binding = 0) uniform texture2D textures[];
+				layout(set = 0, binding = 1) uniform sampler samplers[];
+				layout(set = 0, binding = 2) buffer Buffers { ... } buffers[];
+		*/
+		class BindlessHeap
+		{
+		public:
+
+			static const uint32_t TextureBinding = 0;
+			static const uint32_t SamplerBinding = 1;
+			static const uint32_t StorageBufferBinding = 2;
+
+			static const uint32_t InvalidIndex = UINT32_MAX;
+
+			uint32_t GetCapacity(uint32_t binding) const { return m_Slots[binding].capacity; }
+
+		private:
+
+			friend class Device;
+			friend class CommandList;
+			friend class Texture;
+			friend class Buffer;
+			friend class Defragmenter;
+
+			void Init(VkDevice device, uint32_t textureCount, uint32_t samplerCount, uint32_t storageBufferCount, Timeline* timelines);
+
+			void Dispose();
+
+			uint32_t AddTexture(VkImageView view);
+
+			uint32_t AddSampler(VkSampler sampler);
+
+			uint32_t AddStorageBuffer(VkBuffer buffer);
+
+			// The slot isn't reused until every queue has finished the work submitted before the release
+			void Release(uint32_t binding, uint32_t index);
+
+			struct RetiredSlot
+			{
+				uint32_t index;
+				uint64_t submitValues[3];
+			};
+
+			struct Slots
+			{
+				uint32_t capacity = 0;
+				uint32_t next = 0;
+				std::vector<uint32_t> free;
+				std::queue<RetiredSlot> retired;
+			};
+
+			Slots m_Slots[3];
+
+			uint32_t Allocate(uint32_t binding);
+
+			void Write(uint32_t binding, uint32_t index, VkDescriptorType type, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo);
+
+			VkDevice m_Device;
+
+			VkDescriptorPool m_Pool = VK_NULL_HANDLE;
+			VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+			VkDescriptorSet m_Set = VK_NULL_HANDLE;
+
+			// The device's queue timelines, indexed by Queue
+			Timeline* m_Timelines = nullptr;
+
+			std::mutex m_Mutex;
+		};
+	}
+}
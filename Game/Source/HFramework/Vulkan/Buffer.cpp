@@ -1,5 +1,8 @@
 
 #include "Buffer.h"
+#include "Defragmenter.h"
+#include "ResidencyManager.h"
+#include "Device.h"
 #include "../Core/Log.h"
 
 namespace hf
@@ -8,12 +11,21 @@ namespace hf
 	{
 		void Buffer::Dispose()
 		{
+			if (m_Defragmenter)
+				m_Defragmenter->Unregister(this);
+
+			if (m_Residency)
+				m_Residency->manager->Unregister(this);
+
 			if (m_Mapped)
 			{
 				vmaUnmapMemory(m_AssociatedAllocator, m_Allocation);
 			}
 
 			vmaDestroyBuffer(m_AssociatedAllocator, m_Buffer, m_Allocation);
+
+			if (m_Heap)
+				m_Heap->Release(BindlessHeap::StorageBufferBinding, m_HeapIndex);
 		}
 
 		void* Buffer::Map()
@@ -51,9 +63,55 @@ namespace hf
 		}
 
 
+		void Buffer::MarkUsed()
+		{
+			if (m_Device)
+				std::atomic_ref<uint64_t>(m_LastUsedFrame).store(m_Device->GetFrame(), std::memory_order_relaxed);
+
+			if (m_Residency)
+				m_Residency->MarkUsed();
+		}
+
+		bool Buffer::IsInFlight() const
+		{
+			if (!m_Device)
+				return false;
+
+			uint64_t frame = std::atomic_ref<uint64_t>(const_cast<uint64_t&>(m_LastUsedFrame)).load(std::memory_order_relaxed);
+			return !m_Device->HasCompletedFrame(frame);
+		}
+
+		void Buffer::QueryDeviceAddress()
+		{
+			if (!(m_Usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+				return;
+
+			VkBufferDeviceAddressInfo addressInfo{};
+			addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+			addressInfo.buffer = m_Buffer;
+
+			m_DeviceAddress = vkGetBufferDeviceAddress(m_AssociatedDevice, &addressInfo);
+		}
+
+		void Buffer::Flush(size_t offset, size_t size)
+		{
+			vmaFlushAllocation(m_AssociatedAllocator, m_Allocation, offset, size);
+		}
+
 		void Buffer::Create(const BufferDesc& desc)
 		{
-			VkBufferUsageFlagBits  usage = (VkBufferUsageFlagBits)desc.usage;
+			VkBufferUsageFlags usage = (VkBufferUsageFlags)desc.usage;
+			m_Size = desc.bufferSize;
+
+			// If it doesn't land somewhere host visible it is filled by copies instead
+			if (desc.visibility == BufferVisibility::DevicePreferHostWrite)
+				usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+			// Pooled buffers can be moved by the defragmenter, which copies them
+			if (m_Placement.pool)
+				usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+			m_Usage = usage;
 
 			VkBufferCreateInfo bufferInfo{};
 			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -68,13 +126,49 @@ namespace hf
 			{
 				allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
 			}
+			else if (desc.visibility == BufferVisibility::DevicePreferHostWrite)
+			{
+				// VMA picks device local memory that is also host visible when there is some, otherwise plain device memory
+				allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT;
+			}
 
-			if (vmaCreateBuffer(m_AssociatedAllocator, &bufferInfo, &allocInfo, &m_Buffer, &m_Allocation, nullptr) != VK_SUCCESS)
+			allocInfo.pool = m_Placement.pool;
+
+			if (m_Placement.dedicated)
+				allocInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+			VkResult result = vmaCreateBuffer(m_AssociatedAllocator, &bufferInfo, &allocInfo, &m_Buffer, &m_Allocation, nullptr);
+
+			// The pool's memory type may not suit this buffer's usage
+			if (result != VK_SUCCESS && allocInfo.pool)
+			{
+				// The buffer isn't in the pool, the defragmenter and residency manager mustn't treat it as if it were
+				allocInfo.pool = VK_NULL_HANDLE;
+				m_Placement.pool = VK_NULL_HANDLE;
+				result = vmaCreateBuffer(m_AssociatedAllocator, &bufferInfo, &allocInfo, &m_Buffer, &m_Allocation, nullptr);
+			}
+
+			if (result != VK_SUCCESS)
 			{
 				Log::Error("Failed to Create Buffer");
 				return;
 			}
 
+			m_HandleId = NextHandleId();
+			QueryDeviceAddress();
+
+			if (desc.visibility == BufferVisibility::HostVisible)
+			{
+				m_HostWritable = true;
+			}
+			else if (desc.visibility == BufferVisibility::DevicePreferHostWrite)
+			{
+				VkMemoryPropertyFlags memoryFlags = 0;
+				vmaGetAllocationMemoryProperties(m_AssociatedAllocator, m_Allocation, &memoryFlags);
+
+				m_HostWritable = memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			}
+
 			Log::Info("Successfully Created Buffer");
 
 		}
@@ -1,5 +1,9 @@
 #pragma once
 #include "VulkanInclude.h"
+#include "BindlessHeap.h"
+#include "MemoryPools.h"
+#include "HandleId.h"
+#include <atomic>
 
 namespace hf
 {
@@ -14,7 +18,8 @@ namespace hf
 			ShaderStorage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 			IndirectArguments = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
 			TransferSrc = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			TransferDst = VK_BUFFER_USAGE_TRANSFER_DST_BIT
+			TransferDst = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			ShaderDeviceAddress = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
 		};
 
 		inline BufferUsage operator|(BufferUsage lh, BufferUsage rh)
@@ -26,8 +31,9 @@ namespace hf
 
 		enum class BufferVisibility
 		{
-			HostVisible,	/* Buffer is visible to host and device */
-			Device			/* Buffer is only visible to device*/
+			HostVisible,			/* Buffer is visible to host and device */
+			Device,					/* Buffer is only visible to device*/
+			DevicePreferHostWrite	/* Device local, host visible too when the memory allows it (ReBAR, UMA). Check IsHostWritable */
 		};
 
 		struct BufferDesc
@@ -35,8 +41,16 @@ namespace hf
 			BufferUsage usage;
 			BufferVisibility visibility;
 			size_t bufferSize;
+
+			// HostVisible buffers need a class whose memory is host visible, otherwise the default pools are used
+			MemoryClass memoryClass = MemoryClass::Default;
 		};
 
+		class Device;
+		class Defragmenter;
+		class ResidencyManager;
+		struct ResidencyEntry;
+
 		class Buffer
 		{
 		public:
@@ -47,23 +61,77 @@ namespace hf
 
 			void Unmap();
 
+			// Makes host writes to a mapped range visible to the device, nothing happens for coherent memory
+			void Flush(size_t offset, size_t size);
+
+			// False for DevicePreferHostWrite buffers that ended up in memory the host can't see, those need staging
+			bool IsHostWritable() const { return m_HostWritable; }
+
+			// Stamps the frame for the residency manager. Binding and descriptor writes do it already, bindless users call it themselves
+			void MarkUsed();
+
+			// True while a frame the buffer was last used in may still be running on the GPU, host writes have to wait or be staged
+			bool IsInFlight() const;
+
+			// Index into the bindless heap's storage buffer array, InvalidIndex unless this is a storage buffer and the heap is enabled
+			uint32_t GetHeapIndex() const { return m_HeapIndex; }
+
+			// The queue family the buffer was last handed to, VK_QUEUE_FAMILY_IGNORED until its ownership has been transferred
+			uint32_t GetQueueFamily() const { return m_QueueFamily; }
+
+			// Changes whenever the VkBuffer does, including when it is moved
+			uint64_t GetHandleId() const { return m_HandleId; }
+
+			// Zero unless the buffer was created with ShaderDeviceAddress usage
+			VkDeviceAddress GetDeviceAddress() const { return m_DeviceAddress; }
+
 		private:
 
 			friend class Device;
 			friend class CommandList;
 			friend class DescriptorSet;
+			friend class Defragmenter;
+			friend class ResidencyManager;
 
 			bool m_Mapped = false;
 			void* m_MappedBuffer = nullptr;
 
 			VkBuffer m_Buffer;
 			VmaAllocation m_Allocation;
+			uint64_t m_HandleId = 0;
+			VkDeviceAddress m_DeviceAddress = 0;
+			size_t m_Size = 0;
+			VkBufferUsageFlags m_Usage = 0;
+			bool m_HostWritable = false;
+			uint32_t m_QueueFamily = VK_QUEUE_FAMILY_IGNORED;
+
+			// Released by one queue family and not yet acquired by the other
+			bool m_OwnershipPending = false;
 
 			// Must be set by the device
 			VmaAllocator m_AssociatedAllocator;
 			VkDevice m_AssociatedDevice;
 
+			// Set by the device, buffers it didn't create are never considered in flight
+			Device* m_Device = nullptr;
+			alignas(std::atomic_ref<uint64_t>::required_alignment) uint64_t m_LastUsedFrame = 0;
+
+			BindlessHeap* m_Heap = nullptr;
+			uint32_t m_HeapIndex = BindlessHeap::InvalidIndex;
+
+			// Set by the device from the desc's memory class
+			MemoryPlacement m_Placement;
+
+			// Set while the buffer is registered as movable
+			Defragmenter* m_Defragmenter = nullptr;
+
+			// Set while the buffer is registered as streamable
+			ResidencyEntry* m_Residency = nullptr;
+
 			void Create(const BufferDesc& desc);
+
+			// Queried once per VkBuffer so descriptor writes don't have to
+			void QueryDeviceAddress();
 		};
 
 	}
@@ -2,6 +2,10 @@
 #include "CommandList.h"
 #include "../Core/Log.h"
 #include "TextureUtil.h"
+#include "Device.h"
+#include "../Core/Util.h"
+#include <algorithm>
+#include <cstring>
 
 namespace hf
 {
@@ -9,25 +13,18 @@ namespace hf
 	{
 		bool CommandList::FinishedExecution()
 		{
-			if (m_FinishedExecution)
-			{
-				VkResult result = vkGetFenceStatus(m_Device, m_FinishedExecution); 
+			// If we have no timeline just return finished since the command list hasn't been submitted at all 
+			if (!m_Timeline)
+				return true;
 
-				if (result == VK_SUCCESS)
-					return true;
-				else if (result == VK_NOT_READY)
-					return false; 
-			}
-			
-			// If we have no fence just return finished since the command list hasn't been submitted at all 
-			return true; 
+			return m_Timeline->IsComplete(m_SubmitValue);
 		}
 
 		void CommandList::Begin(RenderpassInfo* info)
 		{
-			if (m_FinishedExecution)
+			if (m_Timeline)
 			{
-				vkWaitForFences(m_Device, 1, &m_FinishedExecution, VK_TRUE, UINT64_MAX);
+				m_Timeline->Wait(m_SubmitValue);
 			}
 
 			VkCommandBufferBeginInfo beginInfo{};
@@ -86,7 +83,8 @@ namespace hf
 			}
 
 			m_SecondaryCommandLists.clear();
-
+			m_DescriptorBufferBound = false;
+			m_DynamicSetCopies.clear();
 		}
 
 		void CommandList::End()
@@ -195,13 +193,37 @@ namespace hf
 		{
 			vkCmdBindPipeline(m_Buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->m_Pipeline);
 
-			m_CurrentGraphicsPipeline = pipeline;
+			m_CurrentLayout = pipeline->m_Layout;
+			m_CurrentBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		}
+
+		void CommandList::BindPipeline(ComputePipeline* pipeline)
+		{
+			vkCmdBindPipeline(m_Buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->m_Pipeline);
+
+			m_CurrentLayout = pipeline->m_Layout;
+			m_CurrentBindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+		}
+
+		bool CommandList::BindPipeline(GraphicsPipelineHandle& pipeline, GraphicsPipeline* fallback)
+		{
+			GraphicsPipeline* ready = pipeline.Get();
+
+			if (!ready)
+				ready = fallback;
+
+			if (!ready)
+				return false;
+
+			BindPipeline(ready);
+			return true;
 		}
 
 		void CommandList::BindVertexBuffer(Buffer* buffer, uint32_t bindPoint, size_t offset)
 		{
 			VkDeviceSize offsets[] = { offset };
 			vkCmdBindVertexBuffers(m_Buffer, bindPoint, 1, &buffer->m_Buffer, offsets);
+			buffer->MarkUsed();
 		}
 
 		void CommandList::BindIndexBuffer(Buffer* buffer, IndexType type, size_t offset)
@@ -224,21 +246,217 @@ namespace hf
 			}
 
 			vkCmdBindIndexBuffer(m_Buffer, buffer->m_Buffer, offset, idxType);
+			buffer->MarkUsed();
 		}
 
-		void CommandList::BindDescriptorSets(std::vector<DescriptorSet*> sets, uint32_t firstSet)
+		void CommandList::BindDescriptorSets(std::vector<DescriptorSet*> sets, uint32_t firstSet, const std::vector<uint32_t>& dynamicOffsets)
 		{
-			if (!m_CurrentGraphicsPipeline)
+			if (!m_CurrentLayout)
 			{
 				Log::Fatal("No Pipeline Bound to bind descriptor set to");
 			}
 
+			// Sets written once and bound every frame only stamp their resources here
+			for (DescriptorSet* set : sets)
+			{
+				bool stale = false;
+
+				for (const DescriptorSet::BoundResource& resource : set->m_Resources)
+				{
+					if (resource.buffer)
+						resource.buffer->MarkUsed();
+					if (resource.texture)
+						resource.texture->MarkUsed();
+
+					stale = stale || resource.IsStale();
+				}
+
+				// Something in the set was moved by the defragmenter or lost a mip to the residency manager
+				if (stale)
+					m_ParentDevice->RefreshDescriptorSet(*set);
+			}
+
+			if (m_ParentDevice->m_SupportedFeatures.descriptorBuffer)
+			{
+				BindDescriptorBufferSets(sets, firstSet, dynamicOffsets);
+				return;
+			}
+
 			std::vector<VkDescriptorSet> s(sets.size());
 
 			for (uint32_t i = 0; i < sets.size(); i++)
 				s[i] = sets[i]->m_Set;
 			
-			vkCmdBindDescriptorSets(m_Buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_CurrentGraphicsPipeline->m_Layout, firstSet, s.size(), s.data(), 0, nullptr);
+			vkCmdBindDescriptorSets(m_Buffer, m_CurrentBindPoint, m_CurrentLayout, firstSet, s.size(), s.data(), dynamicOffsets.size(), dynamicOffsets.data());
+		}
+
+		void CommandList::BindDescriptorBufferSets(std::vector<DescriptorSet*>& sets, uint32_t firstSet, const std::vector<uint32_t>& dynamicOffsets)
+		{
+			Device* device = m_ParentDevice;
+			DescriptorBuffer& descriptorBuffer = device->m_DescriptorBuffer;
+
+			if (!m_DescriptorBufferBound)
+			{
+				VkDescriptorBufferBindingInfoEXT bindingInfo{};
+				bindingInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+				bindingInfo.address = descriptorBuffer.m_Address;
+				bindingInfo.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+
+				device->m_ExtensionFunctions.vkCmdBindDescriptorBuffersEXT(m_Buffer, 1, &bindingInfo);
+				m_DescriptorBufferBound = true;
+			}
+
+			std::vector<uint32_t> bufferIndices(sets.size(), 0);
+			std::vector<VkDeviceSize> offsets(sets.size());
+
+			uint32_t dynamicIndex = 0;
+
+			for (uint32_t i = 0; i < sets.size(); i++)
+			{
+				DescriptorSet* set = sets[i];
+				const DescriptorUpdateTemplate& updateTemplate = *set->m_Template;
+
+				offsets[i] = set->m_BufferOffset;
+
+				if (updateTemplate.dynamicCount == 0)
+					continue;
+
+				if (dynamicIndex + updateTemplate.dynamicCount > dynamicOffsets.size())
+				{
+					Log::Error("Not enough dynamic offsets for the descriptor sets being bound");
+					return;
+				}
+
+				const uint32_t* setDynamicOffsets = dynamicOffsets.data() + dynamicIndex;
+				dynamicIndex += updateTemplate.dynamicCount;
+
+				size_t key = 0;
+				hash_combine(key, set->m_BufferOffset);
+				for (uint32_t d = 0; d < updateTemplate.dynamicCount; d++)
+					hash_combine(key, setDynamicOffsets[d]);
+
+				DynamicSetCopy& cached = m_DynamicSetCopies[key];
+				if (cached.setOffset == set->m_BufferOffset && cached.dynamicOffsets.size() == updateTemplate.dynamicCount &&
+					std::equal(cached.dynamicOffsets.begin(), cached.dynamicOffsets.end(), setDynamicOffsets))
+				{
+					offsets[i] = cached.copyOffset;
+					continue;
+				}
+
+				// Copy the set for this frame and rewrite its dynamic descriptors with the offsets applied
+				VkDeviceSize copyOffset = 0;
+				if (!descriptorBuffer.AllocateTransient(updateTemplate.descriptorBufferSize, &copyOffset))
+					return;
+
+				uint8_t* copy = descriptorBuffer.GetMapped(copyOffset);
+
+				// Sets that are nothing but dynamic bindings (a uniform ring's) are rewritten in full, there is nothing to copy
+				if (updateTemplate.dynamicCount < updateTemplate.descriptorCount)
+					memcpy(copy, descriptorBuffer.GetMapped(set->m_BufferOffset), updateTemplate.descriptorBufferSize);
+
+				device->WriteDescriptorBuffer(*set, copy, setDynamicOffsets);
+
+				cached.setOffset = set->m_BufferOffset;
+				cached.dynamicOffsets.assign(setDynamicOffsets, setDynamicOffsets + updateTemplate.dynamicCount);
+				cached.copyOffset = copyOffset;
+
+				offsets[i] = copyOffset;
+			}
+
+			device->m_ExtensionFunctions.vkCmdSetDescriptorBufferOffsetsEXT(m_Buffer, m_CurrentBindPoint, m_CurrentLayout, firstSet, sets.size(), bufferIndices.data(), offsets.data());
+		}
+
+		void CommandList::BindBindlessHeap(BindlessHeap* heap)
+		{
+			if (!m_CurrentLayout)
+			{
+				Log::Fatal("No Pipeline Bound to bind the bindless heap to");
+			}
+
+			vkCmdBindDescriptorSets(m_Buffer, m_CurrentBindPoint, m_CurrentLayout, 0, 1, &heap->m_Set, 0, nullptr);
+		}
+
+		void CommandList::PushConstants(ShaderStage stage, const void* data, uint32_t size, uint32_t offset)
+		{
+			if (!m_CurrentLayout)
+			{
+				Log::Fatal("No Pipeline Bound to push constants to");
+			}
+
+			VkShaderStageFlags stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+			switch (stage)
+			{
+			case ShaderStage::Vertex:
+				stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+				break;
+			case ShaderStage::Fragment:
+				stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+				break;
+			case ShaderStage::Compute:
+				stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+				break;
+			case ShaderStage::All:
+				stageFlags = (m_CurrentBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_ALL_GRAPHICS;
+				break;
+			}
+
+			vkCmdPushConstants(m_Buffer, m_CurrentLayout, stageFlags, offset, size, data);
+		}
+
+		void CommandList::PushUniformBuffer(Buffer& buffer, uint32_t set, uint32_t binding, size_t offset, size_t range)
+		{
+			VkDescriptorBufferInfo bufferInfo{};
+			bufferInfo.buffer = buffer.m_Buffer;
+			bufferInfo.offset = offset;
+			bufferInfo.range = (range == 0) ? VK_WHOLE_SIZE : range;
+
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfo;
+
+			PushDescriptor(set, descriptorWrite);
+			buffer.MarkUsed();
+		}
+
+		void CommandList::PushTextureSampler(Texture& texture, SamplerState& samplerState, uint32_t set, uint32_t binding, uint32_t arrayElement)
+		{
+			VkDescriptorImageInfo imageInfo{};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = texture.m_ImageView;
+			imageInfo.sampler = m_ParentDevice->GetSampler(samplerState);
+
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.dstArrayElement = arrayElement;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pImageInfo = &imageInfo;
+
+			PushDescriptor(set, descriptorWrite);
+			texture.MarkUsed();
+		}
+
+		void CommandList::PushDescriptor(uint32_t set, const VkWriteDescriptorSet& write)
+		{
+			if (!m_CurrentLayout)
+			{
+				Log::Fatal("No Pipeline Bound to push descriptors to");
+			}
+
+			PFN_vkCmdPushDescriptorSetKHR pushDescriptorSet = m_ParentDevice->m_ExtensionFunctions.vkCmdPushDescriptorSetKHR;
+
+			if (!pushDescriptorSet)
+			{
+				Log::Error("Push descriptors aren't supported on this device");
+				return;
+			}
+
+			pushDescriptorSet(m_Buffer, m_CurrentBindPoint, m_CurrentLayout, set, 1, &write);
 		}
 
 		void CommandList::Draw(uint32_t vertexCount, uint32_t firstVertex, uint32_t instanceCount, uint32_t firstInstance )
@@ -251,6 +469,16 @@ namespace hf
 			vkCmdDrawIndexed(m_Buffer, indexCount, instanceCount, firstIndex, firstVertex, firstInstance);
 		}
 
+		void CommandList::Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
+		{
+			vkCmdDispatch(m_Buffer, groupCountX, groupCountY, groupCountZ);
+		}
+
+		void CommandList::DispatchIndirect(Buffer* buffer, size_t offset)
+		{
+			vkCmdDispatchIndirect(m_Buffer, buffer->m_Buffer, offset);
+		}
+
 		void CommandList::ResourceBarrier(Texture* texture, ImageLayout newLayout)
 		{
 			VkImageMemoryBarrier imgBarrier = {};
@@ -263,9 +491,9 @@ namespace hf
 			imgBarrier.image = texture->m_Image;
 			imgBarrier.subresourceRange.aspectMask = GetAspectMask(texture);
 			imgBarrier.subresourceRange.baseMipLevel = 0;
-			imgBarrier.subresourceRange.levelCount = 1;
+			imgBarrier.subresourceRange.levelCount = texture->m_MipLevels;
 			imgBarrier.subresourceRange.baseArrayLayer = 0;
-			imgBarrier.subresourceRange.layerCount = 1;
+			imgBarrier.subresourceRange.layerCount = texture->m_ArrayLayers;
 			imgBarrier.srcAccessMask = GetAccessMaskFromLayout(imgBarrier.oldLayout, false);
 			imgBarrier.dstAccessMask = GetAccessMaskFromLayout(imgBarrier.newLayout, true);
 
@@ -314,6 +542,68 @@ namespace hf
 			texture->m_Layout = (VkImageLayout)newLayout;
 		}
 
+		void CommandList::TransferOwnership(Buffer* buffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily)
+		{
+			// Tracked even when nothing needs recording so later writers know the buffer has been handed over
+			buffer->m_QueueFamily = dstQueueFamily;
+
+			if (srcQueueFamily == dstQueueFamily)
+				return;
+
+			bool release = (m_QueueFamily == srcQueueFamily);
+			buffer->m_OwnershipPending = release;
+
+			VkBufferMemoryBarrier bufBarrier{};
+			bufBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bufBarrier.srcQueueFamilyIndex = srcQueueFamily;
+			bufBarrier.dstQueueFamilyIndex = dstQueueFamily;
+			bufBarrier.buffer = buffer->m_Buffer;
+			bufBarrier.offset = 0;
+			bufBarrier.size = VK_WHOLE_SIZE;
+
+			// Access masks on the other side of the transfer are ignored
+			// The source could be a transfer or a compute shader so all writes are made available
+			bufBarrier.srcAccessMask = release ? VK_ACCESS_MEMORY_WRITE_BIT : 0;
+			bufBarrier.dstAccessMask = release ? 0 : VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+			VkPipelineStageFlags srcStage = release ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			VkPipelineStageFlags dstStage = release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+			vkCmdPipelineBarrier(m_Buffer, srcStage, dstStage, 0, 0, nullptr, 1, &bufBarrier, 0, nullptr);
+		}
+
+		void CommandList::TransferOwnership(Texture* texture, uint32_t srcQueueFamily, uint32_t dstQueueFamily, ImageLayout oldLayout, ImageLayout newLayout)
+		{
+			bool release = (m_QueueFamily == srcQueueFamily);
+
+			VkImageMemoryBarrier imgBarrier = {};
+			imgBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imgBarrier.oldLayout = static_cast<VkImageLayout>(oldLayout);
+			imgBarrier.newLayout = static_cast<VkImageLayout>(newLayout);
+			imgBarrier.srcQueueFamilyIndex = (srcQueueFamily == dstQueueFamily) ? VK_QUEUE_FAMILY_IGNORED : srcQueueFamily;
+			imgBarrier.dstQueueFamilyIndex = (srcQueueFamily == dstQueueFamily) ? VK_QUEUE_FAMILY_IGNORED : dstQueueFamily;
+			imgBarrier.image = texture->m_Image;
+			imgBarrier.subresourceRange.aspectMask = GetAspectMask(texture);
+			imgBarrier.subresourceRange.baseMipLevel = 0;
+			imgBarrier.subresourceRange.levelCount = texture->m_MipLevels;
+			imgBarrier.subresourceRange.baseArrayLayer = 0;
+			imgBarrier.subresourceRange.layerCount = texture->m_ArrayLayers;
+
+			// When both families match this is a plain layout transition 
+			bool sameFamily = (srcQueueFamily == dstQueueFamily);
+
+			imgBarrier.srcAccessMask = (release || sameFamily) ? GetAccessMaskFromLayout(imgBarrier.oldLayout, false) : 0;
+			imgBarrier.dstAccessMask = (!release || sameFamily) ? GetAccessMaskFromLayout(imgBarrier.newLayout, true) : 0;
+
+			VkPipelineStageFlags srcStage = (release || sameFamily) ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			VkPipelineStageFlags dstStage = (!release || sameFamily) ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+			vkCmdPipelineBarrier(m_Buffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+
+			texture->m_Layout = imgBarrier.newLayout;
+			texture->m_OwnershipPending = release && !sameFamily;
+		}
+
 		void CommandList::CopyBufferToTexture(Buffer* buffer, Texture* texture, const BufferImageCopy& copyInfo)
 		{
 
@@ -345,6 +635,23 @@ namespace hf
 			vkCmdCopyBuffer(m_Buffer, src->m_Buffer, dst->m_Buffer, 1, &copy);
 		}
 
+		void CommandList::CopyBuffer(Buffer* src, Buffer* dst, const std::vector<BufferCopy>& regions)
+		{
+			if (regions.empty())
+				return;
+
+			std::vector<VkBufferCopy> copies(regions.size());
+
+			for (size_t i = 0; i < regions.size(); i++)
+			{
+				copies[i].srcOffset = regions[i].srcOffset;
+				copies[i].dstOffset = regions[i].dstOffset;
+				copies[i].size = regions[i].size;
+			}
+
+			vkCmdCopyBuffer(m_Buffer, src->m_Buffer, dst->m_Buffer, (uint32_t)copies.size(), copies.data());
+		}
+
 		void CommandList::ExecuteCommandList(CommandList* list)
 		{
 			VkCommandBuffer cmd = list->m_Buffer;
@@ -353,5 +660,21 @@ namespace hf
 
 			m_SecondaryCommandLists.push_back(list);
 		}
+
+		void CommandList::ExecuteCommandLists(const std::vector<CommandList*>& lists)
+		{
+			if (lists.empty())
+				return;
+
+			std::vector<VkCommandBuffer> cmds(lists.size());
+
+			for (uint32_t i = 0; i < lists.size(); i++)
+			{
+				cmds[i] = lists[i]->m_Buffer;
+				m_SecondaryCommandLists.push_back(lists[i]);
+			}
+
+			vkCmdExecuteCommands(m_Buffer, cmds.size(), cmds.data());
+		}
 	}
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "VulkanInclude.h"
+#include <unordered_map>
 #include <vector>
 #include "Texture.h"
 #include "GraphicsPipeline.h"
+#include "ComputePipeline.h"
 #include "Buffer.h"
 #include "DescriptorSet.h"
 #include "Texture.h"
+#include "Timeline.h"
+#include "SamplerState.h"
 
 namespace hf
 {
@@ -88,6 +92,15 @@ namespace hf
 			} extent;
 		};
 
+		struct BufferCopy
+		{
+			size_t srcOffset = 0;
+			size_t dstOffset = 0;
+			size_t size = 0;
+		};
+
+
+		class Device;
 
 		class CommandList
 		{
@@ -109,22 +122,56 @@ namespace hf
 
 			void ResourceBarrier(Texture* texture, ImageLayout newLayout);
 
+			/*
+				Queue family ownership transfers. The same barrier has to be recorded on both queues,
+				on the source queue it acts as the release and on the destination queue as the acquire.
+			*/
+
+			void TransferOwnership(Buffer* buffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily);
+
+			void TransferOwnership(Texture* texture, uint32_t srcQueueFamily, uint32_t dstQueueFamily, ImageLayout oldLayout, ImageLayout newLayout);
+
 			/* -- Drawing Functions -- */
 
 			void Draw(uint32_t vertexCount, uint32_t firstVertex, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
 
 			void DrawIndexed(uint32_t indexCount, uint32_t firstIndex, uint32_t firstVertex = 0, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
 
+			/* -- Compute Functions -- */
+
+			void Dispatch(uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1);
+
+			void DispatchIndirect(Buffer* buffer, size_t offset = 0);
+
 
 			/* -- Binding Functions -- */
 
 			void BindPipeline(GraphicsPipeline* pipeline);
 
+			void BindPipeline(ComputePipeline* pipeline);
+
+			// Binds the pipeline if it has finished compiling, otherwise the fallback if one is given.
+			// Returns false if nothing was bound so the caller can skip its draws
+			bool BindPipeline(GraphicsPipelineHandle& pipeline, GraphicsPipeline* fallback = nullptr);
+
 			void BindVertexBuffer(Buffer* buffer, uint32_t bindPoint, size_t offset = 0);
 
 			void BindIndexBuffer(Buffer* buffer, IndexType type, size_t offset = 0);
 
-			void BindDescriptorSets(std::vector<DescriptorSet*> sets, uint32_t firstSet);
+			// One dynamic offset per dynamic binding in the sets, in set then binding order
+			void BindDescriptorSets(std::vector<DescriptorSet*> sets, uint32_t firstSet, const std::vector<uint32_t>& dynamicOffsets = {});
+
+			// Binds the heap at set 0 against the current pipeline, it stays bound across pipelines with the same push constant ranges
+			void BindBindlessHeap(BindlessHeap* heap);
+
+			void PushConstants(ShaderStage stage, const void* data, uint32_t size, uint32_t offset = 0);
+
+			/* -- Push Descriptors -- */
+			// The set must use a layout created with SetPushDescriptor
+
+			void PushUniformBuffer(Buffer& buffer, uint32_t set, uint32_t binding, size_t offset = 0, size_t range = 0);
+
+			void PushTextureSampler(Texture& texture, SamplerState& samplerState, uint32_t set, uint32_t binding, uint32_t arrayElement = 0);
 
 
 			/* Copy Functions */
@@ -133,26 +180,58 @@ namespace hf
 
 			void CopyBuffer(Buffer* src, Buffer* dst, size_t size, size_t srcOffset = 0, size_t dstOffset = 0);
 
+			// One command for every region, destination regions must not overlap
+			void CopyBuffer(Buffer* src, Buffer* dst, const std::vector<BufferCopy>& regions);
+
 			void ExecuteCommandList(CommandList* list);
 
+			void ExecuteCommandLists(const std::vector<CommandList*>& lists);
+
 		private:
 
-			VkFence m_FinishedExecution;
-			
+			// The queue timeline and value signalled when the last submit of this list finished
+			Timeline* m_Timeline = nullptr;
+			uint64_t m_SubmitValue = 0;
 
 			friend class Device;
+			friend class Defragmenter;
+			friend class TransientAttachments;
 
 			VkCommandBuffer m_Buffer;
 
 			VkDevice m_Device;
+			Device* m_ParentDevice = nullptr;
+
+			uint32_t m_QueueFamily = 0;
 
 
-			GraphicsPipeline* m_CurrentGraphicsPipeline = nullptr;
+			// Descriptor sets are bound against whichever pipeline was bound last
+			VkPipelineLayout m_CurrentLayout = VK_NULL_HANDLE;
+			VkPipelineBindPoint m_CurrentBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 			
 			bool m_Secondary = false;
 			bool m_SingleUse = false;
 
 			std::vector<CommandList*> m_SecondaryCommandLists;
+
+			// The descriptor buffer is bound once per recording, the first time sets are bound
+			bool m_DescriptorBufferBound = false;
+
+			// Sets with dynamic offsets are rewritten into the frame's transient region when bound,
+			// binding the same set with the same offsets again in the recording reuses the copy
+			struct DynamicSetCopy
+			{
+				VkDeviceSize setOffset = 0;
+				std::vector<uint32_t> dynamicOffsets;
+				VkDeviceSize copyOffset = 0;
+			};
+
+			// Keyed by a hash of the set's offset and its dynamic offsets, a collision just replaces the entry
+			std::unordered_map<size_t, DynamicSetCopy> m_DynamicSetCopies;
+
+			void PushDescriptor(uint32_t set, const VkWriteDescriptorSet& write);
+
+			void BindDescriptorBufferSets(std::vector<DescriptorSet*>& sets, uint32_t firstSet, const std::vector<uint32_t>& dynamicOffsets);
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "ComputePipeline.h"
+#include "../Core/Log.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void ComputePipeline::Create(VkDevice device, VkPipelineCache cache, VkShaderModule shaderModule, VkPipelineLayout layout, VkPipelineCreateFlags flags, VkPipelineCreationFeedback* feedback)
+		{
+			m_Layout = layout;
+
+			VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+			computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+			computeShaderStageInfo.module = shaderModule;
+			computeShaderStageInfo.pName = "main";
+
+			VkComputePipelineCreateInfo pipelineInfo{};
+			pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+			pipelineInfo.flags = flags;
+			pipelineInfo.stage = computeShaderStageInfo;
+			pipelineInfo.layout = m_Layout;
+			pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+			pipelineInfo.basePipelineIndex = -1;
+
+			VkPipelineCreationFeedbackCreateInfo feedbackInfo{};
+			feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+			feedbackInfo.pPipelineCreationFeedback = feedback;
+
+			if (feedback)
+			{
+				pipelineInfo.pNext = &feedbackInfo;
+			}
+
+			if (vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS)
+			{
+				Log::Error("failed to create compute pipeline!");
+			}
+
+			Log::Info("Successfully Created Compute Pipeline");
+		}
+	}
+}
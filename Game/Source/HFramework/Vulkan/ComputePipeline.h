@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include "VulkanInclude.h"
+#include "GraphicsPipeline.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		struct ComputePipelineDesc
+		{
+			ShaderDesc shader;
+
+			std::vector<DescriptorSetLayout> setLayouts = {};
+
+			// Leave size as 0 for no push constants
+			PushConstantRange pushConstantRange = { 0, 0 };
+
+			// Puts the device's bindless heap at set 0, setLayouts then start at set 1
+			bool useBindlessHeap = false;
+		};
+
+		// Like graphics pipelines these are owned and shared by the device
+		class ComputePipeline
+		{
+		private:
+
+			friend class Device;
+			friend class CommandList;
+
+			VkPipeline m_Pipeline;
+			VkPipelineLayout m_Layout;
+
+			void Create(VkDevice device, VkPipelineCache cache, VkShaderModule shaderModule, VkPipelineLayout layout, VkPipelineCreateFlags flags = 0, VkPipelineCreationFeedback* feedback = nullptr);
+		};
+	}
+}
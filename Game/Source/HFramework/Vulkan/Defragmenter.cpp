@@ -0,0 +1,517 @@
+#include "Defragmenter.h"
+#include "Device.h"
+#include "TextureUtil.h"
+#include <algorithm>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void Defragmenter::Init(Device* device, size_t maxBytesPerFrame)
+		{
+			m_Device = device;
+			m_Allocator = device->m_Allocator;
+			m_MaxBytesPerFrame = maxBytesPerFrame;
+
+			if (m_MaxBytesPerFrame == 0)
+				return;
+
+			m_CommandList = device->AllocateCommandLists(Queue::Graphics, CommandListType::Primary, 1)[0];
+
+			Log::Info("Created Defragmenter (%zu KB per frame)", m_MaxBytesPerFrame / 1024);
+		}
+
+		void Defragmenter::Dispose()
+		{
+			if (m_MaxBytesPerFrame == 0)
+				return;
+
+			// The device is idle by now so the last pass can be retired straight away
+			if (m_PassInFlight)
+				FinishPass();
+
+			if (m_Context)
+				EndDefragmentation();
+
+			for (auto& [object, movable] : m_Movables)
+			{
+				if (movable.buffer)
+				{
+					vmaSetAllocationUserData(m_Allocator, movable.buffer->m_Allocation, nullptr);
+					movable.buffer->m_Defragmenter = nullptr;
+				}
+				else
+				{
+					vmaSetAllocationUserData(m_Allocator, movable.texture->m_Allocation, nullptr);
+					movable.texture->m_Defragmenter = nullptr;
+				}
+			}
+
+			m_Movables.clear();
+		}
+
+		void Defragmenter::Register(Buffer* buffer)
+		{
+			if (buffer->m_Mapped)
+			{
+				Log::Warn("Mapped buffers can't be moved, the buffer stays where it is");
+				return;
+			}
+
+			if (Register(buffer, buffer->m_Allocation, buffer->m_Placement, buffer, nullptr))
+				buffer->m_Defragmenter = this;
+		}
+
+		void Defragmenter::Register(Texture* texture)
+		{
+			if (texture->m_InternallyManaged)
+				return;
+
+			if (Register(texture, texture->m_Allocation, texture->m_Placement, nullptr, texture))
+				texture->m_Defragmenter = this;
+		}
+
+		void Defragmenter::Unregister(Buffer* buffer)
+		{
+			Unregister(buffer, buffer->m_Allocation);
+			buffer->m_Defragmenter = nullptr;
+		}
+
+		void Defragmenter::Unregister(Texture* texture)
+		{
+			Unregister(texture, texture->m_Allocation);
+			texture->m_Defragmenter = nullptr;
+		}
+
+		bool Defragmenter::Register(const void* object, VmaAllocation allocation, const MemoryPlacement& placement, Buffer* buffer, Texture* texture)
+		{
+			if (m_MaxBytesPerFrame == 0)
+				return false;
+
+			if (!placement.pool)
+			{
+				Log::Warn("Only resources in a memory class pool can be moved, the resource stays where it is");
+				return false;
+			}
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			Movable& movable = m_Movables[object];
+			movable.buffer = buffer;
+			movable.texture = texture;
+
+			vmaSetAllocationUserData(m_Allocator, allocation, &movable);
+
+			return true;
+		}
+
+		void Defragmenter::Unregister(const void* object, VmaAllocation allocation)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			auto it = m_Movables.find(object);
+			if (it == m_Movables.end())
+				return;
+
+			// The allocation is about to be freed and VMA can't have it in the middle of a move
+			if (m_PassInFlight)
+			{
+				m_Device->WaitForSubmit(Queue::Graphics, m_PassSubmitValue);
+				m_Device->WaitForSubmit(Queue::Compute, m_PassComputeValue);
+				FinishPass();
+			}
+
+			vmaSetAllocationUserData(m_Allocator, allocation, nullptr);
+			m_Movables.erase(it);
+		}
+
+		void Defragmenter::BeginFrame()
+		{
+			if (m_MaxBytesPerFrame == 0)
+				return;
+
+			std::vector<Movable> moved;
+
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+
+				if (m_PassInFlight)
+				{
+					if (!m_Device->HasCompleted(Queue::Graphics, m_PassSubmitValue) || !m_Device->HasCompleted(Queue::Compute, m_PassComputeValue))
+						return;
+
+					FinishPass();
+				}
+
+				if (!m_Context)
+				{
+					if (++m_FramesSinceCheck < CheckInterval)
+						return;
+
+					m_FramesSinceCheck = 0;
+
+					if (!BeginDefragmentation())
+						return;
+				}
+
+				RecordPass(moved);
+			}
+
+			// Outside the lock so the callback is free to register and unregister resources
+			if (m_MoveCallback)
+			{
+				for (auto& movable : moved)
+					m_MoveCallback(movable.buffer, movable.texture);
+			}
+		}
+
+		DefragmentationStats Defragmenter::GetStats()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Stats;
+		}
+
+		bool Defragmenter::BeginDefragmentation()
+		{
+			MemoryPools& pools = m_Device->m_MemoryPools;
+
+			for (uint32_t i = 1; i <= MemoryClassCount; i++)
+			{
+				uint32_t index = (m_PoolIndex + i) % MemoryClassCount;
+				VmaPool pool = pools.m_Pools[index];
+
+				if (!pool)
+					continue;
+
+				VmaDetailedStatistics poolStats{};
+				vmaCalculatePoolStatistics(m_Allocator, pool, &poolStats);
+
+				// Not worth moving anything unless a whole block could be given back
+				VkDeviceSize unused = poolStats.statistics.blockBytes - poolStats.statistics.allocationBytes;
+				if (poolStats.statistics.blockCount < 2 || unused < pools.m_Descs[index].blockSize)
+					continue;
+
+				VmaDefragmentationInfo info{};
+				info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT;
+				info.pool = pool;
+				info.maxBytesPerPass = m_MaxBytesPerFrame;
+
+				if (vmaBeginDefragmentation(m_Allocator, &info, &m_Context) != VK_SUCCESS)
+				{
+					Log::Warn("Failed to begin defragmentation");
+					m_Context = VK_NULL_HANDLE;
+					return false;
+				}
+
+				m_PoolIndex = index;
+
+				const char* name = nullptr;
+				vmaGetPoolName(m_Allocator, pool, &name);
+
+				Log::Info("Defragmenting the %s pool (%llu KB unused across %u blocks)", name ? name : "", unused / 1024, poolStats.statistics.blockCount);
+
+				return true;
+			}
+
+			return false;
+		}
+
+		void Defragmenter::EndDefragmentation()
+		{
+			VmaDefragmentationStats stats{};
+			vmaEndDefragmentation(m_Allocator, m_Context, &stats);
+			m_Context = VK_NULL_HANDLE;
+
+			m_Stats.allocationsMoved += stats.allocationsMoved;
+			m_Stats.bytesMoved += stats.bytesMoved;
+			m_Stats.bytesFreed += stats.bytesFreed;
+			m_Stats.blocksFreed += stats.deviceMemoryBlocksFreed;
+
+			if (stats.allocationsMoved > 0)
+				Log::Info("Defragmentation moved %u allocations (%llu KB) and freed %u blocks", stats.allocationsMoved, stats.bytesMoved / 1024, stats.deviceMemoryBlocksFreed);
+		}
+
+		bool Defragmenter::CanMove(const Movable* movable) const
+		{
+			if (!movable)
+				return false;
+
+			// The pass copies on the graphics queue, anything another family holds or has released without graphics
+			// acquiring it yet can't be read there
+			uint32_t graphicsFamily = m_Device->GetQueueFamily(Queue::Graphics);
+
+			if (movable->buffer)
+			{
+				const Buffer* buffer = movable->buffer;
+
+				if (buffer->m_OwnershipPending || (buffer->m_QueueFamily != VK_QUEUE_FAMILY_IGNORED && buffer->m_QueueFamily != graphicsFamily))
+					return false;
+
+				return !buffer->m_Mapped;
+			}
+
+			const Texture* texture = movable->texture;
+
+			if (texture->m_OwnershipPending)
+				return false;
+
+			// Anything else is mid upload or being written to, the copy would miss it
+			return texture->m_Layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+
+		void Defragmenter::RecordPass(std::vector<Movable>& moved)
+		{
+			VkResult result = vmaBeginDefragmentationPass(m_Allocator, m_Context, &m_Pass);
+
+			// Success means there is nothing left to move
+			if (result != VK_INCOMPLETE)
+			{
+				if (result != VK_SUCCESS)
+					Log::Warn("Failed to begin defragmentation pass");
+
+				EndDefragmentation();
+				return;
+			}
+
+			std::vector<Movable*> movables(m_Pass.moveCount);
+
+			bool anyMovable = false;
+			for (uint32_t i = 0; i < m_Pass.moveCount; i++)
+			{
+				VmaAllocationInfo allocationInfo{};
+				vmaGetAllocationInfo(m_Allocator, m_Pass.pMoves[i].srcAllocation, &allocationInfo);
+
+				movables[i] = (Movable*)allocationInfo.pUserData;
+
+				// Unregistered resources can't have their handles patched so VMA leaves them where they are
+				if (!CanMove(movables[i]))
+				{
+					m_Pass.pMoves[i].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					movables[i] = nullptr;
+					continue;
+				}
+
+				anyMovable = true;
+			}
+
+			m_Retired.assign(m_Pass.moveCount, RetiredHandles());
+
+			if (!anyMovable)
+			{
+				FinishPass();
+				return;
+			}
+
+			m_CommandList.Begin();
+
+			// Whatever last wrote the resources has to land before they are read
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+			for (uint32_t i = 0; i < m_Pass.moveCount; i++)
+			{
+				if (!movables[i])
+					continue;
+
+				bool recorded = movables[i]->buffer ? MoveBuffer(movables[i]->buffer, m_Pass.pMoves[i].dstTmpAllocation, m_Retired[i]) : MoveTexture(movables[i]->texture, m_Pass.pMoves[i].dstTmpAllocation, m_Retired[i]);
+
+				if (!recorded)
+				{
+					m_Pass.pMoves[i].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					movables[i] = nullptr;
+				}
+			}
+
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+			m_CommandList.End();
+
+			// Copies still running on the transfer queue could be writing what the pass reads
+			TimelineWait transferWait{};
+			transferWait.queue = Queue::Transfer;
+			transferWait.value = m_Device->GetTimeline(Queue::Transfer).GetSubmittedValue();
+
+			// Compute work already submitted could still be writing what the pass reads, and was recorded with the old handles.
+			// Graphics work before the pass finishes before it, so the pass's own value covers that
+			m_PassComputeValue = m_Device->GetTimeline(Queue::Compute).GetSubmittedValue();
+
+			TimelineWait computeWait{};
+			computeWait.queue = Queue::Compute;
+			computeWait.value = m_PassComputeValue;
+
+			m_PassSubmitValue = m_Device->QueueSubmit(Queue::Graphics, { &m_CommandList }, std::vector<Semaphore*>{}, nullptr, { transferWait, computeWait });
+			m_PassInFlight = true;
+			m_Stats.passes++;
+
+			for (Movable* movable : movables)
+			{
+				if (movable)
+					moved.push_back(*movable);
+			}
+		}
+
+		bool Defragmenter::MoveBuffer(Buffer* buffer, VmaAllocation dst, RetiredHandles& retired)
+		{
+			VkBufferCreateInfo bufferInfo{};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = buffer->m_Size;
+			bufferInfo.usage = buffer->m_Usage;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			VkBuffer newBuffer = VK_NULL_HANDLE;
+			if (vkCreateBuffer(m_Device->m_Device, &bufferInfo, nullptr, &newBuffer) != VK_SUCCESS)
+				return false;
+
+			if (vmaBindBufferMemory(m_Allocator, dst, newBuffer) != VK_SUCCESS)
+			{
+				vkDestroyBuffer(m_Device->m_Device, newBuffer, nullptr);
+				return false;
+			}
+
+			// Work in flight may read the old slot so it can't be rewritten, the new handle goes in a slot of its own
+			uint32_t heapIndex = BindlessHeap::InvalidIndex;
+			if (buffer->m_Heap && buffer->m_HeapIndex != BindlessHeap::InvalidIndex)
+			{
+				heapIndex = buffer->m_Heap->AddStorageBuffer(newBuffer);
+
+				if (heapIndex == BindlessHeap::InvalidIndex)
+				{
+					vkDestroyBuffer(m_Device->m_Device, newBuffer, nullptr);
+					return false;
+				}
+
+				buffer->m_Heap->Release(BindlessHeap::StorageBufferBinding, buffer->m_HeapIndex);
+				buffer->m_HeapIndex = heapIndex;
+			}
+
+			VkBufferCopy region{};
+			region.size = buffer->m_Size;
+			vkCmdCopyBuffer(m_CommandList.m_Buffer, buffer->m_Buffer, newBuffer, 1, &region);
+
+			retired.buffer = buffer->m_Buffer;
+			buffer->m_Buffer = newBuffer;
+			buffer->m_HandleId = NextHandleId();
+			buffer->QueryDeviceAddress();
+
+			return true;
+		}
+
+		bool Defragmenter::MoveTexture(Texture* texture, VmaAllocation dst, RetiredHandles& retired)
+		{
+			VkImageCreateInfo imageInfo = texture->GetImageInfo();
+
+			VkImage newImage = VK_NULL_HANDLE;
+			if (vkCreateImage(m_Device->m_Device, &imageInfo, nullptr, &newImage) != VK_SUCCESS)
+				return false;
+
+			VkImageView newView = VK_NULL_HANDLE;
+			if (vmaBindImageMemory(m_Allocator, dst, newImage) != VK_SUCCESS || texture->CreateView(newImage, &newView) != VK_SUCCESS)
+			{
+				vkDestroyImage(m_Device->m_Device, newImage, nullptr);
+				return false;
+			}
+
+			// Work in flight may read the old slot so it can't be rewritten, the new view goes in a slot of its own
+			if (texture->m_Heap && texture->m_HeapIndex != BindlessHeap::InvalidIndex)
+			{
+				uint32_t heapIndex = texture->m_Heap->AddTexture(newView);
+
+				if (heapIndex == BindlessHeap::InvalidIndex)
+				{
+					vkDestroyImageView(m_Device->m_Device, newView, nullptr);
+					vkDestroyImage(m_Device->m_Device, newImage, nullptr);
+					return false;
+				}
+
+				texture->m_Heap->Release(BindlessHeap::TextureBinding, texture->m_HeapIndex);
+				texture->m_HeapIndex = heapIndex;
+			}
+
+			VkImageSubresourceRange range{};
+			range.aspectMask = GetAspectMask(texture);
+			range.levelCount = texture->m_MipLevels;
+			range.layerCount = texture->m_ArrayLayers;
+
+			VkImageMemoryBarrier barriers[2]{};
+			barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[0].oldLayout = texture->m_Layout;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[0].image = texture->m_Image;
+			barriers[0].subresourceRange = range;
+
+			barriers[1] = barriers[0];
+			barriers[1].srcAccessMask = 0;
+			barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].image = newImage;
+
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+			std::vector<VkImageCopy> regions(texture->m_MipLevels);
+
+			for (uint32_t mip = 0; mip < texture->m_MipLevels; mip++)
+			{
+				VkImageCopy& region = regions[mip];
+				region.srcSubresource.aspectMask = range.aspectMask;
+				region.srcSubresource.mipLevel = mip;
+				region.srcSubresource.layerCount = texture->m_ArrayLayers;
+				region.dstSubresource = region.srcSubresource;
+				region.extent.width = std::max(texture->m_Width >> mip, 1u);
+				region.extent.height = std::max(texture->m_Height >> mip, 1u);
+				region.extent.depth = std::max(texture->m_Depth >> mip, 1u);
+			}
+
+			vkCmdCopyImage(m_CommandList.m_Buffer, texture->m_Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+
+			// The new image takes over in the layout the old one was in, the pass's final barrier makes the copy visible
+			VkImageMemoryBarrier toLayout = barriers[1];
+			toLayout.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			toLayout.dstAccessMask = 0;
+			toLayout.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			toLayout.newLayout = texture->m_Layout;
+
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toLayout);
+
+			retired.image = texture->m_Image;
+			retired.view = texture->m_ImageView;
+
+			texture->m_Image = newImage;
+			texture->m_ImageView = newView;
+			texture->m_HandleId = NextHandleId();
+
+			return true;
+		}
+
+		void Defragmenter::FinishPass()
+		{
+			for (auto& retired : m_Retired)
+			{
+				if (retired.buffer)
+					vkDestroyBuffer(m_Device->m_Device, retired.buffer, nullptr);
+
+				if (retired.view)
+					vkDestroyImageView(m_Device->m_Device, retired.view, nullptr);
+
+				if (retired.image)
+					vkDestroyImage(m_Device->m_Device, retired.image, nullptr);
+			}
+
+			m_Retired.clear();
+			m_PassInFlight = false;
+
+			// Anything moved now lives in what was the temporary allocation
+			if (vmaEndDefragmentationPass(m_Allocator, m_Context, &m_Pass) == VK_SUCCESS)
+				EndDefragmentation();
+		}
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include "VulkanInclude.h"
+#include "Buffer.h"
+#include "Texture.h"
+#include "CommandList.h"
+#include "../Core/Log.h"
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		class Device;
+
+		struct DefragmentationStats
+		{
+			uint64_t passes = 0;
+			uint64_t allocationsMoved = 0;
+			uint64_t bytesMoved = 0;
+			uint64_t bytesFreed = 0;
+			uint64_t blocksFreed = 0;
+
+			void Print()
+			{
+				Log::Info("Defragmentation Stats:");
+				Log::Info(" - Passes: %llu", passes);
+				Log::Info(" - Allocations Moved: %llu", allocationsMoved);
+				Log::Info(" - Moved: %llu KB", bytesMoved / 1024);
+				Log::Info(" - Freed: %llu KB (%llu blocks)", bytesFreed / 1024, blocksFreed);
+			}
+		};
+
+		/*
+			Compacts the memory class pools a little at a time so long sessions of loading and unloading don't leave them
+			full of half empty blocks. Once a pool could give back at least a block, each frame moves up to a fixed number of bytes
+			with a VMA defragmentation pass, copying on the graphics queue and swapping the new handles into the moved resources.
+			The old handles are destroyed and the memory handed back once the copy has finished.
+
+			Only resources registered as movable are touched, Device::CreateBuffer and CreateTexture register pooled ones when they
+			are created in place. A registered resource promises it stays at the same address (every command list and descriptor
+			write goes through Buffer* and Texture* so that is what gets patched). Mapped resources, ones still waiting on an
+			ownership acquire and textures mid upload are skipped, and the pass waits for the transfer queue's copies.
+
+			Descriptor sets holding the old handles are refreshed by the device the next time they are bound. A moved resource gets
+			a new bindless slot since the old one may be read by work in flight, the old slot is retired on the timeline like any
+			other release. Anything that kept the heap index should take the new one in the move callback.
+		*/
+		class Defragmenter
+		{
+		public:
+
+			// Exactly one of the two is set
+			using MoveCallback = std::function<void(Buffer* buffer, Texture* texture)>;
+
+			// Only pooled resources can move, anything dedicated or in the default pools is left where it is
+			void Register(Buffer* buffer);
+
+			void Register(Texture* texture);
+
+			// Called by Dispose, waits for a pass moving the resource to finish
+			void Unregister(Buffer* buffer);
+
+			void Unregister(Texture* texture);
+
+			// Called from BeginFrame with the new handles and heap indices in place, before anything is recorded with them
+			void SetMoveCallback(MoveCallback callback) { m_MoveCallback = callback; }
+
+			/// <summary>
+			/// Retires the last pass once its copy has finished and records the next one, or starts on a fragmented pool.
+			/// Command lists recorded before this must already be submitted since they hold the old handles
+			/// </summary>
+			void BeginFrame();
+
+			DefragmentationStats GetStats();
+
+		private:
+
+			friend class Device;
+
+			void Init(Device* device, size_t maxBytesPerFrame);
+
+			void Dispose();
+
+			struct Movable
+			{
+				Buffer* buffer = nullptr;
+				Texture* texture = nullptr;
+			};
+
+			// Handles the resource had before the move, destroyed once the copy has finished
+			struct RetiredHandles
+			{
+				VkBuffer buffer = VK_NULL_HANDLE;
+				VkImage image = VK_NULL_HANDLE;
+				VkImageView view = VK_NULL_HANDLE;
+			};
+
+			Device* m_Device = nullptr;
+			VmaAllocator m_Allocator = VK_NULL_HANDLE;
+
+			size_t m_MaxBytesPerFrame = 0;
+
+			// Node based so the entries can be the VMA user data of their allocations
+			std::unordered_map<const void*, Movable> m_Movables;
+
+			MoveCallback m_MoveCallback;
+
+			CommandList m_CommandList;
+
+			VmaDefragmentationContext m_Context = VK_NULL_HANDLE;
+			VmaDefragmentationPassMoveInfo m_Pass{};
+			uint32_t m_PoolIndex = 0;
+
+			bool m_PassInFlight = false;
+			uint64_t m_PassSubmitValue = 0;
+
+			// Compute work submitted before the handles were swapped may still be using the old ones
+			uint64_t m_PassComputeValue = 0;
+
+			std::vector<RetiredHandles> m_Retired;
+
+			// Pools are only checked every so often while nothing is being defragmented
+			static const uint32_t CheckInterval = 120;
+			uint32_t m_FramesSinceCheck = 0;
+
+			DefragmentationStats m_Stats;
+
+			std::mutex m_Mutex;
+
+			bool Register(const void* object, VmaAllocation allocation, const MemoryPlacement& placement, Buffer* buffer, Texture* texture);
+
+			void Unregister(const void* object, VmaAllocation allocation);
+
+			// Next pool that would give back at least one block, starting after the last one defragmented
+			bool BeginDefragmentation();
+
+			void EndDefragmentation();
+
+			bool CanMove(const Movable* movable) const;
+
+			// Records and submits the copies then swaps in the new handles, what moved is handed back for the callback
+			void RecordPass(std::vector<Movable>& moved);
+
+			bool MoveBuffer(Buffer* buffer, VmaAllocation dst, RetiredHandles& retired);
+
+			bool MoveTexture(Texture* texture, VmaAllocation dst, RetiredHandles& retired);
+
+			// Destroys the old handles and lets VMA free the memory they were in
+			void FinishPass();
+		};
+	}
+}
@@ -0,0 +1,133 @@
+#include "DescriptorBuffer.h"
+#include "../Core/Log.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void DescriptorBuffer::Init(VmaAllocator allocator, VkDevice device, VkDeviceSize persistentSize, VkDeviceSize transientFrameSize, VkDeviceSize alignment)
+		{
+			m_Allocator = allocator;
+			m_Alignment = alignment;
+
+			// Keep the transient regions aligned by rounding everything before them up
+			m_PersistentSize = (persistentSize + m_Alignment - 1) & ~(m_Alignment - 1);
+			m_TransientFrameSize = (transientFrameSize + m_Alignment - 1) & ~(m_Alignment - 1);
+
+			// Combined image samplers need the sampler usage as well so one buffer holds every descriptor type
+			VkBufferCreateInfo bufferInfo{};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = m_PersistentSize + m_TransientFrameSize * MaxImagesInFlight;
+			bufferInfo.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			VmaAllocationCreateInfo allocInfo{};
+			allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+			allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+			VmaAllocationInfo allocationInfo{};
+
+			if (vmaCreateBuffer(m_Allocator, &bufferInfo, &allocInfo, &m_Buffer, &m_Allocation, &allocationInfo) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to create descriptor buffer");
+			}
+
+			m_Mapped = (uint8_t*)allocationInfo.pMappedData;
+
+			VkBufferDeviceAddressInfo addressInfo{};
+			addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+			addressInfo.buffer = m_Buffer;
+
+			m_Address = vkGetBufferDeviceAddress(device, &addressInfo);
+
+			VmaVirtualBlockCreateInfo blockInfo{};
+			blockInfo.size = m_PersistentSize;
+
+			if (vmaCreateVirtualBlock(&blockInfo, &m_PersistentBlock) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to create the descriptor buffer's persistent block");
+			}
+
+			Log::Info("Created Descriptor Buffer (%llu KB persistent, %llu KB per frame)", m_PersistentSize / 1024, m_TransientFrameSize / 1024);
+		}
+
+		void DescriptorBuffer::Dispose()
+		{
+			// Sets that were never disposed would trip VMA's leak assert
+			vmaClearVirtualBlock(m_PersistentBlock);
+			vmaDestroyVirtualBlock(m_PersistentBlock);
+
+			vmaDestroyBuffer(m_Allocator, m_Buffer, m_Allocation);
+		}
+
+		VkDeviceSize DescriptorBuffer::GetPersistentUsed() const
+		{
+			std::lock_guard<std::mutex> lock(m_PersistentMutex);
+
+			VmaStatistics stats{};
+			vmaGetVirtualBlockStatistics(m_PersistentBlock, &stats);
+
+			return stats.allocationBytes;
+		}
+
+		bool DescriptorBuffer::AllocatePersistent(VkDeviceSize size, VkDeviceSize* offset)
+		{
+			VmaVirtualAllocationCreateInfo allocInfo{};
+			allocInfo.size = size;
+			allocInfo.alignment = m_Alignment;
+
+			std::lock_guard<std::mutex> lock(m_PersistentMutex);
+
+			VmaVirtualAllocation allocation = VK_NULL_HANDLE;
+			if (vmaVirtualAllocate(m_PersistentBlock, &allocInfo, &allocation, offset) != VK_SUCCESS)
+			{
+				Log::Error("Descriptor buffer is out of space for persistent sets");
+				return false;
+			}
+
+			m_PersistentAllocations[*offset] = allocation;
+			return true;
+		}
+
+		void DescriptorBuffer::FreePersistent(VkDeviceSize offset)
+		{
+			std::lock_guard<std::mutex> lock(m_PersistentMutex);
+			m_PendingFrees[m_Frame].push_back(offset);
+		}
+
+		bool DescriptorBuffer::AllocateTransient(VkDeviceSize size, VkDeviceSize* offset)
+		{
+			VkDeviceSize alignedSize = (size + m_Alignment - 1) & ~(m_Alignment - 1);
+			VkDeviceSize start = m_TransientOffset.fetch_add(alignedSize);
+
+			if (start + alignedSize > m_TransientFrameSize)
+			{
+				Log::Error("Descriptor buffer is out of space for this frame's transient sets");
+				return false;
+			}
+
+			*offset = m_PersistentSize + m_TransientFrameSize * m_Frame + start;
+			return true;
+		}
+
+		void DescriptorBuffer::BeginFrame(uint32_t frame)
+		{
+			std::lock_guard<std::mutex> lock(m_PersistentMutex);
+
+			m_Frame = frame;
+			m_TransientOffset = 0;
+
+			for (VkDeviceSize offset : m_PendingFrees[frame])
+			{
+				auto it = m_PersistentAllocations.find(offset);
+				if (it == m_PersistentAllocations.end())
+					continue;
+
+				vmaVirtualFree(m_PersistentBlock, it->second);
+				m_PersistentAllocations.erase(it);
+			}
+
+			m_PendingFrees[frame].clear();
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "VulkanInclude.h"
+#include "Swapchain.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		/*
+			Backing memory for the VK_EXT_descriptor_buffer backend. One persistently mapped buffer holds every descriptor,
+			a descriptor set is just an offset into it and writing one is vkGetDescriptorEXT straight into the mapping.
+			The front of the buffer holds persistent sets, sub-allocated from a VMA virtual block so disposed sets give
+			their space back, after that there is one region per frame in flight for transient sets which is reset in
+			bulk when the frame comes round again.
+		*/
+		class DescriptorBuffer
+		{
+		public:
+
+			VkDeviceSize GetPersistentUsed() const;
+
+		private:
+
+			friend class Device;
+			friend class CommandList;
+			friend class DescriptorSet;
+
+			void Init(VmaAllocator allocator, VkDevice device, VkDeviceSize persistentSize, VkDeviceSize transientFrameSize, VkDeviceSize alignment);
+
+			void Dispose();
+
+			// Offsets are aligned to descriptorBufferOffsetAlignment so they can be bound directly, thread safe
+			bool AllocatePersistent(VkDeviceSize size, VkDeviceSize* offset);
+
+			// The space is reused once the frames that could still be reading it have finished, thread safe
+			void FreePersistent(VkDeviceSize offset);
+
+			bool AllocateTransient(VkDeviceSize size, VkDeviceSize* offset);
+
+			// Nothing from the frame's region or freed during the frame's last use can still be in use on the GPU
+			void BeginFrame(uint32_t frame);
+
+			uint8_t* GetMapped(VkDeviceSize offset) { return m_Mapped + offset; }
+
+			VmaAllocator m_Allocator;
+
+			VkBuffer m_Buffer = VK_NULL_HANDLE;
+			VmaAllocation m_Allocation = VK_NULL_HANDLE;
+			VkDeviceAddress m_Address = 0;
+			uint8_t* m_Mapped = nullptr;
+
+			VkDeviceSize m_Alignment = 64;
+			VkDeviceSize m_PersistentSize = 0;
+			VkDeviceSize m_TransientFrameSize = 0;
+
+			VmaVirtualBlock m_PersistentBlock = VK_NULL_HANDLE;
+			std::unordered_map<VkDeviceSize, VmaVirtualAllocation> m_PersistentAllocations;
+
+			// Offsets freed while each frame was being recorded
+			std::vector<VkDeviceSize> m_PendingFrees[MaxImagesInFlight];
+			mutable std::mutex m_PersistentMutex;
+
+			std::atomic<VkDeviceSize> m_TransientOffset = 0;
+			uint32_t m_Frame = 0;
+		};
+	}
+}
@@ -1,4 +1,3 @@
-
 #include "DescriptorSet.h"
 #include "../Core/Log.h"
 #include "Device.h"
@@ -9,59 +8,140 @@ namespace hf
 	{
 		void DescriptorSet::BindUniformBuffer(Buffer& buffer, uint32_t binding, uint32_t dstArrayElement, size_t offset, size_t range)
 		{
+			DescriptorInfo* info = GetPayloadSlot(binding, dstArrayElement, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
+			if (!info)
+				return;
 
-			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = buffer.m_Buffer;
-			bufferInfo.offset = offset;
-			bufferInfo.range = (range == 0) ? VK_WHOLE_SIZE : range;
+			info->buffer.buffer = buffer.m_Buffer;
+			SetResource(info, &buffer, nullptr);
+			buffer.MarkUsed();
+			info->buffer.offset = offset;
+			info->buffer.range = (range == 0) ? buffer.m_Size - offset : range;
+		}
 
-			m_BufferInfo.push_back(bufferInfo);
+		void DescriptorSet::BindDynamicUniformBuffer(Buffer& buffer, uint32_t binding, size_t range, uint32_t dstArrayElement, size_t offset)
+		{
+			DescriptorInfo* info = GetPayloadSlot(binding, dstArrayElement, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
 
-			VkWriteDescriptorSet descriptorWrite{};
-			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrite.dstSet = m_Set;
-			descriptorWrite.dstBinding = binding;
-			descriptorWrite.dstArrayElement = dstArrayElement;
-			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrite.descriptorCount = 1;
-			descriptorWrite.pBufferInfo = &m_BufferInfo[m_BufferInfo.size() - 1];
-			descriptorWrite.pImageInfo = nullptr; 
-			descriptorWrite.pTexelBufferView = nullptr; 
+			if (!info)
+				return;
 
-			m_Writes.push_back(descriptorWrite);
+			info->buffer.buffer = buffer.m_Buffer;
+			SetResource(info, &buffer, nullptr);
+			buffer.MarkUsed();
+			info->buffer.offset = offset;
+			info->buffer.range = range;
 		}
 
 		void DescriptorSet::BindTextureSampler(Texture& texture, SamplerState& samplerState, uint32_t binding, uint32_t arrayElement )
 		{
-			VkDescriptorImageInfo imageInfo{};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;	// Set to use shader read only optimal 
-			imageInfo.imageView = texture.m_ImageView;
-			imageInfo.sampler = m_Device->GetSampler(samplerState);
-
-			m_ImageInfo.push_back(imageInfo);
-
-			VkWriteDescriptorSet descriptorWrite{};
-			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrite.dstSet = m_Set;
-			descriptorWrite.dstBinding = binding;
-			descriptorWrite.dstArrayElement = arrayElement;
-			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrite.descriptorCount = 1;
-			descriptorWrite.pBufferInfo = nullptr;
-			descriptorWrite.pImageInfo = &m_ImageInfo[m_ImageInfo.size() - 1];
-			descriptorWrite.pTexelBufferView = nullptr;
-
-			m_Writes.push_back(descriptorWrite);
+			DescriptorInfo* info = GetPayloadSlot(binding, arrayElement, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+			if (!info)
+				return;
+
+			info->image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;	// Set to use shader read only optimal 
+			info->image.imageView = texture.m_ImageView;
+			SetResource(info, nullptr, &texture);
+			texture.MarkUsed();
+			info->image.sampler = m_Device->GetSampler(samplerState);
+		}
+
+		void DescriptorSet::BindStorageBuffer(Buffer& buffer, uint32_t binding, uint32_t dstArrayElement, size_t offset, size_t range)
+		{
+			DescriptorInfo* info = GetPayloadSlot(binding, dstArrayElement, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+			if (!info)
+				return;
+
+			info->buffer.buffer = buffer.m_Buffer;
+			SetResource(info, &buffer, nullptr);
+			buffer.MarkUsed();
+			info->buffer.offset = offset;
+			info->buffer.range = (range == 0) ? buffer.m_Size - offset : range;
+		}
+
+		void DescriptorSet::BindStorageImage(Texture& texture, uint32_t binding, uint32_t arrayElement)
+		{
+			DescriptorInfo* info = GetPayloadSlot(binding, arrayElement, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+			if (!info)
+				return;
+
+			info->image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			info->image.imageView = texture.m_ImageView;
+			SetResource(info, nullptr, &texture);
+			texture.MarkUsed();
+			info->image.sampler = VK_NULL_HANDLE;
 		}
 
 		void DescriptorSet::Write()
 		{
-			vkUpdateDescriptorSets(m_Device->m_Device, m_Writes.size(), m_Writes.data(), 0, nullptr);
+			if (!m_Template)
+				return;
+
+			if (m_Cached)
+			{
+				m_Device->WriteCachedDescriptorSet(*this);
+				return;
+			}
+
+			if (m_Device->m_SupportedFeatures.descriptorBuffer)
+			{
+				m_Device->WriteDescriptorBuffer(*this, m_Device->m_DescriptorBuffer.GetMapped(m_BufferOffset));
+				return;
+			}
+
+			if (!m_Template->handle)
+				return;
+
+			vkUpdateDescriptorSetWithTemplate(m_Device->m_Device, m_Set, m_Template->handle, m_Payload.data());
+		}
+
+		void DescriptorSet::Dispose()
+		{
+			if (!m_Template || m_Cached || m_Transient)
+				return;
+
+			if (m_Device->m_SupportedFeatures.descriptorBuffer)
+				m_Device->m_DescriptorBuffer.FreePersistent(m_BufferOffset);
+			else if (m_Set)
+				m_Device->RetireDescriptorSet(m_Set, m_Pool);
+
+			m_Template = nullptr;
+			m_Set = VK_NULL_HANDLE;
+		}
+
+		void DescriptorSet::SetResource(const DescriptorInfo* slot, Buffer* buffer, Texture* texture)
+		{
+			BoundResource& resource = m_Resources[slot - m_Payload.data()];
+			resource.buffer = buffer;
+			resource.texture = texture;
+			resource.handleId = buffer ? buffer->m_HandleId : texture->m_HandleId;
+		}
+
+		DescriptorInfo* DescriptorSet::GetPayloadSlot(uint32_t binding, uint32_t arrayElement, VkDescriptorType type)
+		{
+			if (!m_Template || binding >= m_Template->bindingOffsets.size() || m_Template->bindingOffsets[binding] == UINT32_MAX)
+			{
+				Log::Error("Descriptor set layout has no binding %d", binding);
+				return nullptr;
+			}
+
+			if (m_Template->bindingTypes[binding] != type)
+			{
+				Log::Error("Descriptor binding %d is a different type in the layout", binding);
+				return nullptr;
+			}
+
+			if (arrayElement >= m_Template->bindingCounts[binding])
+			{
+				Log::Error("Array element %d is out of range for descriptor binding %d", arrayElement, binding);
+				return nullptr;
+			}
 
-			m_Writes.clear();
-			m_BufferInfo.clear();
-			m_ImageInfo.clear();
+			return &m_Payload[m_Template->bindingOffsets[binding] + arrayElement];
 		}
 	}
 }
\ No newline at end of file
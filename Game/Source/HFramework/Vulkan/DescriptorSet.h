@@ -4,6 +4,8 @@
 #include "Buffer.h"
 #include "SamplerState.h"
 #include "Texture.h"
+#include "DescriptorSetLayout.h"
+#include <atomic>
 #include <vector>
 
 namespace hf
@@ -18,10 +20,25 @@ namespace hf
 
 			void BindUniformBuffer(Buffer& buffer, uint32_t binding, uint32_t dstArrayElement = 0, size_t offset = 0, size_t range = 0);
 
+			// Range is the size every draw sees, the offset into the buffer is given when the set is bound
+			void BindDynamicUniformBuffer(Buffer& buffer, uint32_t binding, size_t range, uint32_t dstArrayElement = 0, size_t offset = 0);
+
 			void BindTextureSampler(Texture& texture, SamplerState& samplerState, uint32_t binding, uint32_t arrayElement = 0);
 
+			void BindStorageBuffer(Buffer& buffer, uint32_t binding, uint32_t dstArrayElement = 0, size_t offset = 0, size_t range = 0);
+
+			// Storage images are expected to be in the General layout when used
+			void BindStorageImage(Texture& texture, uint32_t binding, uint32_t arrayElement = 0);
+
+			// Writes every binding in the layout at once so each one must have been bound before the first Write.
+			// Bindings keep their contents between writes so only the ones that changed need binding again.
+			// Cached sets look up a set with the same contents instead, see Device::CreateCachedDescriptorSet
 			void Write();
 
+			// Gives a persistent set's descriptor buffer space back once the frames in flight are done with it.
+			// Transient and cached sets are recycled by the device, sets from pools go back when the device is destroyed
+			void Dispose();
+
 		private:
 
 			friend class Device;
@@ -29,12 +46,54 @@ namespace hf
 
 			Device* m_Device;
 
-			std::vector<VkWriteDescriptorSet> m_Writes;
+			const DescriptorUpdateTemplate* m_Template = nullptr;
+
+			// Sized for the layout when the set is allocated, filled in by the Bind functions
+			std::vector<DescriptorInfo> m_Payload;
+
+			// What each payload slot was bound from. The handle id is the resource's when it was bound,
+			// so a recycled handle in the payload can't be mistaken for the resource that had it before
+			struct BoundResource
+			{
+				Buffer* buffer = nullptr;
+				Texture* texture = nullptr;
+				alignas(std::atomic_ref<uint64_t>::required_alignment) uint64_t handleId = 0;
+
+				// The resource was moved or lost a mip since it was bound. Checked without the refresh lock, see Device::RefreshDescriptorSet
+				bool IsStale() const
+				{
+					uint64_t id = std::atomic_ref<uint64_t>(const_cast<uint64_t&>(handleId)).load(std::memory_order_acquire);
+
+					if (buffer)
+						return id != buffer->GetHandleId();
+
+					if (texture)
+						return id != texture->GetHandleId();
+
+					return false;
+				}
+			};
+
+			std::vector<BoundResource> m_Resources;
+
+			DescriptorInfo* GetPayloadSlot(uint32_t binding, uint32_t arrayElement, VkDescriptorType type);
+
+			void SetResource(const DescriptorInfo* slot, Buffer* buffer, Texture* texture);
+
+			VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+
+			// Cached sets share their VkDescriptorSet with every other set of the same layout and contents
+			bool m_Cached = false;
+
+			bool m_Transient = false;
+
+			VkDescriptorSet m_Set = VK_NULL_HANDLE;
 
-			std::vector< VkDescriptorBufferInfo> m_BufferInfo;
-			std::vector< VkDescriptorImageInfo> m_ImageInfo;
+			// The pool a persistent set came from, needed to free it
+			VkDescriptorPool m_Pool = VK_NULL_HANDLE;
 
-			VkDescriptorSet m_Set;
+			// Where the set lives in the device's descriptor buffer when that backend is in use
+			VkDeviceSize m_BufferOffset = 0;
 		};
 	}
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "DescriptorSetAllocator.h"
 #include "../Core/Log.h"
+#include <algorithm>
+#include <cmath>
 
 namespace hf
 {
@@ -12,7 +14,7 @@ namespace hf
 			std::vector<VkDescriptorPoolSize> sizes;
 			sizes.reserve(poolSizes.sizes.size());
 			for (auto sz : poolSizes.sizes) {
-				sizes.push_back({ sz.first, uint32_t(sz.second * count) });
+				sizes.push_back({ sz.first, std::max(1u, uint32_t(std::ceil(sz.second * count))) });
 			}
 			VkDescriptorPoolCreateInfo pool_info = {};
 			pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -30,12 +32,27 @@ namespace hf
 		}
 
 
-		bool DescriptorSetAllocator::Allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout)
+		bool DescriptorSetAllocator::Allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
 		{
 			if (!m_CurrentPool)
 			{
 				m_CurrentPool = GetPool();
-				m_UsedPools.push(m_CurrentPool);
+				m_UsedPools.push({ m_CurrentPool, m_Generation });
+			}
+
+			m_SetsAllocated++;
+
+			uint32_t setUsage[DescriptorTypeCount] = {};
+			for (auto& binding : bindings)
+			{
+				if (binding.descriptorType < DescriptorTypeCount)
+					setUsage[binding.descriptorType] += binding.descriptorCount;
+			}
+
+			for (uint32_t type = 0; type < DescriptorTypeCount; type++)
+			{
+				m_TypeUsage[type] += setUsage[type];
+				m_MaxTypePerSet[type] = std::max(m_MaxTypePerSet[type], setUsage[type]);
 			}
 
 			VkDescriptorSetAllocateInfo allocInfo = {};
@@ -51,6 +68,8 @@ namespace hf
 
 			switch (allocResult) {
 			case VK_SUCCESS:
+				if (pool)
+					*pool = allocInfo.descriptorPool;
 				return true;
 			case VK_ERROR_FRAGMENTED_POOL:
 			case VK_ERROR_OUT_OF_POOL_MEMORY:
@@ -62,70 +81,163 @@ namespace hf
 
 			if (needReallocate)
 			{
+				// Pools a set doesn't fit in any more are dropped from the list, they still get reset with the rest
+				while (!m_PartialPools.empty())
+				{
+					allocInfo.descriptorPool = m_PartialPools.back();
+
+					if (vkAllocateDescriptorSets(m_Device, &allocInfo, set) == VK_SUCCESS)
+					{
+						if (pool)
+							*pool = allocInfo.descriptorPool;
+						return true;
+					}
+
+					m_PartialPools.pop_back();
+				}
+
 				m_CurrentPool = GetPool();
-				m_UsedPools.push(m_CurrentPool);
+				m_UsedPools.push({ m_CurrentPool, m_Generation });
 
 				allocInfo.descriptorPool = m_CurrentPool;
 
 				allocResult = vkAllocateDescriptorSets(m_Device, &allocInfo, set);
 
 				if (allocResult == VK_SUCCESS) {
+					if (pool)
+						*pool = allocInfo.descriptorPool;
 					return true;
 				}
+
+				// Even a fresh pool is too small, the adapted sizes are off so go back to the defaults
+				if (allocResult == VK_ERROR_FRAGMENTED_POOL || allocResult == VK_ERROR_OUT_OF_POOL_MEMORY)
+				{
+					Log::Warn("Descriptor set doesn't fit in a new pool, resetting the pool sizes");
+
+					m_PoolSizes = PoolSizes();
+					m_SetsPerPool = 1000;
+					m_Generation++;
+
+					m_CurrentPool = GetPool();
+					m_UsedPools.push({ m_CurrentPool, m_Generation });
+
+					allocInfo.descriptorPool = m_CurrentPool;
+
+					if (vkAllocateDescriptorSets(m_Device, &allocInfo, set) == VK_SUCCESS)
+					{
+						if (pool)
+							*pool = allocInfo.descriptorPool;
+						return true;
+					}
+				}
 			}
 
 			return false;
 		}
 
-		void DescriptorSetAllocator::Init(VkDevice device)
+		void DescriptorSetAllocator::Free(VkDescriptorSet set, VkDescriptorPool pool)
+		{
+			vkFreeDescriptorSets(m_Device, pool, 1, &set);
+
+			if (pool != m_CurrentPool && std::find(m_PartialPools.begin(), m_PartialPools.end(), pool) == m_PartialPools.end())
+				m_PartialPools.push_back(pool);
+		}
+
+		void DescriptorSetAllocator::Init(VkDevice device, VkDescriptorPoolCreateFlags poolFlags)
 		{
 			m_Device = device;
+			m_PoolFlags = poolFlags;
 		}
 
 		void DescriptorSetAllocator::Dispose()
 		{
-			for (uint32_t i = 0; i < m_FreePools.size(); i++)
+			while (!m_FreePools.empty())
 			{
-				VkDescriptorPool pool = m_FreePools.front();
+				vkDestroyDescriptorPool(m_Device, m_FreePools.front().pool, nullptr);
 				m_FreePools.pop();
-
-				vkDestroyDescriptorPool(m_Device, pool, nullptr);
 			}
 
-			for (uint32_t i = 0; i < m_UsedPools.size(); i++)
+			while (!m_UsedPools.empty())
 			{
-				VkDescriptorPool pool = m_UsedPools.front();
+				vkDestroyDescriptorPool(m_Device, m_UsedPools.front().pool, nullptr);
 				m_UsedPools.pop();
-
-				vkDestroyDescriptorPool(m_Device, pool, nullptr);
 			}
+
+			m_CurrentPool = VK_NULL_HANDLE;
+			m_PartialPools.clear();
 		}
 
 		void DescriptorSetAllocator::Reset()
 		{
-			for (uint32_t i = 0; i < m_UsedPools.size(); i++)
+			AdaptPoolSizes();
+
+			while (!m_UsedPools.empty())
 			{
-				VkDescriptorPool pool = m_UsedPools.front();
+				Pool pool = m_UsedPools.front();
 				m_UsedPools.pop();
-				vkResetDescriptorPool(m_Device, pool, 0);
+
+				vkResetDescriptorPool(m_Device, pool.pool, 0);
 				m_FreePools.push(pool);
 			}
 
 			m_CurrentPool = VK_NULL_HANDLE;
+			m_PartialPools.clear();
+		}
+
+		void DescriptorSetAllocator::AdaptPoolSizes()
+		{
+			if (m_SetsAllocated == 0)
+				return;
+
+			// Aim for a single pool holding everything allocated between resets, with some headroom
+			uint32_t setsPerPool = std::clamp(m_SetsAllocated + m_SetsAllocated / 4, 64u, 4096u);
+			bool changed = (setsPerPool > m_SetsPerPool) || (setsPerPool < m_SetsPerPool / 2);
+
+			PoolSizes poolSizes = m_PoolSizes;
+
+			for (auto& size : poolSizes.sizes)
+			{
+				float observed = (float)m_TypeUsage[size.first] / (float)m_SetsAllocated;
+
+				// Types that weren't used keep a small share so a new layout doesn't immediately need another pool,
+				// and never less than the biggest set seen needs or that set could never be allocated again
+				float minRatio = std::max(0.0625f, (float)m_MaxTypePerSet[size.first] / (float)setsPerPool);
+				float ratio = std::max(observed * 1.25f, minRatio);
+
+				if (ratio > size.second || ratio < size.second * 0.5f)
+				{
+					size.second = ratio;
+					changed = true;
+				}
+			}
+
+			if (changed)
+			{
+				m_PoolSizes = poolSizes;
+				m_SetsPerPool = setsPerPool;
+				m_Generation++;
+			}
+
+			m_SetsAllocated = 0;
+			for (auto& usage : m_TypeUsage)
+				usage = 0;
 		}
 
 		VkDescriptorPool DescriptorSetAllocator::GetPool()
 		{
-			// See if we have a pool available 
-			if (!m_FreePools.empty())
+			// See if we have a pool available, pools sized for older usage are thrown away
+			while (!m_FreePools.empty())
 			{
-				VkDescriptorPool pool = m_FreePools.front();
+				Pool pool = m_FreePools.front();
 				m_FreePools.pop();
 
-				return pool;
+				if (pool.generation == m_Generation)
+					return pool.pool;
+
+				vkDestroyDescriptorPool(m_Device, pool.pool, nullptr);
 			}
 
-			return CreatePool(m_Device, m_PoolSizes, 1000, 0);
+			return CreatePool(m_Device, m_PoolSizes, m_SetsPerPool, m_PoolFlags);
 		}
 	}
 }
\ No newline at end of file
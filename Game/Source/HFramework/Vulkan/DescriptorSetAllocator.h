@@ -1,6 +1,7 @@
 #pragma once
 
 #include <queue>
+#include <vector>
 #include "VulkanInclude.h"
 
 namespace hf
@@ -31,25 +32,55 @@ namespace hf
 				};
 			};
 
-			bool Allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout);
+			// The bindings are only used to track how many of each descriptor type get used. The pool is needed to free the set again
+			bool Allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, VkDescriptorPool* pool = nullptr);
 
-			void Init(VkDevice device);
+			// Only for allocators whose pools are created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, the GPU must be done with the set
+			void Free(VkDescriptorSet set, VkDescriptorPool pool);
+
+			void Init(VkDevice device, VkDescriptorPoolCreateFlags poolFlags = 0);
 
 			void Dispose();
 
+			// Resets every pool at once, nothing allocated from them can still be in use.
+			// New pools are sized from what was allocated since the last reset
 			void Reset();
 
 		private:
 
+			struct Pool
+			{
+				VkDescriptorPool pool;
+
+				// Pools from an older generation were sized before the last adapt and get recreated
+				uint32_t generation;
+			};
+
 			VkDescriptorPool GetPool();
-			
+
+			void AdaptPoolSizes();
+
 			VkDevice m_Device;
+			VkDescriptorPoolCreateFlags m_PoolFlags = 0;
+
+			VkDescriptorPool m_CurrentPool = VK_NULL_HANDLE;
 
-			VkDescriptorPool m_CurrentPool;
-			std::queue<VkDescriptorPool> m_UsedPools;
-			std::queue<VkDescriptorPool> m_FreePools;
+			// Used pools sets have been freed from, tried before a new pool is made
+			std::vector<VkDescriptorPool> m_PartialPools;
+			std::queue<Pool> m_UsedPools;
+			std::queue<Pool> m_FreePools;
 
 			PoolSizes m_PoolSizes;
+			uint32_t m_SetsPerPool = 1000;
+			uint32_t m_Generation = 0;
+
+			// Usage since the last reset, indexed by descriptor type
+			static const uint32_t DescriptorTypeCount = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1;
+			uint32_t m_TypeUsage[DescriptorTypeCount] = {};
+			uint32_t m_SetsAllocated = 0;
+
+			// Most of each type a single set has ever needed, new pools always hold at least this many
+			uint32_t m_MaxTypePerSet[DescriptorTypeCount] = {};
 		};
 	}
 }
\ No newline at end of file
@@ -8,90 +8,190 @@ namespace hf
 {
 	namespace vulkan
 	{
-		class DescriptorSetLayout
+		constexpr VkShaderStageFlags ToShaderStageFlags(ShaderStage stage)
 		{
-		public:
+			switch (stage)
+			{
+			case ShaderStage::Vertex:
+				return VK_SHADER_STAGE_VERTEX_BIT;
+			case ShaderStage::Fragment:
+				return VK_SHADER_STAGE_FRAGMENT_BIT;
+			case ShaderStage::Compute:
+				return VK_SHADER_STAGE_COMPUTE_BIT;
+			case ShaderStage::All:
+				return VK_SHADER_STAGE_ALL;
+			}
 
-			DescriptorSetLayout& AddUniformBuffer(ShaderStage stage, uint32_t binding, uint32_t count)
+			return VK_SHADER_STAGE_ALL;
+		}
+
+		/*
+			Layout hashing is constexpr so layouts built at runtime and StaticSetLayouts built at compile time
+			hash to the same value and share the device's cached VkDescriptorSetLayout.
+		*/
+
+		constexpr size_t CombineLayoutHash(size_t seed, size_t value)
+		{
+			return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+		}
+
+		constexpr size_t HashLayoutBindings(const VkDescriptorSetLayoutBinding* bindings, size_t count, bool pushDescriptor)
+		{
+			size_t hash = CombineLayoutHash(0, pushDescriptor ? 1 : 0);
+
+			for (size_t i = 0; i < count; i++)
 			{
-				VkDescriptorSetLayoutBinding layoutBinding{};
-				layoutBinding.binding = binding;
-				layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				layoutBinding.descriptorCount = count;
+				size_t bindingHash = 0;
+				bindingHash = CombineLayoutHash(bindingHash, bindings[i].binding);
+				bindingHash = CombineLayoutHash(bindingHash, bindings[i].descriptorType);
+				bindingHash = CombineLayoutHash(bindingHash, bindings[i].descriptorCount);
+				bindingHash = CombineLayoutHash(bindingHash, bindings[i].stageFlags);
 
-				switch (stage)
-				{
-				case ShaderStage::Vertex:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-					break;
-				case ShaderStage::Fragment:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-					break;
-				case ShaderStage::Compute:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-					break;
-				};
+				hash = CombineLayoutHash(hash, bindingHash);
+			}
 
-				layoutBinding.pImmutableSamplers = nullptr;
+			return hash;
+		}
 
-				m_LayoutBindings.push_back(layoutBinding);
+		template<typename... Bindings>
+		class StaticSetLayout;
 
-				return *this;
+		class DescriptorSetLayout
+		{
+		public:
+
+			DescriptorSetLayout() = default;
+
+			DescriptorSetLayout& AddUniformBuffer(ShaderStage stage, uint32_t binding, uint32_t count)
+			{
+				return AddBinding(stage, binding, count, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 			}
 
-			DescriptorSetLayout& AddTextureSampler(ShaderStage stage, uint32_t binding, uint32_t count)
+			// The buffer offset is supplied when the set is bound so many draws can share one set
+			DescriptorSetLayout& AddDynamicUniformBuffer(ShaderStage stage, uint32_t binding, uint32_t count)
 			{
-				VkDescriptorSetLayoutBinding layoutBinding{};
-				layoutBinding.binding = binding;
-				layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				layoutBinding.descriptorCount = count;
+				return AddBinding(stage, binding, count, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+			}
 
-				switch (stage)
-				{
-				case ShaderStage::Vertex:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-					break;
-				case ShaderStage::Fragment:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-					break;
-				case ShaderStage::Compute:
-					layoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-					break;
-				};
+			DescriptorSetLayout& AddTextureSampler(ShaderStage stage, uint32_t binding, uint32_t count)
+			{
+				return AddBinding(stage, binding, count, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+			}
 
-				layoutBinding.pImmutableSamplers = nullptr;
+			DescriptorSetLayout& AddStorageBuffer(ShaderStage stage, uint32_t binding, uint32_t count)
+			{
+				return AddBinding(stage, binding, count, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+			}
 
-				m_LayoutBindings.push_back(layoutBinding);
+			DescriptorSetLayout& AddStorageImage(ShaderStage stage, uint32_t binding, uint32_t count)
+			{
+				return AddBinding(stage, binding, count, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+			}
 
+			// Push descriptor sets are never allocated, their bindings are recorded straight into command lists
+			// with CommandList::PushUniformBuffer and PushTextureSampler. Needs VK_KHR_push_descriptor
+			DescriptorSetLayout& SetPushDescriptor(bool pushDescriptor = true)
+			{
+				m_PushDescriptor = pushDescriptor;
+				m_Hash = HashLayoutBindings(m_LayoutBindings.data(), m_LayoutBindings.size(), m_PushDescriptor);
 				return *this;
 			}
 
+			bool IsPushDescriptor() const { return m_PushDescriptor; }
+
 
-			size_t Hash()
+			// Kept up to date as bindings are added so lookups don't rehash the bindings
+			size_t Hash() const { return m_Hash; }
+
+			bool operator==(const DescriptorSetLayout& rh) const
 			{
-				size_t hash = 0;
-				for (auto& binding : m_LayoutBindings)
-					hash_combine(hash, HashBinding(binding));
+				if (m_Hash != rh.m_Hash || m_PushDescriptor != rh.m_PushDescriptor || m_LayoutBindings.size() != rh.m_LayoutBindings.size())
+					return false;
+
+				for (size_t i = 0; i < m_LayoutBindings.size(); i++)
+				{
+					const VkDescriptorSetLayoutBinding& a = m_LayoutBindings[i];
+					const VkDescriptorSetLayoutBinding& b = rh.m_LayoutBindings[i];
 
-				return hash;
+					if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount || a.stageFlags != b.stageFlags)
+						return false;
+				}
+
+				return true;
 			}
 		
 		private:
 
 			friend class Device;
 
-			size_t HashBinding(VkDescriptorSetLayoutBinding& binding)
+			template<typename... Bindings>
+			friend class StaticSetLayout;
+
+			// Static layouts hand over bindings and a hash worked out at compile time
+			DescriptorSetLayout(const VkDescriptorSetLayoutBinding* bindings, size_t count, size_t hash) : m_LayoutBindings(bindings, bindings + count), m_Hash(hash) { }
+
+			DescriptorSetLayout& AddBinding(ShaderStage stage, uint32_t binding, uint32_t count, VkDescriptorType type)
 			{
-				size_t hash = 0;
-				hash_combine(hash, binding.binding);
-				hash_combine(hash, binding.descriptorType);
-				hash_combine(hash, binding.descriptorCount);
-				hash_combine(hash, binding.stageFlags);
-				return hash;
+				VkDescriptorSetLayoutBinding layoutBinding{};
+				layoutBinding.binding = binding;
+				layoutBinding.descriptorType = type;
+				layoutBinding.descriptorCount = count;
+				layoutBinding.stageFlags = ToShaderStageFlags(stage);
+				layoutBinding.pImmutableSamplers = nullptr;
+
+				m_LayoutBindings.push_back(layoutBinding);
+
+				m_Hash = HashLayoutBindings(m_LayoutBindings.data(), m_LayoutBindings.size(), m_PushDescriptor);
+
+				return *this;
 			}
 
 
 			std::vector< VkDescriptorSetLayoutBinding> m_LayoutBindings;
+
+			bool m_PushDescriptor = false;
+
+			size_t m_Hash = HashLayoutBindings(nullptr, 0, false);
+		};
+
+		// One element of a descriptor set's update payload, every descriptor type we write fits in here
+		union DescriptorInfo
+		{
+			VkDescriptorImageInfo image;
+			VkDescriptorBufferInfo buffer;
+		};
+
+		/*
+			Created by the device alongside each set layout. Descriptor sets fill a flat array of DescriptorInfo
+			and the whole array is written in one vkUpdateDescriptorSetWithTemplate call,
+			or into the descriptor buffer when that backend is in use.
+		*/
+		struct DescriptorUpdateTemplate
+		{
+			VkDescriptorUpdateTemplate handle = VK_NULL_HANDLE;
+
+			// Where each binding starts in the payload, indexed by binding number. UINT32_MAX for bindings not in the layout
+			std::vector<uint32_t> bindingOffsets;
+			std::vector<VkDescriptorType> bindingTypes;
+			std::vector<uint32_t> bindingCounts;
+
+			uint32_t descriptorCount = 0;
+
+			// Descriptors in dynamic bindings, each takes one dynamic offset when the set is bound
+			uint32_t dynamicCount = 0;
+
+			// With the descriptor buffer backend there is no template handle, sets are written straight into
+			// the descriptor buffer at these offsets instead. Indexed by binding number
+			std::vector<VkDeviceSize> descriptorBufferOffsets;
+			VkDeviceSize descriptorBufferSize = 0;
+		};
+
+		struct DescriptorSetLayoutHash
+		{
+			size_t operator()(const DescriptorSetLayout& layout) const
+			{
+				return layout.Hash();
+			}
 		};
 	}
 }
\ No newline at end of file
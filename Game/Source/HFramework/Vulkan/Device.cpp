@@ -1,5 +1,9 @@
 
 #include "Device.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
 
 namespace hf
 {
@@ -8,6 +12,10 @@ namespace hf
 		void Device::Create(const DeviceCreateInfo& deviceInfo)
 		{
 			m_Debug = deviceInfo.validationLayers;
+			m_PipelineCachePath = deviceInfo.pipelineCachePath;
+			m_BindlessRequested = deviceInfo.bindlessHeap;
+			m_DescriptorBufferRequested = deviceInfo.descriptorBuffer;
+			m_HostImageCopyRequested = deviceInfo.hostImageCopy;
 
 
 			CreateInstance(deviceInfo);
@@ -18,7 +26,8 @@ namespace hf
 
 			CreateDevice();
 
-			m_FencePool.Initialise(m_Device, 12);
+			for (auto& timeline : m_Timelines)
+				timeline.Initialise(m_Device);
 
 			VmaAllocatorCreateInfo allocatorCreateInfo = {};
 			allocatorCreateInfo.vulkanApiVersion = VK_API_VERSION_1_3;
@@ -26,6 +35,14 @@ namespace hf
 			allocatorCreateInfo.device = m_Device;
 			allocatorCreateInfo.instance = m_Instance;
 
+			// Descriptor buffers reference buffers by device address
+			if (m_SupportedFeatures.descriptorBuffer)
+				allocatorCreateInfo.flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
+			// Without it VMA estimates the budget from the heap sizes
+			if (m_SupportedFeatures.memoryBudget)
+				allocatorCreateInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+
 			if (vmaCreateAllocator(&allocatorCreateInfo, &m_Allocator) != VK_SUCCESS)
 			{
 				Log::Fatal("Failed to create VMA Allocator");
@@ -33,7 +50,51 @@ namespace hf
 			
 			Log::Info("Created VMA Allocator");
 
-			m_SetAllocator.Init(m_Device);
+			m_MemoryPools.Init(m_Allocator, deviceInfo.memoryPools);
+
+			// Persistent sets are freed one at a time when they are replaced or disposed
+			m_SetAllocator.Init(m_Device, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+
+			// Evicted sets are rewritten straight away so they must have aged past every frame in flight
+			m_DescriptorCacheMaxAge = std::max(deviceInfo.descriptorCacheMaxAge, MaxImagesInFlight + 1);
+
+			if (m_SupportedFeatures.descriptorBuffer)
+			{
+				// Combined image samplers sit in the same buffer so it has to fit in both address ranges
+				VkDeviceSize maxRange = std::min(m_DescriptorBufferProperties.maxResourceDescriptorBufferRange, m_DescriptorBufferProperties.maxSamplerDescriptorBufferRange);
+				VkDeviceSize persistentSize = deviceInfo.descriptorBufferSize;
+				VkDeviceSize transientSize = deviceInfo.transientDescriptorBufferSize;
+
+				if (persistentSize + transientSize * MaxImagesInFlight > maxRange)
+				{
+					Log::Warn("Descriptor buffer sizes are bigger than the device's descriptor buffer range, shrinking to fit");
+
+					persistentSize = maxRange / 2;
+					transientSize = maxRange / (2 * MaxImagesInFlight);
+				}
+
+				m_DescriptorBuffer.Init(m_Allocator, m_Device, persistentSize, transientSize, m_DescriptorBufferProperties.descriptorBufferOffsetAlignment);
+			}
+
+			for (auto& frame : m_TransientDescriptorFrames)
+			{
+				frame.threadAllocators.resize(MaxDescriptorThreads);
+				for (auto& allocator : frame.threadAllocators)
+					allocator.Init(m_Device);
+			}
+
+			CreatePipelineCache();
+
+			m_CompileWorkers.Initialise(deviceInfo.pipelineCompileThreads);
+
+			if (m_SupportedFeatures.bindless)
+				CreateBindlessHeap(deviceInfo);
+
+			m_Defragmenter.Init(this, deviceInfo.defragmentBytesPerFrame);
+
+			m_Residency.Init(this, deviceInfo.residencyHighWatermark, deviceInfo.residencyLowWatermark, deviceInfo.residencyMinMipSize);
+
+			m_TransientAttachments.Init(this);
 
 
 			// Lets get the supported features and fill out the struct
@@ -42,17 +103,59 @@ namespace hf
 			vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
 
 			m_SupportedFeatures.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+			m_SupportedFeatures.minUniformBufferOffsetAlignment = properties.limits.minUniformBufferOffsetAlignment;
+			m_SupportedFeatures.maxUniformBufferRange = properties.limits.maxUniformBufferRange;
+			m_SupportedFeatures.minStorageBufferOffsetAlignment = properties.limits.minStorageBufferOffsetAlignment;
 
 			m_SupportedFeatures.Print();
 		}
 
 		void Device::Dispose()
 		{
+			// Lets any pipelines still compiling finish before their caches are destroyed
+			m_CompileWorkers.Dispose();
+
 			vkDeviceWaitIdle(m_Device);
 
-			m_FencePool.Dispose();
+			m_Defragmenter.Dispose();
+
+			m_Residency.Dispose();
+
+			m_TransientAttachments.Dispose();
+
+			SavePipelineCache();
+			vkDestroyPipelineCache(m_Device, m_PipelineCache, nullptr);
+
+			for (auto& pipeline : m_GraphicsPipelines)
+				vkDestroyPipeline(m_Device, pipeline.second.m_Pipeline, nullptr);
+
+			for (auto& pipeline : m_ComputePipelines)
+				vkDestroyPipeline(m_Device, pipeline.second.m_Pipeline, nullptr);
+
+			for (auto& layout : m_PipelineLayouts)
+				vkDestroyPipelineLayout(m_Device, layout.second, nullptr);
+
+			for (auto& shaderModule : m_ShaderModules)
+				vkDestroyShaderModule(m_Device, shaderModule.second, nullptr);
+
+			for (auto& timeline : m_Timelines)
+				timeline.Dispose();
 			m_SetAllocator.Dispose();
 
+			for (auto& frame : m_TransientDescriptorFrames)
+			{
+				for (auto& allocator : frame.threadAllocators)
+					allocator.Dispose();
+			}
+
+			if (m_SupportedFeatures.bindless)
+				m_BindlessHeap.Dispose();
+
+			if (m_SupportedFeatures.descriptorBuffer)
+				m_DescriptorBuffer.Dispose();
+
+			m_MemoryPools.Dispose();
+
 			vmaDestroyAllocator(m_Allocator);
 
 			for (auto& sampler : m_Samplers)
@@ -62,7 +165,10 @@ namespace hf
 
 			for (auto& setLayout : m_DescriptorSetLayouts)
 			{
-				vkDestroyDescriptorSetLayout(m_Device, setLayout.second, nullptr);
+				if (setLayout.second.updateTemplate.handle)
+					vkDestroyDescriptorUpdateTemplate(m_Device, setLayout.second.updateTemplate.handle, nullptr);
+
+				vkDestroyDescriptorSetLayout(m_Device, setLayout.second.layout, nullptr);
 			}
 
 			for (auto& cmdPools : m_CommandPools)
@@ -148,18 +254,177 @@ namespace hf
 		}
 
 		GraphicsPipeline Device::RetrieveGraphicsPipeline(GraphicsPipelineDesc& desc)
+		{
+			GraphicsPipelineHandle handle = RequestGraphicsPipeline(desc, false);
+
+			// Only blocks if another thread was already compiling the same pipeline
+			return *handle.Wait();
+		}
+
+		GraphicsPipelineHandle Device::RetrieveGraphicsPipelineAsync(const GraphicsPipelineDesc& desc)
+		{
+			return RequestGraphicsPipeline(desc, true);
+		}
+
+		GraphicsPipelineHandle Device::RequestGraphicsPipeline(const GraphicsPipelineDesc& desc, bool async)
+		{
+			std::vector<VkPushConstantRange> pushConstants{};
+
+			for (auto& range : desc.pushConstantRanges)
+			{
+				VkPushConstantRange r{};
+				r.size = range.second.size;
+				r.offset = range.second.offset;
+
+				switch (range.first)
+				{
+				case ShaderStage::Vertex:
+					r.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+					break;
+				case ShaderStage::Fragment:
+					r.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+					break;
+				case ShaderStage::All:
+					r.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+					break;
+				}
+
+				pushConstants.push_back(r);
+			}
+
+			GraphicsPipelineHandle handle;
+			GraphicsPipelineKey key;
+			std::unordered_map<ShaderStage, VkShaderModule> shaderModules;
+
+			{
+				std::lock_guard<std::mutex> lock(m_PipelineMutex);
+
+				// Modules and layouts are cheap to create compared to the pipeline so they are always made here
+				for (auto& shader : desc.shaders)
+					shaderModules[shader.first] = GetShaderModule(shader.second.bytecode);
+
+				VkPipelineLayout layout = GetPipelineLayout(desc.setLayouts, pushConstants, desc.useBindlessHeap);
+
+				VkShaderModule vertexShader = (shaderModules.find(ShaderStage::Vertex) != shaderModules.end()) ? shaderModules[ShaderStage::Vertex] : VK_NULL_HANDLE;
+				VkShaderModule fragmentShader = (shaderModules.find(ShaderStage::Fragment) != shaderModules.end()) ? shaderModules[ShaderStage::Fragment] : VK_NULL_HANDLE;
+
+				key = GraphicsPipelineKey::Create(desc, vertexShader, fragmentShader, layout);
+
+				auto it = m_GraphicsPipelines.find(key);
+				if (it != m_GraphicsPipelines.end())
+				{
+					handle.m_State = std::make_shared<GraphicsPipelineHandle::State>();
+					handle.m_State->pipeline = it->second;
+					handle.m_State->ready = true;
+				}
+				else
+				{
+					auto pending = m_PendingGraphicsPipelines.find(key);
+					if (pending != m_PendingGraphicsPipelines.end())
+					{
+						handle.m_State = pending->second;
+					}
+				}
+
+				if (handle.m_State)
+				{
+					std::lock_guard<std::mutex> statsLock(m_PipelineCacheStatsMutex);
+					m_PipelineCacheStats.pipelinesReused++;
+
+					return handle;
+				}
+
+				handle.m_State = std::make_shared<GraphicsPipelineHandle::State>();
+				m_PendingGraphicsPipelines[key] = handle.m_State;
+			}
+
+			if (async)
+			{
+				// The job takes copies as the caller's desc may be gone by the time it runs
+				std::shared_ptr<GraphicsPipelineHandle::State> state = handle.m_State;
+				m_CompileWorkers.Enqueue([this, state, key, desc, shaderModules]()
+					{
+						CompileGraphicsPipeline(state, key, desc, shaderModules);
+					});
+			}
+			else
+			{
+				CompileGraphicsPipeline(handle.m_State, key, desc, shaderModules);
+			}
+
+			return handle;
+		}
+
+		void Device::CompileGraphicsPipeline(std::shared_ptr<GraphicsPipelineHandle::State> state, const GraphicsPipelineKey& key, const GraphicsPipelineDesc& desc, const std::unordered_map<ShaderStage, VkShaderModule>& shaderModules)
 		{
 			GraphicsPipeline pipeline;
 
-			std::vector<VkDescriptorSetLayout> setLayouts(desc.setLayouts.size());
+			VkPipelineCreationFeedback feedback{};
+			pipeline.Create(m_Device, m_PipelineCache, desc, key.layout, shaderModules, GetPipelineCreateFlags(), &feedback);
+			RecordPipelineFeedback(feedback);
+
+			{
+				std::lock_guard<std::mutex> lock(m_PipelineMutex);
+				m_GraphicsPipelines[key] = pipeline;
+				m_PendingGraphicsPipelines.erase(key);
+			}
 
-			for (uint32_t i = 0; i < desc.setLayouts.size(); i++)
 			{
-				setLayouts[i] = GetSetLayout(desc.setLayouts[i]);
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->pipeline = pipeline;
+				state->ready.store(true, std::memory_order_release);
+			}
+
+			state->compiled.notify_all();
+		}
+
+		ComputePipeline Device::RetrieveComputePipeline(ComputePipelineDesc& desc)
+		{
+			std::vector<VkPushConstantRange> pushConstants{};
+
+			if (desc.pushConstantRange.size > 0)
+			{
+				VkPushConstantRange r{};
+				r.offset = desc.pushConstantRange.offset;
+				r.size = desc.pushConstantRange.size;
+				r.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+				pushConstants.push_back(r);
+			}
+
+			ComputePipelineKey key{};
+
+			{
+				std::lock_guard<std::mutex> lock(m_PipelineMutex);
+
+				key.shader = GetShaderModule(desc.shader.bytecode);
+				key.layout = GetPipelineLayout(desc.setLayouts, pushConstants, desc.useBindlessHeap);
+
+				auto it = m_ComputePipelines.find(key);
+				if (it != m_ComputePipelines.end())
+				{
+					std::lock_guard<std::mutex> statsLock(m_PipelineCacheStatsMutex);
+					m_PipelineCacheStats.pipelinesReused++;
+
+					return it->second;
+				}
 			}
 
-			pipeline.Create(m_Device, desc, setLayouts);
-			return pipeline;
+			// Compiled without the lock so other lookups, and the graphics compile workers, aren't held up behind it
+			ComputePipeline pipeline;
+
+			VkPipelineCreationFeedback feedback{};
+			pipeline.Create(m_Device, m_PipelineCache, key.shader, key.layout, GetPipelineCreateFlags(), &feedback);
+			RecordPipelineFeedback(feedback);
+
+			std::lock_guard<std::mutex> lock(m_PipelineMutex);
+
+			// Another thread compiled the same pipeline in the meantime, keep the one everyone else already has
+			auto [it, inserted] = m_ComputePipelines.insert({ key, pipeline });
+			if (!inserted)
+				vkDestroyPipeline(m_Device, pipeline.m_Pipeline, nullptr);
+
+			return it->second;
 		}
 
 		Buffer Device::CreateBuffer(const BufferDesc& desc)
@@ -167,8 +432,29 @@ namespace hf
 			Buffer buf;
 			buf.m_AssociatedDevice = m_Device;
 			buf.m_AssociatedAllocator = m_Allocator;
+			buf.m_Device = this;
+
+			BufferDesc bufferDesc = desc;
+
+			// Descriptor buffer descriptors point at buffers by address
+			if (m_SupportedFeatures.descriptorBuffer && ((int)desc.usage & ((int)BufferUsage::Uniform | (int)BufferUsage::ShaderStorage)))
+				bufferDesc.usage = bufferDesc.usage | BufferUsage::ShaderDeviceAddress;
+
+			if (desc.visibility == BufferVisibility::HostVisible && desc.memoryClass != MemoryClass::Default && !m_MemoryPools.IsHostVisible(desc.memoryClass))
+			{
+				Log::Warn("Host visible buffer requested from a memory class that isn't host visible, using the default pools");
+				bufferDesc.memoryClass = MemoryClass::Default;
+			}
+
+			buf.m_Placement = m_MemoryPools.GetPlacement(bufferDesc.memoryClass, desc.bufferSize);
 
-			buf.Create(desc);
+			buf.Create(bufferDesc);
+
+			if (m_SupportedFeatures.bindless && ((int)desc.usage & (int)BufferUsage::ShaderStorage))
+			{
+				buf.m_Heap = &m_BindlessHeap;
+				buf.m_HeapIndex = m_BindlessHeap.AddStorageBuffer(buf.m_Buffer);
+			}
 
 			return buf;
 		}
@@ -179,22 +465,526 @@ namespace hf
 			tex.m_AssociatedAllocator = m_Allocator;
 			tex.m_AssociatedDevice = m_Device;
 
+			MemoryClass memoryClass = desc.memoryClass;
+			if (memoryClass == MemoryClass::Default)
+				memoryClass = desc.isRenderTarget ? MemoryClass::RenderTarget : MemoryClass::SampledTexture;
+
+			// Roughly what the image will need, a full mip chain adds a third
+			size_t size = (size_t)desc.width * desc.height * desc.depth * desc.arrayLevels * GetFormatSize(desc.format);
+			if (desc.mipLevels > 1)
+				size += size / 3;
+
+			tex.m_Placement = m_MemoryPools.GetPlacement(memoryClass, size);
+
+			tex.m_Device = this;
+
+			// Render targets are only ever written by the GPU
+			if (m_SupportedFeatures.hostImageCopy && !desc.isRenderTarget && SupportsHostImageCopy(desc, tex.m_Placement.pool != VK_NULL_HANDLE))
+			{
+				tex.m_CopyMemoryToImage = m_ExtensionFunctions.vkCopyMemoryToImageEXT;
+				tex.m_TransitionImageLayout = m_ExtensionFunctions.vkTransitionImageLayoutEXT;
+				tex.m_HostCopyLayout = m_HostCopyLayout;
+			}
+
 			tex.Create(desc);
+
+			if (m_SupportedFeatures.bindless)
+			{
+				tex.m_Heap = &m_BindlessHeap;
+				tex.m_HeapIndex = m_BindlessHeap.AddTexture(tex.m_ImageView);
+			}
+
 			return tex;
 		}
 
+		void Device::CreateBuffer(const BufferDesc& desc, Buffer* buffer)
+		{
+			*buffer = CreateBuffer(desc);
+
+			// Host writable buffers end up mapped and a mapped buffer can't move
+			if (buffer->m_Placement.pool && !buffer->m_HostWritable)
+				m_Defragmenter.Register(buffer);
+		}
+
+		void Device::CreateTexture(const TextureDesc& desc, Texture* texture)
+		{
+			*texture = CreateTexture(desc);
+
+			// Render targets are held by framebuffers and views outside the device, they stay where they are
+			if (texture->m_Placement.pool && !desc.isRenderTarget && !desc.isStorage)
+				m_Defragmenter.Register(texture);
+		}
+
+		bool Device::SupportsHostImageCopy(const TextureDesc& desc, bool pooled)
+		{
+			VkFormat format = FormatTable[(int)desc.format];
+
+			VkFormatProperties3 formatProperties3{};
+			formatProperties3.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3;
+
+			VkFormatProperties2 formatProperties{};
+			formatProperties.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+			formatProperties.pNext = &formatProperties3;
+
+			vkGetPhysicalDeviceFormatProperties2(m_PhysicalDevice, format, &formatProperties);
+
+			if (!(formatProperties3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT))
+				return false;
+
+			// The usage Texture::Create ends up with, the host transfer bit can change the image's layout in memory
+			VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+			if (desc.isStorage)
+				usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+			if (pooled)
+				usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+			VkPhysicalDeviceImageFormatInfo2 imageFormatInfo{};
+			imageFormatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+			imageFormatInfo.format = format;
+			imageFormatInfo.type = desc.type == TextureType::Flat3D ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+			imageFormatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageFormatInfo.usage = usage;
+
+			VkHostImageCopyDevicePerformanceQueryEXT performance{};
+			performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+
+			VkImageFormatProperties2 imageFormatProperties{};
+			imageFormatProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+			imageFormatProperties.pNext = &performance;
+
+			if (vkGetPhysicalDeviceImageFormatProperties2(m_PhysicalDevice, &imageFormatInfo, &imageFormatProperties) != VK_SUCCESS)
+				return false;
+
+			// Otherwise every GPU read of the texture pays for the faster uploads, only worth it when asked for
+			return performance.optimalDeviceAccess || desc.forceHostCopy;
+		}
+
 		DescriptorSet Device::AllocateDescriptorSet(DescriptorSetLayout layout)
 		{
-			VkDescriptorSetLayout setLayout = GetSetLayout(layout);
+			if (layout.IsPushDescriptor())
+			{
+				Log::Error("Push descriptor sets can't be allocated, push them through the command list instead");
+				return DescriptorSet();
+			}
+
+			const DescriptorUpdateTemplate* updateTemplate = nullptr;
+			VkDescriptorSetLayout setLayout = GetSetLayout(layout, &updateTemplate);
+
+			DescriptorSet set = DescriptorSet();
+			set.m_Device = this;
+			set.m_Template = updateTemplate;
+			set.m_Layout = setLayout;
+			set.m_Payload.resize(updateTemplate->descriptorCount);
+			set.m_Resources.resize(updateTemplate->descriptorCount);
+
+			if (m_SupportedFeatures.descriptorBuffer)
+			{
+				if (!AllocateDescriptorBufferSet(*updateTemplate, false, &set.m_BufferOffset))
+					Log::Error("Failed to Allocate Descriptor set");
+
+				return set;
+			}
+
+			std::lock_guard<std::mutex> lock(m_SetAllocatorMutex);
+
+			if (!m_SetAllocator.Allocate(&set.m_Set, setLayout, layout.m_LayoutBindings, &set.m_Pool))
+			{
+				Log::Error("Failed to Allocate Descriptor set");
+			}
+
+			return set;
+		}
+
+		DescriptorSet Device::AllocateTransientDescriptorSet(const DescriptorSetLayout& layout)
+		{
+			if (layout.IsPushDescriptor())
+			{
+				Log::Error("Push descriptor sets can't be allocated, push them through the command list instead");
+				return DescriptorSet();
+			}
+
+			const DescriptorUpdateTemplate* updateTemplate = nullptr;
+			VkDescriptorSetLayout setLayout = GetSetLayout(layout, &updateTemplate);
+
+			DescriptorSet set = DescriptorSet();
+			set.m_Device = this;
+			set.m_Template = updateTemplate;
+			set.m_Layout = setLayout;
+			set.m_Payload.resize(updateTemplate->descriptorCount);
+			set.m_Resources.resize(updateTemplate->descriptorCount);
+			set.m_Transient = true;
+
+			if (m_SupportedFeatures.descriptorBuffer)
+			{
+				if (!AllocateDescriptorBufferSet(*updateTemplate, true, &set.m_BufferOffset))
+					Log::Error("Failed to Allocate Transient Descriptor set");
+
+				return set;
+			}
+
+			uint32_t threadIndex = GetDescriptorThreadIndex();
+			if (threadIndex >= MaxDescriptorThreads)
+			{
+				Log::Error("Too many threads allocating transient descriptor sets");
+				return DescriptorSet();
+			}
+
+			DescriptorSetAllocator& allocator = m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()].threadAllocators[threadIndex];
+
+			if (!allocator.Allocate(&set.m_Set, setLayout, layout.m_LayoutBindings))
+			{
+				Log::Error("Failed to Allocate Transient Descriptor set");
+			}
+
+			return set;
+		}
+
+		DescriptorSet Device::CreateCachedDescriptorSet(const DescriptorSetLayout& layout)
+		{
+			if (layout.IsPushDescriptor())
+			{
+				Log::Error("Push descriptor sets can't be cached, push them through the command list instead");
+				return DescriptorSet();
+			}
+
+			const DescriptorUpdateTemplate* updateTemplate = nullptr;
+			VkDescriptorSetLayout setLayout = GetSetLayout(layout, &updateTemplate);
 
+			// The payload is zero initialised so the padding in each descriptor compares equal
 			DescriptorSet set = DescriptorSet();
 			set.m_Device = this;
-			if (!m_SetAllocator.Allocate(&set.m_Set, setLayout))
+			set.m_Template = updateTemplate;
+			set.m_Layout = setLayout;
+			set.m_Cached = true;
+			set.m_Payload.resize(updateTemplate->descriptorCount);
+			set.m_Resources.resize(updateTemplate->descriptorCount);
+
+			return set;
+		}
+
+		// The set allocator only needs the bindings to track how many of each type are used
+		static std::vector<VkDescriptorSetLayoutBinding> GetTemplateBindings(const DescriptorUpdateTemplate& updateTemplate)
+		{
+			std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+			for (uint32_t i = 0; i < updateTemplate.bindingOffsets.size(); i++)
+			{
+				if (updateTemplate.bindingOffsets[i] == UINT32_MAX)
+					continue;
+
+				VkDescriptorSetLayoutBinding binding{};
+				binding.binding = i;
+				binding.descriptorType = updateTemplate.bindingTypes[i];
+				binding.descriptorCount = updateTemplate.bindingCounts[i];
+				bindings.push_back(binding);
+			}
+
+			return bindings;
+		}
+
+		void Device::WriteCachedDescriptorSet(DescriptorSet& set)
+		{
+			size_t payloadSize = set.m_Payload.size() * sizeof(DescriptorInfo);
+
+			// Handles are recycled once a resource is disposed, moved or loses a mip so the ids have to match as well
+			std::vector<uint64_t> handleIds(set.m_Resources.size());
+			for (size_t i = 0; i < set.m_Resources.size(); i++)
+				handleIds[i] = set.m_Resources[i].handleId;
+
+			size_t hash = std::hash<std::string_view>()(std::string_view((const char*)set.m_Payload.data(), payloadSize));
+			hash_combine(hash, (uint64_t)set.m_Layout);
+			for (uint64_t id : handleIds)
+				hash_combine(hash, id);
+
+			std::lock_guard<std::mutex> lock(m_DescriptorCacheMutex);
+
+			std::vector<CachedDescriptorSet>& bucket = m_DescriptorCache[hash];
+
+			for (auto& entry : bucket)
+			{
+				if (entry.layout == set.m_Layout && entry.handleIds == handleIds && memcmp(entry.payload.data(), set.m_Payload.data(), payloadSize) == 0)
+				{
+					entry.lastUsedFrame = m_DescriptorFrameCount;
+					set.m_Set = entry.set;
+					set.m_BufferOffset = entry.bufferOffset;
+
+					m_DescriptorCacheStats.setsReused++;
+					return;
+				}
+			}
+
+			CachedDescriptorSet entry{};
+
+			std::vector<CachedDescriptorSet>& freeSets = m_FreeCachedSets[set.m_Layout];
+
+			if (!freeSets.empty())
+			{
+				entry = std::move(freeSets.back());
+				freeSets.pop_back();
+			}
+			else if (m_SupportedFeatures.descriptorBuffer)
+			{
+				if (!AllocateDescriptorBufferSet(*set.m_Template, false, &entry.bufferOffset))
+				{
+					Log::Error("Failed to Allocate Cached Descriptor set");
+					return;
+				}
+			}
+			else
+			{
+				std::vector<VkDescriptorSetLayoutBinding> bindings = GetTemplateBindings(*set.m_Template);
+
+				std::lock_guard<std::mutex> allocatorLock(m_SetAllocatorMutex);
+
+				if (!m_SetAllocator.Allocate(&entry.set, set.m_Layout, bindings))
+				{
+					Log::Error("Failed to Allocate Cached Descriptor set");
+					return;
+				}
+			}
+
+			entry.layout = set.m_Layout;
+			entry.payload = set.m_Payload;
+			entry.handleIds = std::move(handleIds);
+			entry.lastUsedFrame = m_DescriptorFrameCount;
+
+			if (m_SupportedFeatures.descriptorBuffer)
+				WriteDescriptorBuffer(set, m_DescriptorBuffer.GetMapped(entry.bufferOffset));
+			else
+				vkUpdateDescriptorSetWithTemplate(m_Device, entry.set, set.m_Template->handle, set.m_Payload.data());
+
+			set.m_Set = entry.set;
+			set.m_BufferOffset = entry.bufferOffset;
+			bucket.push_back(std::move(entry));
+
+			m_DescriptorCacheStats.setsWritten++;
+			m_DescriptorCacheStats.cachedSets++;
+		}
+
+		void Device::RefreshDescriptorSet(DescriptorSet& set)
+		{
+			std::lock_guard<std::mutex> lock(m_DescriptorRefreshMutex);
+
+			// Filled in on a copy so other threads keep binding the old backing until the new one is ready
+			DescriptorSet refreshed = set;
+			bool stale = false;
+
+			for (size_t i = 0; i < refreshed.m_Resources.size(); i++)
+			{
+				DescriptorSet::BoundResource& resource = refreshed.m_Resources[i];
+
+				if (!resource.IsStale())
+					continue;
+
+				if (resource.buffer)
+				{
+					refreshed.m_Payload[i].buffer.buffer = resource.buffer->m_Buffer;
+					resource.handleId = resource.buffer->m_HandleId;
+				}
+				else
+				{
+					refreshed.m_Payload[i].image.imageView = resource.texture->m_ImageView;
+					resource.handleId = resource.texture->m_HandleId;
+				}
+
+				stale = true;
+			}
+
+			// Another thread got here first
+			if (!stale)
+				return;
+
+			if (refreshed.m_Cached)
+			{
+				WriteCachedDescriptorSet(refreshed);
+			}
+			else if (m_SupportedFeatures.descriptorBuffer)
+			{
+				if (!AllocateDescriptorBufferSet(*refreshed.m_Template, refreshed.m_Transient, &refreshed.m_BufferOffset))
+				{
+					Log::Error("Failed to refresh descriptor set");
+					return;
+				}
+
+				WriteDescriptorBuffer(refreshed, m_DescriptorBuffer.GetMapped(refreshed.m_BufferOffset));
+
+				if (!set.m_Transient)
+					m_DescriptorBuffer.FreePersistent(set.m_BufferOffset);
+			}
+			else
+			{
+				std::vector<VkDescriptorSetLayoutBinding> bindings = GetTemplateBindings(*refreshed.m_Template);
+				bool allocated = false;
+
+				if (refreshed.m_Transient)
+				{
+					uint32_t threadIndex = GetDescriptorThreadIndex();
+					if (threadIndex < MaxDescriptorThreads)
+						allocated = m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()].threadAllocators[threadIndex].Allocate(&refreshed.m_Set, refreshed.m_Layout, bindings);
+				}
+				else
+				{
+					std::lock_guard<std::mutex> allocatorLock(m_SetAllocatorMutex);
+					allocated = m_SetAllocator.Allocate(&refreshed.m_Set, refreshed.m_Layout, bindings, &refreshed.m_Pool);
+				}
+
+				if (!allocated)
+				{
+					Log::Error("Failed to refresh descriptor set");
+					return;
+				}
+
+				vkUpdateDescriptorSetWithTemplate(m_Device, refreshed.m_Set, refreshed.m_Template->handle, refreshed.m_Payload.data());
+
+				if (!set.m_Transient && set.m_Set)
+					RetireDescriptorSet(set.m_Set, set.m_Pool);
+			}
+
+			// The payload doesn't change size so this only copies elements
+			set.m_Payload = refreshed.m_Payload;
+			set.m_Set = refreshed.m_Set;
+			set.m_Pool = refreshed.m_Pool;
+			set.m_BufferOffset = refreshed.m_BufferOffset;
+
+			for (size_t i = 0; i < set.m_Resources.size(); i++)
+				std::atomic_ref<uint64_t>(set.m_Resources[i].handleId).store(refreshed.m_Resources[i].handleId, std::memory_order_release);
+		}
+
+		void Device::RetireDescriptorSet(VkDescriptorSet set, VkDescriptorPool pool)
+		{
+			std::lock_guard<std::mutex> lock(m_SetAllocatorMutex);
+
+			// Read under the lock so the list stays in submit order
+			RetiredDescriptorSet retired{};
+			retired.set = set;
+			retired.pool = pool;
+			retired.retireValue = GetTimeline(Queue::Graphics).GetSubmittedValue();
+			retired.computeRetireValue = GetTimeline(Queue::Compute).GetSubmittedValue();
+
+			m_RetiredDescriptorSets.push_back(retired);
+		}
+
+		void Device::FreeRetiredDescriptorSets()
+		{
+			std::lock_guard<std::mutex> lock(m_SetAllocatorMutex);
+
+			// They retire in order so stop at the first the GPU could still be using
+			size_t freedCount = 0;
+			while (freedCount < m_RetiredDescriptorSets.size() && HasCompleted(Queue::Graphics, m_RetiredDescriptorSets[freedCount].retireValue) &&
+				HasCompleted(Queue::Compute, m_RetiredDescriptorSets[freedCount].computeRetireValue))
+			{
+				m_SetAllocator.Free(m_RetiredDescriptorSets[freedCount].set, m_RetiredDescriptorSets[freedCount].pool);
+				freedCount++;
+			}
+
+			m_RetiredDescriptorSets.erase(m_RetiredDescriptorSets.begin(), m_RetiredDescriptorSets.begin() + freedCount);
+		}
+
+		void Device::EvictCachedDescriptorSets()
+		{
+			std::lock_guard<std::mutex> lock(m_DescriptorCacheMutex);
+
+			for (auto it = m_DescriptorCache.begin(); it != m_DescriptorCache.end();)
+			{
+				std::vector<CachedDescriptorSet>& bucket = it->second;
+
+				for (size_t i = 0; i < bucket.size();)
+				{
+					if (m_DescriptorFrameCount - bucket[i].lastUsedFrame < m_DescriptorCacheMaxAge)
+					{
+						i++;
+						continue;
+					}
+
+					m_FreeCachedSets[bucket[i].layout].push_back(std::move(bucket[i]));
+
+					bucket[i] = std::move(bucket.back());
+					bucket.pop_back();
+
+					m_DescriptorCacheStats.setsEvicted++;
+					m_DescriptorCacheStats.cachedSets--;
+				}
+
+				if (bucket.empty())
+					it = m_DescriptorCache.erase(it);
+				else
+					++it;
+			}
+		}
+
+		DescriptorCacheStats Device::GetDescriptorCacheStats()
+		{
+			std::lock_guard<std::mutex> lock(m_DescriptorCacheMutex);
+			return m_DescriptorCacheStats;
+		}
+
+		void Device::BeginDescriptorFrame()
+		{
+			uint64_t frameCount = 0;
+			uint64_t retiringFrame = 0;
+			uint64_t retireValue = 0;
+			uint64_t computeRetireValue = 0;
+
+			{
+				// Compute submits record themselves against the current frame
+				std::lock_guard<std::mutex> lock(m_QueueMutex);
+				m_TransientDescriptorFrame.store((m_TransientDescriptorFrame.load() + 1) % MaxImagesInFlight);
+
+				TransientDescriptorFrame& frame = m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()];
+
+				retiringFrame = frame.frameCount;
+				retireValue = frame.retireValue;
+				computeRetireValue = frame.computeRetireValue;
+
+				frame.frameCount = frameCount = ++m_DescriptorFrameCount;
+			}
+
+			TransientDescriptorFrame& frame = m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()];
+
+			// Usually long finished by the time we come back round to it
+			GetTimeline(Queue::Graphics).Wait(retireValue);
+			GetTimeline(Queue::Compute).Wait(computeRetireValue);
+
+			m_RetiredFrameCount.store(retiringFrame);
+
+			for (auto& allocator : frame.threadAllocators)
+				allocator.Reset();
+
+			if (m_SupportedFeatures.descriptorBuffer)
+				m_DescriptorBuffer.BeginFrame(m_TransientDescriptorFrame.load());
+			else
+				FreeRetiredDescriptorSets();
+
+			// Walking the whole cache every frame isn't worth it, a set lives a few frames past its max age at most
+			if (frameCount % 16 == 0)
+				EvictCachedDescriptorSets();
+		}
+
+		void Device::EndDescriptorFrame(uint64_t graphicsSubmitValue)
+		{
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+			m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()].retireValue = graphicsSubmitValue;
+		}
+
+		bool Device::HasCompletedFrame(uint64_t frame)
+		{
+			// BeginDescriptorFrame has already waited on anything this old
+			if (frame <= m_RetiredFrameCount.load())
+				return true;
+
+			if (frame >= GetFrame())
+				return false;
+
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+
+			for (const TransientDescriptorFrame& slot : m_TransientDescriptorFrames)
 			{
-				Log::Error("Failed to Allocate Descriptor set");
+				if (slot.frameCount == frame)
+					return HasCompleted(Queue::Graphics, slot.retireValue) && HasCompleted(Queue::Compute, slot.computeRetireValue);
 			}
 
-			return set;
+			// Its slot was just taken over and BeginDescriptorFrame is still waiting on it
+			return false;
 		}
 
 		std::vector<CommandList> Device::AllocateCommandLists(Queue queue, CommandListType type, uint32_t count)
@@ -204,7 +994,7 @@ namespace hf
 
 			CommandQueueIdentifier iden{};
 			iden.queue = queue;
-			iden.threadNum = 0;
+			iden.threadNum = GetThreadIndex();
 
 			VkCommandPool pool = GetCommandPool(iden);
 
@@ -227,6 +1017,8 @@ namespace hf
 			{
 				CommandList& cmdList = cmdLists[i];
 				cmdList.m_Device = m_Device;
+				cmdList.m_ParentDevice = this;
+				cmdList.m_QueueFamily = GetQueueFamily(queue);
 
 				if (level & VK_COMMAND_BUFFER_LEVEL_SECONDARY)
 					cmdList.m_Secondary = true;
@@ -240,11 +1032,11 @@ namespace hf
 			return cmdLists;
 		}
 
-		void Device::ExecuteSingleUsageCommandList(Queue queue, std::function<void(CommandList&)> func, Semaphore* signal)
+		uint64_t Device::ExecuteSingleUsageCommandList(Queue queue, std::function<void(CommandList&)> func, Semaphore* signal)
 		{
 			CommandQueueIdentifier iden{};
 			iden.queue = queue;
-			iden.threadNum = 0;
+			iden.threadNum = GetThreadIndex();
 
 			VkCommandPool pool = GetCommandPool(iden);
 
@@ -256,6 +1048,8 @@ namespace hf
 
 			CommandList cmdList;
 			cmdList.m_Device = m_Device;
+			cmdList.m_ParentDevice = this;
+			cmdList.m_QueueFamily = GetQueueFamily(queue);
 			cmdList.m_SingleUse = true;
 
 			if (vkAllocateCommandBuffers(m_Device, &allocInfo, &cmdList.m_Buffer) != VK_SUCCESS)
@@ -267,102 +1061,97 @@ namespace hf
 			func(cmdList);
 			cmdList.End();
 
+			Timeline& timeline = GetTimeline(queue);
+
 			VkSubmitInfo submitInfo{};
 			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 			submitInfo.commandBufferCount = 1;
 			submitInfo.pCommandBuffers = &cmdList.m_Buffer;
 
-			VkQueue submitQueue = m_GraphicsQueue;
+			// The timeline is always signalled, the binary semaphore only if we have one
+			VkSemaphore signalSemaphores[] = { timeline.m_Semaphore, VK_NULL_HANDLE };
+			uint64_t signalValues[] = { 0, 0 };
+			uint32_t signalCount = 1;
 
-			switch (queue)
+			if (signal)
 			{
-			case Queue::Graphics:
-				submitQueue = m_GraphicsQueue;
-				break;
-			case Queue::Compute:
-				submitQueue = m_ComputeQueue;
-				break;
-			case Queue::Transfer:
-				submitQueue = m_TransferQueue;
-				break;
+				signalSemaphores[signalCount++] = signal->m_Semaphore;
 			}
 
-			// If we have a signal semaphore we want to use it
-			if (signal)
+			VkTimelineSemaphoreSubmitInfo timelineInfo{};
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timelineInfo.signalSemaphoreValueCount = signalCount;
+			timelineInfo.pSignalSemaphoreValues = signalValues;
+
+			submitInfo.pNext = &timelineInfo;
+			submitInfo.signalSemaphoreCount = signalCount;
+			submitInfo.pSignalSemaphores = signalSemaphores;
+
+			uint64_t submitValue = 0;
+
 			{
-				VkSemaphore signalSemaphores[] = { signal->m_Semaphore };
-				submitInfo.signalSemaphoreCount = 1;
-				submitInfo.pSignalSemaphores = signalSemaphores;
-			}
+				// The value is reserved under the same lock as the submit so the queue always signals in order
+				std::lock_guard<std::mutex> lock(m_QueueMutex);
+
+				submitValue = timeline.NextValue();
+				signalValues[0] = submitValue;
 
-			vkQueueSubmit(submitQueue, 1, &submitInfo, VK_NULL_HANDLE);
+				cmdList.m_Timeline = &timeline;
+				cmdList.m_SubmitValue = submitValue;
+
+				vkQueueSubmit(GetQueue(queue), 1, &submitInfo, VK_NULL_HANDLE);
+			}
 
 			// TODO: Is this the best thing to do? 
 			// Wait if we don't have a signal semaphore for the queue to finish execution
 			// This is for safety 
 			if (!signal)
-				vkQueueWaitIdle(submitQueue);
+				timeline.Wait(submitValue);
+
+			return submitValue;
 		}
 
-		void Device::QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, Semaphore* wait, Semaphore* signal)
+		uint64_t Device::QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, Semaphore* wait, Semaphore* signal)
 		{
 			std::vector<Semaphore*> semaphores;
 			semaphores.push_back(wait);
-			QueueSubmit(queue, cmdLists, semaphores, signal);
-			//m_FencePool.Reclaim();
+			return QueueSubmit(queue, cmdLists, semaphores, signal);
 		}
 
-		void Device::QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, std::vector<Semaphore*> wait, Semaphore* signal)
+		uint64_t Device::QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, std::vector<Semaphore*> wait, Semaphore* signal, const std::vector<TimelineWait>& timelineWaits)
 		{
-			m_FencePool.Reclaim();
-
-			VkQueue submitQueue = m_GraphicsQueue;
-
-			switch (queue)
-			{
-			case Queue::Graphics:
-				submitQueue = m_GraphicsQueue;
-				break;
-			case Queue::Compute:
-				submitQueue = m_ComputeQueue;
-				break;
-			case Queue::Transfer:
-				submitQueue = m_TransferQueue;
-				break;
-			}
+			Timeline& timeline = GetTimeline(queue);
 
 			VkSubmitInfo submitInfo{};
 			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 			std::vector< VkSemaphore> waitSemaphores{};
 			std::vector< VkPipelineStageFlags> waitStages;
+			std::vector<uint64_t> waitValues;
 			
 			for (auto& semaphore : wait)
 			{
 				waitSemaphores.push_back(semaphore->m_Semaphore);
 				waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+				waitValues.push_back(0);
 			}
 
-			submitInfo.waitSemaphoreCount = waitSemaphores.size();
+			for (auto& timelineWait : timelineWaits)
+			{
+				waitSemaphores.push_back(GetTimeline(timelineWait.queue).m_Semaphore);
+				waitStages.push_back(timelineWait.stages);
+				waitValues.push_back(timelineWait.value);
+			}
+
+			submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
 			submitInfo.pWaitSemaphores = waitSemaphores.data();
 			submitInfo.pWaitDstStageMask = waitStages.data();
 
 			std::vector<VkCommandBuffer> buffers(cmdLists.size());
 
-			VkFence signalFence = m_FencePool.GetNewFence();
-
 			int i = 0;
 			for (auto& cmd : cmdLists)
 			{
-				// We need to grab the command list for the current frame
-
-				cmd->m_FinishedExecution = signalFence;
-
-				// The reason we do this is so secondary command lists 
-				// also wait on the execution being finished because they could be rerecorded before the main command list 
-				for (auto& secondaryCmd : cmd->m_SecondaryCommandLists)
-					secondaryCmd->m_FinishedExecution = signalFence;
-
 				buffers[i] = cmd->m_Buffer;
 				i++;
 			}
@@ -370,15 +1159,57 @@ namespace hf
 			submitInfo.commandBufferCount = static_cast<uint32_t>(buffers.size());
 			submitInfo.pCommandBuffers = buffers.data();
 
-			VkSemaphore signalSemaphores[] = { signal->m_Semaphore };
-			submitInfo.signalSemaphoreCount = 1;
+			// Binary semaphores ignore their value but the counts have to match
+			VkSemaphore signalSemaphores[] = { timeline.m_Semaphore, VK_NULL_HANDLE };
+			uint64_t signalValues[] = { 0, 0 };
+			uint32_t signalCount = 1;
+
+			if (signal)
+			{
+				signalSemaphores[signalCount++] = signal->m_Semaphore;
+			}
+
+			VkTimelineSemaphoreSubmitInfo timelineInfo{};
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timelineInfo.waitSemaphoreValueCount = (uint32_t)waitValues.size();
+			timelineInfo.pWaitSemaphoreValues = waitValues.data();
+			timelineInfo.signalSemaphoreValueCount = signalCount;
+			timelineInfo.pSignalSemaphoreValues = signalValues;
+
+			submitInfo.pNext = &timelineInfo;
+			submitInfo.signalSemaphoreCount = signalCount;
 			submitInfo.pSignalSemaphores = signalSemaphores;
 
-			if (vkQueueSubmit(submitQueue, 1, &submitInfo, signalFence) != VK_SUCCESS)
+			// The value is reserved under the same lock as the submit so the queue always signals in order
+			std::lock_guard<std::mutex> lock(m_QueueMutex);
+
+			uint64_t submitValue = timeline.NextValue();
+			signalValues[0] = submitValue;
+
+			// Compute work can use the frame's transient descriptor sets, graphics submits are recorded by EndDescriptorFrame
+			if (queue == Queue::Compute)
+				m_TransientDescriptorFrames[m_TransientDescriptorFrame.load()].computeRetireValue = submitValue;
+
+			for (auto& cmd : cmdLists)
+			{
+				cmd->m_Timeline = &timeline;
+				cmd->m_SubmitValue = submitValue;
+
+				// The reason we do this is so secondary command lists 
+				// also wait on the execution being finished because they could be rerecorded before the main command list 
+				for (auto& secondaryCmd : cmd->m_SecondaryCommandLists)
+				{
+					secondaryCmd->m_Timeline = &timeline;
+					secondaryCmd->m_SubmitValue = submitValue;
+				}
+			}
+
+			if (vkQueueSubmit(GetQueue(queue), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
 			{
-				Log::Error("Failed to submit command lists to graphics queue");
+				Log::Error("Failed to submit command lists to queue");
 			}
 
+			return submitValue;
 		}
 
 		VkCommandPool Device::CreateNewCommandPool(Queue queue)
@@ -420,23 +1251,87 @@ namespace hf
 
 
 		void Device::QueueWait(Queue queue)
+		{
+			GetTimeline(queue).WaitIdle();
+		}
+
+		uint32_t Device::GetQueueFamily(Queue queue) const
 		{
 			switch (queue)
 			{
-			case Queue::Graphics:
-				vkQueueWaitIdle(m_GraphicsQueue);
-				break;
 			case Queue::Compute:
-				vkQueueWaitIdle(m_ComputeQueue);
-				break;
+				return m_ComputeQueueFamily;
 			case Queue::Transfer:
-				vkQueueWaitIdle(m_TransferQueue);
-				break;
+				return m_TransferQueueFamily;
+			default:
+				return m_GraphicsQueueFamily;
+			}
+		}
+
+		VkQueue Device::GetQueue(Queue queue)
+		{
+			switch (queue)
+			{
+			case Queue::Compute:
+				return m_ComputeQueue;
+			case Queue::Transfer:
+				return m_TransferQueue;
+			default:
+				return m_GraphicsQueue;
+			}
+		}
+
+		uint32_t Device::GetThreadIndex()
+		{
+			static std::atomic<uint32_t> s_ThreadCount = 0;
+			thread_local uint32_t index = s_ThreadCount++;
+
+			return index;
+		}
+
+		// Hands a thread's descriptor slot back when the thread exits
+		struct DescriptorThreadSlot
+		{
+			static std::mutex& Mutex() { static std::mutex mutex; return mutex; }
+			static std::vector<uint32_t>& FreeSlots() { static std::vector<uint32_t> slots; return slots; }
+			static uint32_t& SlotCount() { static uint32_t count = 0; return count; }
+
+			uint32_t index;
+
+			DescriptorThreadSlot()
+			{
+				std::lock_guard<std::mutex> lock(Mutex());
+
+				if (FreeSlots().empty())
+				{
+					index = SlotCount()++;
+				}
+				else
+				{
+					index = FreeSlots().back();
+					FreeSlots().pop_back();
+				}
 			}
+
+			~DescriptorThreadSlot()
+			{
+				std::lock_guard<std::mutex> lock(Mutex());
+				FreeSlots().push_back(index);
+			}
+		};
+
+		uint32_t Device::GetDescriptorThreadIndex()
+		{
+			// Unlike the thread index this stays below the number of threads alive at once
+			thread_local DescriptorThreadSlot slot;
+
+			return slot.index;
 		}
 
 		VkCommandPool Device::GetCommandPool(const CommandQueueIdentifier& iden)
 		{
+			std::lock_guard<std::mutex> lock(m_CommandPoolMutex);
+
 			VkCommandPool pool = nullptr;
 
 			if (m_CommandPools.find(iden) != m_CommandPools.end())
@@ -453,34 +1348,412 @@ namespace hf
 			return pool;
 		}
 
-		VkDescriptorSetLayout Device::GetSetLayout(DescriptorSetLayout& layout)
+		VkDescriptorSetLayout Device::GetSetLayout(const DescriptorSetLayout& layout, const DescriptorUpdateTemplate** updateTemplate)
 		{
-			size_t hash = layout.Hash();
-			if (m_DescriptorSetLayouts.find(hash) != m_DescriptorSetLayouts.end())
-				return m_DescriptorSetLayouts[hash];
+			std::lock_guard<std::mutex> lock(m_SetLayoutMutex);
+
+			auto it = m_DescriptorSetLayouts.find(layout);
+			if (it != m_DescriptorSetLayouts.end())
+			{
+				if (updateTemplate)
+					*updateTemplate = &it->second.updateTemplate;
+
+				return it->second.layout;
+			}
+
+			SetLayoutEntry& entry = m_DescriptorSetLayouts[layout];
 
-			VkDescriptorSetLayout setLayout;
+			std::vector<VkDescriptorSetLayoutBinding> bindings = layout.m_LayoutBindings;
 
 			VkDescriptorSetLayoutCreateInfo layoutInfo{};
 			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			layoutInfo.bindingCount = layout.m_LayoutBindings.size();
-			layoutInfo.pBindings = layout.m_LayoutBindings.data();
+			layoutInfo.bindingCount = bindings.size();
+			layoutInfo.pBindings = bindings.data();
+
+			if (m_SupportedFeatures.descriptorBuffer)
+			{
+				layoutInfo.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+
+				// Descriptor buffers have no dynamic descriptors, the command list writes a copy of the set
+				// with the offsets baked into the addresses instead so the shader side is unchanged
+				for (auto& binding : bindings)
+				{
+					if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+						binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+					else if (binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+						binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				}
+			}
+
+			if (layout.m_PushDescriptor)
+			{
+				if (m_SupportedFeatures.pushDescriptors)
+					layoutInfo.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+				else
+					Log::Error("Push descriptor layout requested but VK_KHR_push_descriptor isn't supported");
+			}
 
-			if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+			if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &entry.layout) != VK_SUCCESS)
 			{
 				Log::Error("Failed to create Descriptor Set Layout");
 			}
 
+			// Push descriptor sets are written in the command list so they don't need a template
+			if (!layout.m_PushDescriptor)
+			{
+				CreateUpdateTemplate(layout, entry);
+
+				if (m_SupportedFeatures.descriptorBuffer)
+					GetDescriptorBufferLayout(entry.layout, entry.updateTemplate);
+			}
+
 			Log::Info("Created New Unique Descriptor Set Layout");
 
-			m_DescriptorSetLayouts[hash] = setLayout;
+			if (updateTemplate)
+				*updateTemplate = &entry.updateTemplate;
+
+			return entry.layout;
+		}
+
+		void Device::CreateUpdateTemplate(const DescriptorSetLayout& layout, SetLayoutEntry& entry)
+		{
+			DescriptorUpdateTemplate& updateTemplate = entry.updateTemplate;
+
+			if (layout.m_LayoutBindings.empty())
+				return;
+
+			uint32_t maxBinding = 0;
+			for (auto& binding : layout.m_LayoutBindings)
+				maxBinding = std::max(maxBinding, binding.binding);
+
+			updateTemplate.bindingOffsets.resize(maxBinding + 1, UINT32_MAX);
+			updateTemplate.bindingTypes.resize(maxBinding + 1, VK_DESCRIPTOR_TYPE_MAX_ENUM);
+			updateTemplate.bindingCounts.resize(maxBinding + 1, 0);
+
+			std::vector<VkDescriptorUpdateTemplateEntry> entries;
+			entries.reserve(layout.m_LayoutBindings.size());
+
+			for (auto& binding : layout.m_LayoutBindings)
+			{
+				updateTemplate.bindingOffsets[binding.binding] = updateTemplate.descriptorCount;
+				updateTemplate.bindingTypes[binding.binding] = binding.descriptorType;
+				updateTemplate.bindingCounts[binding.binding] = binding.descriptorCount;
+
+				if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+					updateTemplate.dynamicCount += binding.descriptorCount;
 
-			return setLayout;
+				VkDescriptorUpdateTemplateEntry templateEntry{};
+				templateEntry.dstBinding = binding.binding;
+				templateEntry.dstArrayElement = 0;
+				templateEntry.descriptorCount = binding.descriptorCount;
+				templateEntry.descriptorType = binding.descriptorType;
+				templateEntry.offset = updateTemplate.descriptorCount * sizeof(DescriptorInfo);
+				templateEntry.stride = sizeof(DescriptorInfo);
+
+				entries.push_back(templateEntry);
+
+				updateTemplate.descriptorCount += binding.descriptorCount;
+			}
+
+			// Descriptor buffer sets are written with vkGetDescriptorEXT so only the payload layout is needed
+			if (m_SupportedFeatures.descriptorBuffer)
+				return;
+
+			VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+			templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+			templateInfo.descriptorUpdateEntryCount = entries.size();
+			templateInfo.pDescriptorUpdateEntries = entries.data();
+			templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+			templateInfo.descriptorSetLayout = entry.layout;
+
+			if (vkCreateDescriptorUpdateTemplate(m_Device, &templateInfo, nullptr, &updateTemplate.handle) != VK_SUCCESS)
+			{
+				Log::Error("Failed to create Descriptor Update Template");
+			}
+		}
+
+		void Device::GetDescriptorBufferLayout(VkDescriptorSetLayout setLayout, DescriptorUpdateTemplate& updateTemplate)
+		{
+			m_ExtensionFunctions.vkGetDescriptorSetLayoutSizeEXT(m_Device, setLayout, &updateTemplate.descriptorBufferSize);
+
+			updateTemplate.descriptorBufferOffsets.resize(updateTemplate.bindingOffsets.size(), 0);
+
+			for (uint32_t binding = 0; binding < updateTemplate.bindingOffsets.size(); binding++)
+			{
+				if (updateTemplate.bindingOffsets[binding] == UINT32_MAX)
+					continue;
+
+				m_ExtensionFunctions.vkGetDescriptorSetLayoutBindingOffsetEXT(m_Device, setLayout, binding, &updateTemplate.descriptorBufferOffsets[binding]);
+			}
+		}
+
+		bool Device::AllocateDescriptorBufferSet(const DescriptorUpdateTemplate& updateTemplate, bool transient, VkDeviceSize* offset)
+		{
+			if (transient)
+				return m_DescriptorBuffer.AllocateTransient(updateTemplate.descriptorBufferSize, offset);
+
+			return m_DescriptorBuffer.AllocatePersistent(updateTemplate.descriptorBufferSize, offset);
+		}
+
+		void Device::WriteDescriptorBuffer(const DescriptorSet& set, uint8_t* dst, const uint32_t* dynamicOffsets)
+		{
+			const DescriptorUpdateTemplate& updateTemplate = *set.m_Template;
+			const DescriptorInfo* payload = set.m_Payload.data();
+
+			const VkPhysicalDeviceDescriptorBufferPropertiesEXT& props = m_DescriptorBufferProperties;
+
+			uint32_t dynamicIndex = 0;
+
+			// Dynamic offsets are consumed in binding order, which is the order of the payload
+			for (uint32_t binding = 0; binding < updateTemplate.bindingOffsets.size(); binding++)
+			{
+				if (updateTemplate.bindingOffsets[binding] == UINT32_MAX)
+					continue;
+
+				VkDescriptorType type = updateTemplate.bindingTypes[binding];
+				uint32_t count = updateTemplate.bindingCounts[binding];
+				bool dynamic = type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+				if (dynamicOffsets && !dynamic)
+					continue;
+
+				uint8_t* bindingDst = dst + updateTemplate.descriptorBufferOffsets[binding];
+				const DescriptorInfo* infos = payload + updateTemplate.bindingOffsets[binding];
+				const DescriptorSet::BoundResource* resources = set.m_Resources.data() + updateTemplate.bindingOffsets[binding];
+
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const DescriptorInfo& info = infos[i];
+
+					// Every dynamic descriptor takes an offset even if it is left empty
+					VkDeviceSize dynamicOffset = (dynamic && dynamicOffsets) ? dynamicOffsets[dynamicIndex++] : 0;
+
+					VkDescriptorGetInfoEXT getInfo{};
+					getInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+
+					VkDescriptorAddressInfoEXT addressInfo{};
+					addressInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT;
+
+					switch (type)
+					{
+					case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+					case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+					case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+					case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+					{
+						if (!info.buffer.buffer)
+							continue;
+
+						// The buffer's cached address is only good while it still has the handle in the payload
+						const Buffer* resource = resources[i].buffer;
+						if (resource && resource->m_Buffer == info.buffer.buffer && resource->m_DeviceAddress)
+						{
+							addressInfo.address = resource->m_DeviceAddress;
+						}
+						else
+						{
+							VkBufferDeviceAddressInfo bufferAddressInfo{};
+							bufferAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+							bufferAddressInfo.buffer = info.buffer.buffer;
+
+							addressInfo.address = vkGetBufferDeviceAddress(m_Device, &bufferAddressInfo);
+						}
+
+						addressInfo.address += info.buffer.offset;
+						addressInfo.address += dynamicOffset;
+						addressInfo.range = info.buffer.range;
+
+						bool uniform = type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+						size_t size = uniform ? props.uniformBufferDescriptorSize : props.storageBufferDescriptorSize;
+
+						getInfo.type = uniform ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+						if (uniform)
+							getInfo.data.pUniformBuffer = &addressInfo;
+						else
+							getInfo.data.pStorageBuffer = &addressInfo;
+
+						m_ExtensionFunctions.vkGetDescriptorEXT(m_Device, &getInfo, size, bindingDst + size * i);
+						break;
+					}
+					case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+					{
+						if (props.combinedImageSamplerDescriptorSingleArray || count == 1)
+						{
+							getInfo.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+							getInfo.data.pCombinedImageSampler = &info.image;
+
+							m_ExtensionFunctions.vkGetDescriptorEXT(m_Device, &getInfo, props.combinedImageSamplerDescriptorSize, bindingDst + props.combinedImageSamplerDescriptorSize * i);
+							break;
+						}
+
+						// Otherwise arrays are laid out as every image followed by every sampler
+						getInfo.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+						getInfo.data.pSampledImage = &info.image;
+
+						m_ExtensionFunctions.vkGetDescriptorEXT(m_Device, &getInfo, props.sampledImageDescriptorSize, bindingDst + props.sampledImageDescriptorSize * i);
+
+						getInfo.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+						getInfo.data.pSampler = &info.image.sampler;
+
+						m_ExtensionFunctions.vkGetDescriptorEXT(m_Device, &getInfo, props.samplerDescriptorSize, bindingDst + props.sampledImageDescriptorSize * count + props.samplerDescriptorSize * i);
+						break;
+					}
+					case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+					{
+						getInfo.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+						getInfo.data.pStorageImage = &info.image;
+
+						m_ExtensionFunctions.vkGetDescriptorEXT(m_Device, &getInfo, props.storageImageDescriptorSize, bindingDst + props.storageImageDescriptorSize * i);
+						break;
+					}
+					default:
+						Log::Error("Descriptor type %d isn't supported by the descriptor buffer backend", type);
+						break;
+					}
+				}
+			}
+		}
+
+		VkShaderModule Device::GetShaderModule(const std::vector<uint8_t>& bytecode)
+		{
+			auto it = m_ShaderModules.find(bytecode);
+			if (it != m_ShaderModules.end())
+				return it->second;
+
+			VkShaderModule shaderModule = createShaderModule(m_Device, bytecode);
+
+			m_ShaderModules[bytecode] = shaderModule;
+
+			return shaderModule;
+		}
+
+		VkPipelineLayout Device::GetPipelineLayout(const std::vector<DescriptorSetLayout>& setLayouts, std::vector<VkPushConstantRange> pushConstants, bool useBindlessHeap)
+		{
+			PipelineLayoutKey key{};
+
+			// The heap always takes set 0 so the pipeline's own sets start at 1
+			if (useBindlessHeap)
+			{
+				if (m_SupportedFeatures.bindless)
+					key.setLayouts.push_back(m_BindlessHeap.m_Layout);
+				else
+					Log::Error("Pipeline uses the bindless heap but it isn't enabled on the device");
+			}
+
+			for (auto& setLayout : setLayouts)
+				key.setLayouts.push_back(GetSetLayout(setLayout));
+
+			// Push constant ranges come out of an unordered map so sort them to get a stable key
+			std::sort(pushConstants.begin(), pushConstants.end(), [](const VkPushConstantRange& a, const VkPushConstantRange& b)
+				{
+					return (a.stageFlags != b.stageFlags) ? a.stageFlags < b.stageFlags : a.offset < b.offset;
+				});
+
+			key.pushConstants = pushConstants;
+
+			auto it = m_PipelineLayouts.find(key);
+			if (it != m_PipelineLayouts.end())
+				return it->second;
+
+			VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+			pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+			pipelineLayoutInfo.setLayoutCount = key.setLayouts.size();
+			pipelineLayoutInfo.pSetLayouts = key.setLayouts.data();
+			pipelineLayoutInfo.pushConstantRangeCount = key.pushConstants.size();
+			pipelineLayoutInfo.pPushConstantRanges = key.pushConstants.data();
+
+			VkPipelineLayout layout;
+
+			if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+			{
+				Log::Error("failed to create pipeline layout!");
+			}
+
+			m_PipelineLayouts[key] = layout;
+
+			return layout;
 		}
 
 
+		PipelineCacheStats Device::GetPipelineCacheStats()
+		{
+			std::lock_guard<std::mutex> lock(m_PipelineCacheStatsMutex);
+			return m_PipelineCacheStats;
+		}
+
+		void Device::RecordPipelineFeedback(const VkPipelineCreationFeedback& feedback)
+		{
+			// The driver doesn't have to fill out the feedback
+			if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT))
+				return;
+
+			std::lock_guard<std::mutex> lock(m_PipelineCacheStatsMutex);
+
+			m_PipelineCacheStats.pipelinesCreated++;
+			m_PipelineCacheStats.creationTimeNs += feedback.duration;
+
+			if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT)
+				m_PipelineCacheStats.cacheHits++;
+		}
+
+		void Device::SavePipelineCache()
+		{
+			if (m_PipelineCachePath.empty())
+				return;
+
+			size_t dataSize = 0;
+			if (vkGetPipelineCacheData(m_Device, m_PipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+			{
+				Log::Warn("Failed to get pipeline cache data");
+				return;
+			}
+
+			std::vector<uint8_t> data(dataSize);
+			if (vkGetPipelineCacheData(m_Device, m_PipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+			{
+				Log::Warn("Failed to get pipeline cache data");
+				return;
+			}
+
+			// Write to a temporary file and swap it in so a crash mid write can't leave a corrupt cache behind
+			std::string tempPath = m_PipelineCachePath + ".tmp";
+
+			{
+				std::ofstream outstream(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+
+				if (!outstream.is_open())
+				{
+					Log::Warn("Failed to open pipeline cache file for writing: %s", tempPath.c_str());
+					return;
+				}
+
+				outstream.write((const char*)data.data(), dataSize);
+
+				if (!outstream.good())
+				{
+					Log::Warn("Failed to write pipeline cache");
+					return;
+				}
+			}
+
+			std::error_code error;
+			std::filesystem::rename(tempPath, m_PipelineCachePath, error);
+
+			if (error)
+			{
+				Log::Warn("Failed to replace pipeline cache file: %s", error.message().c_str());
+				std::filesystem::remove(tempPath, error);
+				return;
+			}
+
+			Log::Info("Saved Pipeline Cache (%zu bytes)", dataSize);
+		}
+
 		VkSampler Device::GetSampler(SamplerState& state)
 		{
+			std::lock_guard<std::mutex> lock(m_SamplerMutex);
+
 			if (m_Samplers.find(state) != m_Samplers.end())
 			{
 				return m_Samplers[state];
@@ -555,8 +1828,42 @@ namespace hf
 
 			m_Samplers[state] = sampler;
 
+			// Samplers live as long as the device so they never leave the heap
+			if (m_SupportedFeatures.bindless)
+				m_SamplerHeapIndices[state] = m_BindlessHeap.AddSampler(sampler);
+
 			return sampler;
 		}
 
+		uint32_t Device::GetSamplerHeapIndex(SamplerState& state)
+		{
+			if (!m_SupportedFeatures.bindless)
+				return BindlessHeap::InvalidIndex;
+
+			GetSampler(state);
+
+			std::lock_guard<std::mutex> lock(m_SamplerMutex);
+			return m_SamplerHeapIndices[state];
+		}
+
+		void Device::CreateBindlessHeap(const DeviceCreateInfo& info)
+		{
+			// The heap is visible to every stage so the per stage limits are the ones that matter
+			VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+			vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+			VkPhysicalDeviceProperties2 properties{};
+			properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties.pNext = &vulkan12Properties;
+
+			vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties);
+
+			uint32_t textureCount = std::min(info.bindlessTextureCount, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages);
+			uint32_t samplerCount = std::min(info.bindlessSamplerCount, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers);
+			uint32_t storageBufferCount = std::min(info.bindlessStorageBufferCount, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+
+			m_BindlessHeap.Init(m_Device, textureCount, samplerCount, storageBufferCount, m_Timelines);
+		}
+
 	}
 }
\ No newline at end of file
@@ -4,13 +4,22 @@
 #include "CommandList.h"
 #include "Semaphore.h"
 #include "../Core/Util.h"
-#include "FencePool.h"
+#include "Timeline.h"
 #include "GraphicsPipeline.h"
+#include "ComputePipeline.h"
+#include "PipelineKey.h"
 #include "Buffer.h"
 #include "DescriptorSetAllocator.h"
 #include "DescriptorSet.h"
 #include "SamplerState.h"
 #include "Surface.h"
+#include "BindlessHeap.h"
+#include "DescriptorBuffer.h"
+#include "Defragmenter.h"
+#include "ResidencyManager.h"
+#include "TransientAttachments.h"
+#include "../Core/ThreadPool.h"
+#include <mutex>
 
 namespace hf
 {
@@ -31,22 +40,137 @@ namespace hf
 		};
 
 
+		// Makes a submit wait until another queue's timeline has reached a value
+		struct TimelineWait
+		{
+			Queue queue;
+			uint64_t value;
+			VkPipelineStageFlags stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		};
+
 		struct DeviceCreateInfo
 		{
 			bool validationLayers;
+
+			// Where the pipeline cache is loaded from and saved to, leave empty to not persist it
+			std::string pipelineCachePath = "";
+
+			// Worker threads used by RetrieveGraphicsPipelineAsync
+			uint32_t pipelineCompileThreads = 2;
+
+			// Creates the global bindless heap if descriptor indexing is supported
+			bool bindlessHeap = false;
+			uint32_t bindlessTextureCount = 16384;
+			uint32_t bindlessSamplerCount = 256;
+			uint32_t bindlessStorageBufferCount = 16384;
+
+			// Frames a cached descriptor set can go without being written before it is recycled
+			uint32_t descriptorCacheMaxAge = 120;
+
+			// Writes descriptors into a buffer with VK_EXT_descriptor_buffer instead of allocating sets from pools.
+			// Opt in, it changes every set layout and pipeline the device creates. Only used when the extension
+			// is supported and the bindless heap isn't enabled, otherwise pools are used
+			bool descriptorBuffer = false;
+			size_t descriptorBufferSize = 8 * 1024 * 1024;
+			size_t transientDescriptorBufferSize = 2 * 1024 * 1024;
+
+			// Lets textures be written straight from CPU memory with VK_EXT_host_image_copy when the device supports it
+			bool hostImageCopy = true;
+
+			// Block size and dedicated allocation threshold for each memory class, indexed by MemoryClass
+			std::array<MemoryPoolDesc, MemoryClassCount> memoryPools = DefaultMemoryPools();
+
+			// Most the defragmenter copies per frame to compact the memory class pools, 0 turns it off
+			size_t defragmentBytesPerFrame = 4 * 1024 * 1024;
+
+			// Fractions of a device local heap's budget, past the high watermark registered resources are released until usage is under the low one
+			float residencyHighWatermark = 0.9f;
+			float residencyLowWatermark = 0.8f;
+
+			// Textures don't lose mips below this size
+			uint32_t residencyMinMipSize = 64;
 		};
 
 		struct SupportedFeatures
 		{
 			float maxAnisotropy;
+			size_t minUniformBufferOffsetAlignment;
+			size_t maxUniformBufferRange;
+			size_t minStorageBufferOffsetAlignment;
+			bool bindless = false;
+			bool pushDescriptors = false;
+			bool descriptorBuffer = false;
+			bool hostImageCopy = false;
+			bool memoryBudget = false;
 
 			void Print()
 			{
 				Log::Info("Device Supported Features:");
 				Log::Info(" - Max Anisotropy: %.4f", maxAnisotropy);
+				Log::Info(" - Min Uniform Buffer Offset Alignment: %zu", minUniformBufferOffsetAlignment);
+				Log::Info(" - Max Uniform Buffer Range: %zu", maxUniformBufferRange);
+				Log::Info(" - Min Storage Buffer Offset Alignment: %zu", minStorageBufferOffsetAlignment);
+				Log::Info(" - Bindless: %s", bindless ? "Yes" : "No");
+				Log::Info(" - Push Descriptors: %s", pushDescriptors ? "Yes" : "No");
+				Log::Info(" - Descriptor Buffer: %s", descriptorBuffer ? "Yes" : "No");
+				Log::Info(" - Host Image Copy: %s", hostImageCopy ? "Yes" : "No");
+				Log::Info(" - Memory Budget: %s", memoryBudget ? "Yes" : "No");
 			}
 		};
 
+		struct PipelineCacheStats
+		{
+			size_t loadedCacheSize = 0;
+			uint32_t pipelinesCreated = 0;
+			uint32_t pipelinesReused = 0;
+			uint32_t cacheHits = 0;
+			uint64_t creationTimeNs = 0;
+
+			void Print()
+			{
+				float hitRate = (pipelinesCreated > 0) ? 100.0f * (float)cacheHits / (float)pipelinesCreated : 0.0f;
+
+				Log::Info("Pipeline Cache Stats:");
+				Log::Info(" - Loaded Cache Size: %zu bytes", loadedCacheSize);
+				Log::Info(" - Pipelines Created: %d", pipelinesCreated);
+				Log::Info(" - Pipelines Reused: %d", pipelinesReused);
+				Log::Info(" - Cache Hit Rate: %.1f%% (%d / %d)", hitRate, cacheHits, pipelinesCreated);
+				Log::Info(" - Total Creation Time: %.2f ms", (double)creationTimeNs / 1000000.0);
+			}
+		};
+
+		struct DescriptorCacheStats
+		{
+			uint32_t cachedSets = 0;
+			uint64_t setsReused = 0;
+			uint64_t setsWritten = 0;
+			uint64_t setsEvicted = 0;
+
+			void Print()
+			{
+				Log::Info("Descriptor Cache Stats:");
+				Log::Info(" - Cached Sets: %d", cachedSets);
+				Log::Info(" - Sets Reused: %llu", setsReused);
+				Log::Info(" - Sets Written: %llu", setsWritten);
+				Log::Info(" - Sets Evicted: %llu", setsEvicted);
+			}
+		};
+
+		// Entry points for optional device extensions, null when the extension isn't enabled
+		struct ExtensionFunctions
+		{
+			PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR = nullptr;
+
+			PFN_vkGetDescriptorSetLayoutSizeEXT vkGetDescriptorSetLayoutSizeEXT = nullptr;
+			PFN_vkGetDescriptorSetLayoutBindingOffsetEXT vkGetDescriptorSetLayoutBindingOffsetEXT = nullptr;
+			PFN_vkGetDescriptorEXT vkGetDescriptorEXT = nullptr;
+			PFN_vkCmdBindDescriptorBuffersEXT vkCmdBindDescriptorBuffersEXT = nullptr;
+			PFN_vkCmdSetDescriptorBufferOffsetsEXT vkCmdSetDescriptorBufferOffsetsEXT = nullptr;
+
+			PFN_vkCopyMemoryToImageEXT vkCopyMemoryToImageEXT = nullptr;
+			PFN_vkTransitionImageLayoutEXT vkTransitionImageLayoutEXT = nullptr;
+		};
+
 		class Device
 		{
 		public:
@@ -58,34 +182,116 @@ namespace hf
 
 			Swapchain CreateSwapchain(Surface* surface, bool vsync = false);
 			
+			// Command lists come from a pool owned by the calling thread so they must be recorded on the thread that allocated them
 			std::vector<CommandList> AllocateCommandLists(Queue queue, CommandListType type, uint32_t count);
 
 			std::vector<Semaphore> CreateSemaphores(uint32_t count);
 
+			// Pipelines with matching state are only created once and shared, the device owns them
 			GraphicsPipeline RetrieveGraphicsPipeline(GraphicsPipelineDesc& desc);
 
+			// Returns straight away and compiles the pipeline on a worker thread if it isn't already cached
+			GraphicsPipelineHandle RetrieveGraphicsPipelineAsync(const GraphicsPipelineDesc& desc);
+
+			ComputePipeline RetrieveComputePipeline(ComputePipelineDesc& desc);
+
 			Buffer CreateBuffer(const BufferDesc& desc);
 
 			Texture CreateTexture(const TextureDesc& desc);
 
+			// Creates straight into where the resource will live, pooled ones are registered with the defragmenter.
+			// The resource can't be copied or moved afterwards since the defragmenter patches it through the pointer
+			void CreateBuffer(const BufferDesc& desc, Buffer* buffer);
+
+			void CreateTexture(const TextureDesc& desc, Texture* texture);
+
 			DescriptorSet AllocateDescriptorSet(DescriptorSetLayout layout);
 
-			void ExecuteSingleUsageCommandList(Queue queue, std::function<void(CommandList&)> func, Semaphore* signal = nullptr);
+			/*
+				Transient descriptor sets only live for the frame they are allocated in.
+				Each thread allocates from its own pools for the current frame, no locking,
+				and those pools are reset in bulk once the frame has finished on the GPU.
+			*/
+
+			DescriptorSet AllocateTransientDescriptorSet(const DescriptorSetLayout& layout);
+
+			/*
+				Cached descriptor sets don't own a VkDescriptorSet. Bind into them as usual and Write looks up a set
+				with the same layout and contents, only allocating and writing one when nothing matches,
+				so materials that don't change cost a hash lookup per frame instead of a descriptor write.
+				Sets that aren't written for descriptorCacheMaxAge frames are recycled so Write a cached set
+				each frame it is bound, and before any resource in it is disposed stop using it
+			*/
+
+			DescriptorSet CreateCachedDescriptorSet(const DescriptorSetLayout& layout);
+
+			DescriptorCacheStats GetDescriptorCacheStats();
+
+			// Moves on to the next frame's allocators, waiting for the graphics work that last used them to finish.
+			// Also ages the descriptor set cache
+			void BeginDescriptorFrame();
+
+			// The graphics submit that uses this frame's transient sets
+			void EndDescriptorFrame(uint64_t graphicsSubmitValue);
+
+			// The frame resources are stamped with when they are bound, moved on by BeginDescriptorFrame
+			uint64_t GetFrame() const { return m_DescriptorFrameCount.load(std::memory_order_relaxed); }
+
+			// True once every graphics and compute submit made during the frame has finished, never for the frame being recorded
+			bool HasCompletedFrame(uint64_t frame);
 
-			void QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, Semaphore* wait, Semaphore* signal);
+			uint64_t ExecuteSingleUsageCommandList(Queue queue, std::function<void(CommandList&)> func, Semaphore* signal = nullptr);
 
+			// Submits return the value the queue's timeline reaches once the work has finished
 
-			void QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, std::vector<Semaphore*> wait, Semaphore* signal);
+			uint64_t QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, Semaphore* wait, Semaphore* signal);
+
+
+			uint64_t QueueSubmit(Queue queue, std::vector<CommandList*> cmdLists, std::vector<Semaphore*> wait, Semaphore* signal, const std::vector<TimelineWait>& timelineWaits = {});
 
 			void QueueWait(Queue queue);
 
+			bool HasCompleted(Queue queue, uint64_t submitValue) { return GetTimeline(queue).IsComplete(submitValue); }
+
+			void WaitForSubmit(Queue queue, uint64_t submitValue) { GetTimeline(queue).Wait(submitValue); }
+
 			void WaitIdle() { vkDeviceWaitIdle(m_Device); }
 
 			const SupportedFeatures& GetSupportedFeatures() const { return m_SupportedFeatures; }
 
+			PipelineCacheStats GetPipelineCacheStats();
+
+			uint32_t GetQueueFamily(Queue queue) const;
+
+			bool HasDedicatedTransferQueue() const { return m_HasDedicatedTransferQueue; }
+
+			bool HasAsyncComputeQueue() const { return m_HasAsyncComputeQueue; }
+
+			// nullptr unless the bindless heap was requested and is supported
+			BindlessHeap* GetBindlessHeap() { return m_SupportedFeatures.bindless ? &m_BindlessHeap : nullptr; }
+
+			// Index of the sampler in the bindless heap, the sampler is created if it doesn't exist yet
+			uint32_t GetSamplerHeapIndex(SamplerState& state);
+
+			// Resources registered here can be moved to compact the memory class pools
+			Defragmenter& GetDefragmenter() { return m_Defragmenter; }
+
+			// Tracks the heap budgets and releases registered resources when memory runs short
+			ResidencyManager& GetResidency() { return m_Residency; }
+
+			// Render targets that only live for part of a frame, sharing memory with the ones they don't overlap
+			TransientAttachments& GetTransientAttachments() { return m_TransientAttachments; }
+
+			// A small unique index for the calling thread, used to pick its command pool
+			static uint32_t GetThreadIndex();
+
 		private:
 
 			friend class DescriptorSet;
+			friend class CommandList;
+			friend class Defragmenter;
+			friend class ResidencyManager;
+			friend class TransientAttachments;
 
 			SupportedFeatures m_SupportedFeatures;
 
@@ -102,16 +308,24 @@ namespace hf
 			uint32_t m_TransferQueueFamily = 0;
 
 			bool m_HasDedicatedTransferQueue = false; 
+			bool m_HasAsyncComputeQueue = false;
 
 			VkDevice m_Device;
 
 			VmaAllocator m_Allocator;
 
+			ExtensionFunctions m_ExtensionFunctions;
+
 			VkQueue m_GraphicsQueue;
 			VkQueue m_TransferQueue;
 			VkQueue m_ComputeQueue;
 
-			FencePool m_FencePool;
+			// One timeline per queue, indexed by Queue
+			Timeline m_Timelines[3];
+
+			Timeline& GetTimeline(Queue queue) { return m_Timelines[(int)queue]; }
+
+			VkQueue GetQueue(Queue queue);
 
 			struct CommandQueueIdentifier
 			{
@@ -137,15 +351,173 @@ namespace hf
 			};
 
 			std::unordered_map<CommandQueueIdentifier, VkCommandPool, CommandQueueIdentifierHash> m_CommandPools;
+			std::mutex m_CommandPoolMutex;
 			VkCommandPool GetCommandPool(const CommandQueueIdentifier& iden);
 
+			// Queues need external synchronisation when submitting from multiple threads
+			std::mutex m_QueueMutex;
+
 
-			std::unordered_map<size_t, VkDescriptorSetLayout> m_DescriptorSetLayouts;
+			struct SetLayoutEntry
+			{
+				VkDescriptorSetLayout layout;
+				DescriptorUpdateTemplate updateTemplate;
+			};
+
+			std::unordered_map<DescriptorSetLayout, SetLayoutEntry, DescriptorSetLayoutHash> m_DescriptorSetLayouts;
+			std::mutex m_SetLayoutMutex;
 			DescriptorSetAllocator m_SetAllocator;
+			std::mutex m_SetAllocatorMutex;
+
+			// Persistent pool sets that were replaced or disposed, freed once the work submitted before then has finished
+			struct RetiredDescriptorSet
+			{
+				VkDescriptorSet set;
+				VkDescriptorPool pool;
+				uint64_t retireValue;
+				uint64_t computeRetireValue;
+			};
+
+			std::vector<RetiredDescriptorSet> m_RetiredDescriptorSets;
+
+			void RetireDescriptorSet(VkDescriptorSet set, VkDescriptorPool pool);
+
+			void FreeRetiredDescriptorSets();
+
+			// Upper bound on the number of threads allocating transient sets at once, a thread's slot is reused once it exits
+			static const uint32_t MaxDescriptorThreads = 64;
+
+			static uint32_t GetDescriptorThreadIndex();
+
+			struct TransientDescriptorFrame
+			{
+				std::vector<DescriptorSetAllocator> threadAllocators;
+
+				// Sets can be used by the frame's graphics submit and any compute submitted during the frame
+				uint64_t retireValue = 0;
+				uint64_t computeRetireValue = 0;
+
+				// The frame count the slot was last started for
+				uint64_t frameCount = 0;
+			};
+
+			TransientDescriptorFrame m_TransientDescriptorFrames[MaxImagesInFlight];
+			// Advanced under the queue mutex, read without it by threads allocating transient sets
+			std::atomic<uint32_t> m_TransientDescriptorFrame = 0;
+
+			struct CachedDescriptorSet
+			{
+				VkDescriptorSetLayout layout;
+				std::vector<DescriptorInfo> payload;
+				std::vector<uint64_t> handleIds;
+				VkDescriptorSet set;
+				VkDeviceSize bufferOffset;
+				uint64_t lastUsedFrame;
+			};
+
+			// Keyed by a hash of the layout and contents, entries that collide share a bucket and are compared in full
+			std::unordered_map<size_t, std::vector<CachedDescriptorSet>> m_DescriptorCache;
+
+			// Evicted sets per layout, the GPU has finished with them so they can be rewritten straight away
+			std::unordered_map<VkDescriptorSetLayout, std::vector<CachedDescriptorSet>> m_FreeCachedSets;
+
+			std::mutex m_DescriptorCacheMutex;
+			std::atomic<uint64_t> m_DescriptorFrameCount = 0;
+
+			// Every frame up to this one has finished on the GPU
+			std::atomic<uint64_t> m_RetiredFrameCount = 0;
+			uint32_t m_DescriptorCacheMaxAge = 120;
+			DescriptorCacheStats m_DescriptorCacheStats;
+
+			void WriteCachedDescriptorSet(DescriptorSet& set);
 
-			VkDescriptorSetLayout GetSetLayout(DescriptorSetLayout& layout);
+			/// <summary>
+			/// Takes the current handles of the set's resources that were moved or lost a mip since they were bound.
+			/// Work in flight may still read the old contents so the set is written into fresh backing rather than updated,
+			/// the old descriptor buffer range or pool set is freed once that work has finished.
+			/// Called when a stale set is bound, the new backing is published before the handle ids so other threads binding
+			/// the set either see it stale and wait on the lock or see it refreshed
+			/// </summary>
+			void RefreshDescriptorSet(DescriptorSet& set);
+
+			std::mutex m_DescriptorRefreshMutex;
+
+			void EvictCachedDescriptorSets();
+
+			// Optionally hands back the update template made for the layout, it stays valid for the device's lifetime
+			VkDescriptorSetLayout GetSetLayout(const DescriptorSetLayout& layout, const DescriptorUpdateTemplate** updateTemplate = nullptr);
+
+			void CreateUpdateTemplate(const DescriptorSetLayout& layout, SetLayoutEntry& entry);
+
+			// Everything a pipeline is built from is deduplicated so shared state is only compiled once
+			std::unordered_map<std::vector<uint8_t>, VkShaderModule, ShaderBytecodeHash> m_ShaderModules;
+			std::unordered_map<PipelineLayoutKey, VkPipelineLayout, PipelineLayoutKeyHash> m_PipelineLayouts;
+			std::unordered_map<GraphicsPipelineKey, GraphicsPipeline, GraphicsPipelineKeyHash> m_GraphicsPipelines;
+			std::unordered_map<ComputePipelineKey, ComputePipeline, ComputePipelineKeyHash> m_ComputePipelines;
+			std::mutex m_PipelineMutex;
+
+			// Pipelines still being compiled, a second request for the same state shares the compile
+			std::unordered_map<GraphicsPipelineKey, std::shared_ptr<GraphicsPipelineHandle::State>, GraphicsPipelineKeyHash> m_PendingGraphicsPipelines;
+			ThreadPool m_CompileWorkers;
+
+			GraphicsPipelineHandle RequestGraphicsPipeline(const GraphicsPipelineDesc& desc, bool async);
+
+			void CompileGraphicsPipeline(std::shared_ptr<GraphicsPipelineHandle::State> state, const GraphicsPipelineKey& key, const GraphicsPipelineDesc& desc, const std::unordered_map<ShaderStage, VkShaderModule>& shaderModules);
+
+			VkShaderModule GetShaderModule(const std::vector<uint8_t>& bytecode);
+
+			VkPipelineLayout GetPipelineLayout(const std::vector<DescriptorSetLayout>& setLayouts, std::vector<VkPushConstantRange> pushConstants, bool useBindlessHeap);
+
+			VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+			std::string m_PipelineCachePath;
+
+			PipelineCacheStats m_PipelineCacheStats;
+			std::mutex m_PipelineCacheStatsMutex;
+
+			void SavePipelineCache();
+
+			void RecordPipelineFeedback(const VkPipelineCreationFeedback& feedback);
 
 			std::unordered_map<SamplerState, VkSampler, SamplerStateHash> m_Samplers;
+			std::unordered_map<SamplerState, uint32_t, SamplerStateHash> m_SamplerHeapIndices;
+			std::mutex m_SamplerMutex;
+
+			bool m_BindlessRequested = false;
+			BindlessHeap m_BindlessHeap;
+
+			void CreateBindlessHeap(const DeviceCreateInfo& info);
+
+			bool m_DescriptorBufferRequested = false;
+			DescriptorBuffer m_DescriptorBuffer;
+			VkPhysicalDeviceDescriptorBufferPropertiesEXT m_DescriptorBufferProperties{};
+
+			// Fills in the layout's descriptor buffer size and binding offsets
+			void GetDescriptorBufferLayout(VkDescriptorSetLayout setLayout, DescriptorUpdateTemplate& updateTemplate);
+
+			// Writes a set's payload into descriptor buffer memory with vkGetDescriptorEXT.
+			// With dynamic offsets only the dynamic bindings are written, with the offsets added to their buffer addresses
+			void WriteDescriptorBuffer(const DescriptorSet& set, uint8_t* dst, const uint32_t* dynamicOffsets = nullptr);
+
+			// Where a set lives in the descriptor buffer, persistent sets live until they are disposed
+			bool AllocateDescriptorBufferSet(const DescriptorUpdateTemplate& updateTemplate, bool transient, VkDeviceSize* offset);
+
+			MemoryPools m_MemoryPools;
+
+			Defragmenter m_Defragmenter;
+
+			ResidencyManager m_Residency;
+
+			TransientAttachments m_TransientAttachments;
+
+			bool m_HostImageCopyRequested = false;
+
+			// The layout host copies write in, ShaderReadOnlyOptimal when the device allows it so nothing needs transitioning afterwards
+			VkImageLayout m_HostCopyLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			// Whether the format can be host copied with optimal tiling without the device giving up optimal GPU access to the image, unless the desc forces it
+			bool SupportsHostImageCopy(const TextureDesc& desc, bool pooled);
+
+			VkPipelineCreateFlags GetPipelineCreateFlags() const { return m_SupportedFeatures.descriptorBuffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0; }
 
 			VkSampler GetSampler(SamplerState& state);
 
@@ -159,6 +531,8 @@ namespace hf
 
 			void CreateDevice();
 
+			void CreatePipelineCache();
+
 			VkCommandPool CreateNewCommandPool(Queue queue);
 		};
 	}
@@ -3,6 +3,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <fstream>
 
 VkResult vkCreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
 	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
@@ -256,17 +257,58 @@ namespace hf
 				{
 					m_TransferQueueFamily = i;
 					foundTransferQueueFamily = true;
-					m_HasDedicatedTransferQueue = true; 
 				}
-				else if (queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT && m_TransferQueueFamily == m_GraphicsQueueFamily)
+
+
+			}
+
+			// Try to grab a dedicated transfer queue, ideally one that can only do transfers (DMA engine)
+			// and otherwise one that at least isn't the graphics family 
+			int dedicatedTransfer = -1;
+			for (uint32_t i = 0; i < queueFamilyCount; i++)
+			{
+				VkQueueFlags flags = queueFamilies[i].queueFlags;
+
+				if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+					continue;
+
+				if (!(flags & VK_QUEUE_COMPUTE_BIT))
 				{
-					// Try to grab a dedicated transfer queue 
-					m_TransferQueueFamily = i;
+					dedicatedTransfer = i;
+					break;
 				}
 
+				if (dedicatedTransfer == -1)
+					dedicatedTransfer = i;
+			}
+
+			if (dedicatedTransfer != -1)
+			{
+				m_TransferQueueFamily = dedicatedTransfer;
+				m_HasDedicatedTransferQueue = true;
+			}
+			else if (foundGraphicsQueueFamily)
+			{
+				// Graphics queues can always do transfers
+				m_TransferQueueFamily = m_GraphicsQueueFamily;
+			}
+
+			// Async compute wants a compute family that isn't the graphics one so it can run alongside it
+			for (uint32_t i = 0; i < queueFamilyCount; i++)
+			{
+				VkQueueFlags flags = queueFamilies[i].queueFlags;
 
+				if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+				{
+					m_ComputeQueueFamily = i;
+					m_HasAsyncComputeQueue = true;
+					break;
+				}
 			}
 
+			Log::Info("Dedicated Transfer Queue: %s", m_HasDedicatedTransferQueue ? "Yes" : "No");
+			Log::Info("Async Compute Queue: %s", m_HasAsyncComputeQueue ? "Yes" : "No");
+
 			if (foundGraphicsQueueFamily)
 			{
 
@@ -322,9 +364,147 @@ namespace hf
 				queueCreateInfos.push_back(queueCreateInfo);
 			}
 
+			// Timeline semaphores are used for all queue synchronisation
+			VkPhysicalDeviceVulkan12Features vulkan12Features{};
+			vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+			vulkan12Features.timelineSemaphore = VK_TRUE;
+
+			if (m_BindlessRequested)
+			{
+				VkPhysicalDeviceVulkan12Features supported12{};
+				supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+				VkPhysicalDeviceFeatures2 supported{};
+				supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+				supported.pNext = &supported12;
+
+				vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supported);
+
+				// Everything the bindless heap needs from descriptor indexing
+				bool supportsBindless = supported12.descriptorIndexing &&
+					supported12.runtimeDescriptorArray &&
+					supported12.descriptorBindingPartiallyBound &&
+					supported12.descriptorBindingSampledImageUpdateAfterBind &&
+					supported12.descriptorBindingStorageBufferUpdateAfterBind &&
+					supported12.descriptorBindingUpdateUnusedWhilePending &&
+					supported12.shaderSampledImageArrayNonUniformIndexing &&
+					supported12.shaderStorageBufferArrayNonUniformIndexing;
+
+				if (supportsBindless)
+				{
+					vulkan12Features.descriptorIndexing = VK_TRUE;
+					vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+					vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+					vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+					vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+					vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+					vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+					vulkan12Features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+
+					m_SupportedFeatures.bindless = true;
+				}
+				else
+				{
+					Log::Warn("Bindless heap requested but the device doesn't support descriptor indexing");
+				}
+			}
+
+			// Only when bindless is off, pipelines can't mix descriptor buffers with the heap's pool allocated set
+			VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{};
+			descriptorBufferFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+
+			if (m_DescriptorBufferRequested && m_SupportedFeatures.bindless)
+			{
+				Log::Info("Descriptor buffer backend disabled because the bindless heap is enabled");
+			}
+			else if (m_DescriptorBufferRequested && checkDeviceExtensionSupport({ VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME }, m_PhysicalDevice))
+			{
+				VkPhysicalDeviceDescriptorBufferFeaturesEXT supportedDescriptorBuffer{};
+				supportedDescriptorBuffer.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+
+				VkPhysicalDeviceVulkan12Features supported12{};
+				supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+				supported12.pNext = &supportedDescriptorBuffer;
+
+				VkPhysicalDeviceFeatures2 supported{};
+				supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+				supported.pNext = &supported12;
+
+				vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supported);
+
+				if (supportedDescriptorBuffer.descriptorBuffer && supported12.bufferDeviceAddress)
+				{
+					descriptorBufferFeatures.descriptorBuffer = VK_TRUE;
+					descriptorBufferFeatures.pNext = vulkan12Features.pNext;
+					vulkan12Features.pNext = &descriptorBufferFeatures;
+					vulkan12Features.bufferDeviceAddress = VK_TRUE;
+
+					m_DescriptorBufferProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+
+					VkPhysicalDeviceProperties2 properties{};
+					properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+					properties.pNext = &m_DescriptorBufferProperties;
+
+					vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties);
+
+					m_SupportedFeatures.descriptorBuffer = true;
+				}
+			}
+
+			// Textures can be written from the CPU without a queue or staging buffer
+			VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures{};
+			hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+			if (m_HostImageCopyRequested && checkDeviceExtensionSupport({ VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME }, m_PhysicalDevice))
+			{
+				VkPhysicalDeviceHostImageCopyFeaturesEXT supportedHostImageCopy{};
+				supportedHostImageCopy.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+				VkPhysicalDeviceFeatures2 supported{};
+				supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+				supported.pNext = &supportedHostImageCopy;
+
+				vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supported);
+
+				if (supportedHostImageCopy.hostImageCopy)
+				{
+					hostImageCopyFeatures.hostImageCopy = VK_TRUE;
+					hostImageCopyFeatures.pNext = vulkan12Features.pNext;
+					vulkan12Features.pNext = &hostImageCopyFeatures;
+
+					// First call gets the layout counts, the second fills them in
+					VkPhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProperties{};
+					hostImageCopyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+
+					VkPhysicalDeviceProperties2 properties{};
+					properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+					properties.pNext = &hostImageCopyProperties;
+
+					vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties);
+
+					std::vector<VkImageLayout> copyDstLayouts(hostImageCopyProperties.copyDstLayoutCount);
+					hostImageCopyProperties.pCopyDstLayouts = copyDstLayouts.data();
+					hostImageCopyProperties.pCopySrcLayouts = nullptr;
+					hostImageCopyProperties.copySrcLayoutCount = 0;
+
+					vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties);
+
+					m_HostCopyLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+					for (VkImageLayout layout : copyDstLayouts)
+					{
+						if (layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+							m_HostCopyLayout = layout;
+					}
+
+					m_SupportedFeatures.hostImageCopy = true;
+				}
+			}
+
 			VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderFeature{};
 			dynamicRenderFeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
 			dynamicRenderFeature.dynamicRendering = VK_TRUE;
+			dynamicRenderFeature.pNext = &vulkan12Features;
 
 			VkPhysicalDeviceFeatures2 features{};
 			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
@@ -347,6 +527,30 @@ namespace hf
 				Log::Fatal("Device Extensions aren't supported");
 			}
 
+			// Optional extensions, the features that rely on them check SupportedFeatures
+
+			if (m_SupportedFeatures.descriptorBuffer)
+				deviceExtensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+
+			if (m_SupportedFeatures.hostImageCopy)
+				deviceExtensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+
+			// Lets VMA report the budget the driver gives us instead of guessing from the heap sizes
+			if (checkDeviceExtensionSupport({ VK_EXT_MEMORY_BUDGET_EXTENSION_NAME }, m_PhysicalDevice))
+			{
+				deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+				m_SupportedFeatures.memoryBudget = true;
+			}
+
+			// Push descriptors alongside descriptor buffers need the driver to handle them without a push descriptor buffer
+			bool pushDescriptorsUsable = !m_SupportedFeatures.descriptorBuffer || m_DescriptorBufferProperties.bufferlessPushDescriptors;
+
+			if (pushDescriptorsUsable && checkDeviceExtensionSupport({ VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME }, m_PhysicalDevice))
+			{
+				deviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+				m_SupportedFeatures.pushDescriptors = true;
+			}
+
 			deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
 			deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
@@ -360,7 +564,89 @@ namespace hf
 
 			vkGetDeviceQueue(m_Device, m_ComputeQueueFamily, 0, &m_ComputeQueue);
 
+			if (m_SupportedFeatures.pushDescriptors)
+				m_ExtensionFunctions.vkCmdPushDescriptorSetKHR = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(m_Device, "vkCmdPushDescriptorSetKHR");
+
+			if (m_SupportedFeatures.descriptorBuffer)
+			{
+				m_ExtensionFunctions.vkGetDescriptorSetLayoutSizeEXT = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(m_Device, "vkGetDescriptorSetLayoutSizeEXT");
+				m_ExtensionFunctions.vkGetDescriptorSetLayoutBindingOffsetEXT = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(m_Device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+				m_ExtensionFunctions.vkGetDescriptorEXT = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(m_Device, "vkGetDescriptorEXT");
+				m_ExtensionFunctions.vkCmdBindDescriptorBuffersEXT = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(m_Device, "vkCmdBindDescriptorBuffersEXT");
+				m_ExtensionFunctions.vkCmdSetDescriptorBufferOffsetsEXT = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(m_Device, "vkCmdSetDescriptorBufferOffsetsEXT");
+			}
+
+			if (m_SupportedFeatures.hostImageCopy)
+			{
+				m_ExtensionFunctions.vkCopyMemoryToImageEXT = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(m_Device, "vkCopyMemoryToImageEXT");
+				m_ExtensionFunctions.vkTransitionImageLayoutEXT = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(m_Device, "vkTransitionImageLayoutEXT");
+			}
+
 			Log::Info("Successfully Created Vulkan Device and retrieved Queues");
 		}
+
+		void Device::CreatePipelineCache()
+		{
+			std::vector<uint8_t> data;
+
+			if (!m_PipelineCachePath.empty())
+			{
+				std::ifstream instream(m_PipelineCachePath, std::ios::in | std::ios::binary);
+
+				if (instream.is_open())
+				{
+					data = std::vector<uint8_t>((std::istreambuf_iterator<char>(instream)), std::istreambuf_iterator<char>());
+				}
+			}
+
+			// Only use the data if it was made by this driver on this device, otherwise start with an empty cache
+			if (!data.empty())
+			{
+				VkPhysicalDeviceProperties properties{};
+				vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+
+				VkPipelineCacheHeaderVersionOne header{};
+				bool valid = data.size() >= sizeof(header);
+
+				if (valid)
+				{
+					memcpy(&header, data.data(), sizeof(header));
+
+					valid = header.headerSize >= sizeof(header) &&
+						header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+						header.vendorID == properties.vendorID &&
+						header.deviceID == properties.deviceID &&
+						memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+				}
+
+				if (!valid)
+				{
+					Log::Warn("Pipeline cache on disk doesn't match the current device or driver, discarding");
+					data.clear();
+				}
+			}
+
+			VkPipelineCacheCreateInfo cacheInfo{};
+			cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+			cacheInfo.initialDataSize = data.size();
+			cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+			if (vkCreatePipelineCache(m_Device, &cacheInfo, nullptr, &m_PipelineCache) != VK_SUCCESS)
+			{
+				// A driver is allowed to reject the data so try again without it
+				cacheInfo.initialDataSize = 0;
+				cacheInfo.pInitialData = nullptr;
+				data.clear();
+
+				if (vkCreatePipelineCache(m_Device, &cacheInfo, nullptr, &m_PipelineCache) != VK_SUCCESS)
+				{
+					Log::Error("Failed to create pipeline cache");
+				}
+			}
+
+			m_PipelineCacheStats.loadedCacheSize = data.size();
+
+			Log::Info("Created Pipeline Cache (%zu bytes loaded)", data.size());
+		}
 	}
 }
\ No newline at end of file
@@ -23,52 +23,36 @@ namespace hf
 			return shaderModule;
 		}
 
-		void GraphicsPipeline::Dispose()
+		void GraphicsPipeline::Create(VkDevice device, VkPipelineCache cache, const GraphicsPipelineDesc& desc, VkPipelineLayout layout, const std::unordered_map<ShaderStage, VkShaderModule>& shaderModules, VkPipelineCreateFlags flags, VkPipelineCreationFeedback* feedback)
 		{
-			vkDestroyPipelineLayout(m_CachedDevice, m_Layout, nullptr);
-			vkDestroyPipeline(m_CachedDevice, m_Pipeline, nullptr);
-		}
-
-		void GraphicsPipeline::Create(VkDevice device, const GraphicsPipelineDesc& desc, std::vector<VkDescriptorSetLayout> setLayouts)
-		{
-			m_CachedDevice = device;
-
-			std::vector<VkShaderModule> shaderModules;
+			m_Layout = layout;
 
 			std::vector< VkPipelineShaderStageCreateInfo> shaderStages;
 
-			if (desc.shaders.find(ShaderStage::Vertex) != desc.shaders.end())
+			if (shaderModules.find(ShaderStage::Vertex) != shaderModules.end())
 			{
 				// Has Vertex Stage
 
-				VkShaderModule vertexModule = createShaderModule(device, desc.shaders.at(ShaderStage::Vertex).bytecode);
-
 				VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 				vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 				vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-				vertShaderStageInfo.module = vertexModule;
+				vertShaderStageInfo.module = shaderModules.at(ShaderStage::Vertex);
 				vertShaderStageInfo.pName = "main";
 
-				shaderModules.push_back(vertexModule);
-
 				shaderStages.push_back(vertShaderStageInfo);
 
 			}
 
-			if (desc.shaders.find(ShaderStage::Fragment) != desc.shaders.end())
+			if (shaderModules.find(ShaderStage::Fragment) != shaderModules.end())
 			{
 				// Has Fragment Stage
 
-				VkShaderModule fragModule = createShaderModule(device, desc.shaders.at(ShaderStage::Fragment).bytecode);
-
 				VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
 				fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 				fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-				fragShaderStageInfo.module = fragModule;
+				fragShaderStageInfo.module = shaderModules.at(ShaderStage::Fragment);
 				fragShaderStageInfo.pName = "main";
 
-				shaderModules.push_back(fragModule);
-
 				shaderStages.push_back(fragShaderStageInfo);
 
 			}
@@ -236,42 +220,9 @@ namespace hf
 
 			// -------------------------------------
 
-			VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-			pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-			pipelineLayoutInfo.setLayoutCount = setLayouts.size();
-			pipelineLayoutInfo.pSetLayouts = setLayouts.data();
-
-			std::vector<VkPushConstantRange> pushConstants{};
-
-			for (auto& range : desc.pushConstantRanges)
-			{
-				VkPushConstantRange r;
-				r.size = range.second.size;
-				r.offset = range.second.offset;
-
-				switch (range.first)
-				{
-				case ShaderStage::Vertex:
-					r.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-					break;
-				case ShaderStage::Fragment:
-					r.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-					break;
-				}
-
-				pushConstants.push_back(r);
-			}
-
-			pipelineLayoutInfo.pushConstantRangeCount = pushConstants.size();
-			pipelineLayoutInfo.pPushConstantRanges = pushConstants.data();
-
-			if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &m_Layout) != VK_SUCCESS)
-			{
-				Log::Error("failed to create pipeline layout!");
-			}
-
 			VkGraphicsPipelineCreateInfo pipelineInfo{};
 			pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+			pipelineInfo.flags = flags;
 			pipelineInfo.stageCount = shaderStages.size();
 			pipelineInfo.pStages = shaderStages.data();
 			pipelineInfo.pVertexInputState = &vertexInputInfo;
@@ -289,14 +240,20 @@ namespace hf
 			pipelineInfo.basePipelineIndex = -1;
 			pipelineInfo.pNext = &pipelineRenderingInfo;
 
-			if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS) 
+			// Lets the device know if the pipeline came out of the cache
+			VkPipelineCreationFeedbackCreateInfo feedbackInfo{};
+			feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+			feedbackInfo.pPipelineCreationFeedback = feedback;
+
+			if (feedback)
 			{
-				Log::Error("failed to create graphics pipeline!");
+				pipelineRenderingInfo.pNext = &feedbackInfo;
 			}
 
-
-			for (auto& module : shaderModules)
-				vkDestroyShaderModule(device, module, nullptr);
+			if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS) 
+			{
+				Log::Error("failed to create graphics pipeline!");
+			}
 
 			Log::Info("Successfully Created Graphics Pipeline");
 		}
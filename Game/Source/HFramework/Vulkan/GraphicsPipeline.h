@@ -1,6 +1,10 @@
 #pragma once
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "../Graphics/Format.h"
 #include "../Graphics/ShaderEnums.h"
 #include "VulkanInclude.h"
@@ -16,10 +20,12 @@ namespace hf
 			std::vector<uint8_t> bytecode;
 		};
 
+		VkShaderModule createShaderModule(VkDevice device, const std::vector<uint8_t>& code);
+
 		struct VertexAttribute
 		{
-			VertexAttribute() : location(0), format(Format::None), offset(0) { }
-			VertexAttribute(uint32_t location, Format format, uint32_t offset) : location(location), format(format), offset(offset) { }
+			constexpr VertexAttribute() : location(0), format(Format::None), offset(0) { }
+			constexpr VertexAttribute(uint32_t location, Format format, uint32_t offset) : location(location), format(format), offset(offset) { }
 
 			uint32_t location;
 			Format format;
@@ -74,14 +80,15 @@ namespace hf
 			bool depthTest = true;
 			bool depthWrite = true;
 
+			// Puts the device's bindless heap at set 0, setLayouts then start at set 1
+			bool useBindlessHeap = false;
+
 		};
 
+		// Pipelines are owned by the device and shared between everything that asks for the same state,
+		// they are destroyed when the device is disposed
 		class GraphicsPipeline
 		{
-		public:
-
-			void Dispose();
-
 		private:
 
 			friend class Device;
@@ -90,9 +97,54 @@ namespace hf
 			VkPipeline m_Pipeline;
 			VkPipelineLayout m_Layout;
 
-			VkDevice m_CachedDevice;
+			void Create(VkDevice device, VkPipelineCache cache, const GraphicsPipelineDesc& desc, VkPipelineLayout layout, const std::unordered_map<ShaderStage, VkShaderModule>& shaderModules, VkPipelineCreateFlags flags = 0, VkPipelineCreationFeedback* feedback = nullptr);
+		};
+
+		/// <summary>
+		/// A pipeline that may still be compiling on a background thread.
+		/// Handles for the same state share the compile, check IsReady before binding or let CommandList::BindPipeline fall back
+		/// </summary>
+		class GraphicsPipelineHandle
+		{
+		public:
+
+			bool IsReady() const
+			{
+				return m_State && m_State->ready.load(std::memory_order_acquire);
+			}
+
+			// Returns nullptr until the pipeline has finished compiling
+			GraphicsPipeline* Get()
+			{
+				return IsReady() ? &m_State->pipeline : nullptr;
+			}
+
+			// Blocks until the pipeline has finished compiling
+			GraphicsPipeline* Wait()
+			{
+				if (!m_State)
+					return nullptr;
+
+				std::unique_lock<std::mutex> lock(m_State->mutex);
+				m_State->compiled.wait(lock, [this]() { return m_State->ready.load(std::memory_order_acquire); });
+
+				return &m_State->pipeline;
+			}
+
+		private:
+
+			friend class Device;
+
+			struct State
+			{
+				GraphicsPipeline pipeline;
+				std::atomic<bool> ready = false;
+
+				std::mutex mutex;
+				std::condition_variable compiled;
+			};
 
-			void Create(VkDevice device, const GraphicsPipelineDesc& desc, std::vector<VkDescriptorSetLayout> setLayouts);
+			std::shared_ptr<State> m_State;
 		};
 	}
 }
\ No newline at end of file
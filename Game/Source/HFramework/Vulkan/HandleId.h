@@ -0,0 +1,17 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		// Every buffer and image handle a resource is given gets a new id. Vulkan handles are recycled once destroyed
+		// but ids never are, so anything remembering a resource by its id can tell when the handle behind it changed
+		inline uint64_t NextHandleId()
+		{
+			static std::atomic<uint64_t> s_NextId = 1;
+			return s_NextId++;
+		}
+	}
+}
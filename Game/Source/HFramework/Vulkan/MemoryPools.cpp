@@ -0,0 +1,132 @@
+#include "MemoryPools.h"
+#include "../Core/Log.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		static const char* MemoryClassNames[MemoryClassCount] = { "Default", "Static Geometry", "Sampled Texture", "Render Target", "Staging", "Readback" };
+
+		void MemoryPools::Init(VmaAllocator allocator, const std::array<MemoryPoolDesc, MemoryClassCount>& descs)
+		{
+			m_Allocator = allocator;
+			m_Descs = descs;
+
+			for (uint32_t i = 1; i < MemoryClassCount; i++)
+			{
+				MemoryClass memoryClass = (MemoryClass)i;
+
+				// Typical resources of the class decide the memory type
+				VkBufferCreateInfo bufferInfo{};
+				bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+				bufferInfo.size = 0x10000;
+				bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+				VkImageCreateInfo imageInfo{};
+				imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+				imageInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageInfo.extent = { 256, 256, 1 };
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = 1;
+				imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+				imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+				imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+				VmaAllocationCreateInfo allocInfo{};
+				allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+				uint32_t memoryTypeIndex = 0;
+				VkResult result = VK_SUCCESS;
+
+				switch (memoryClass)
+				{
+				case MemoryClass::StaticGeometry:
+					bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+					allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+					result = vmaFindMemoryTypeIndexForBufferInfo(m_Allocator, &bufferInfo, &allocInfo, &memoryTypeIndex);
+					break;
+				case MemoryClass::SampledTexture:
+					imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+					allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+					result = vmaFindMemoryTypeIndexForImageInfo(m_Allocator, &imageInfo, &allocInfo, &memoryTypeIndex);
+					break;
+				case MemoryClass::RenderTarget:
+					imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+					allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+					result = vmaFindMemoryTypeIndexForImageInfo(m_Allocator, &imageInfo, &allocInfo, &memoryTypeIndex);
+					break;
+				case MemoryClass::Staging:
+					bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+					allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+					result = vmaFindMemoryTypeIndexForBufferInfo(m_Allocator, &bufferInfo, &allocInfo, &memoryTypeIndex);
+					break;
+				case MemoryClass::Readback:
+					bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+					allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+					result = vmaFindMemoryTypeIndexForBufferInfo(m_Allocator, &bufferInfo, &allocInfo, &memoryTypeIndex);
+					break;
+				}
+
+				if (result != VK_SUCCESS)
+				{
+					Log::Warn("No memory type for the %s pool, its resources use the default pools", MemoryClassNames[i]);
+					continue;
+				}
+
+				VkMemoryPropertyFlags memoryFlags = 0;
+				vmaGetMemoryTypeProperties(m_Allocator, memoryTypeIndex, &memoryFlags);
+				m_HostVisible[i] = memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+				// Everything in the class is dedicated so there is nothing to pool
+				if (m_Descs[i].dedicatedThreshold == 0)
+					continue;
+
+				VmaPoolCreateInfo poolInfo{};
+				poolInfo.memoryTypeIndex = memoryTypeIndex;
+				poolInfo.blockSize = m_Descs[i].blockSize;
+
+				if (vmaCreatePool(m_Allocator, &poolInfo, &m_Pools[i]) != VK_SUCCESS)
+				{
+					Log::Warn("Failed to create the %s pool, its resources use the default pools", MemoryClassNames[i]);
+					m_Pools[i] = VK_NULL_HANDLE;
+					continue;
+				}
+
+				vmaSetPoolName(m_Allocator, m_Pools[i], MemoryClassNames[i]);
+
+				Log::Info("Created %s Memory Pool (%zu MB blocks, type %u)", MemoryClassNames[i], m_Descs[i].blockSize / (1024 * 1024), memoryTypeIndex);
+			}
+		}
+
+		void MemoryPools::Dispose()
+		{
+			for (auto& pool : m_Pools)
+			{
+				if (pool)
+					vmaDestroyPool(m_Allocator, pool);
+			}
+		}
+
+		MemoryPlacement MemoryPools::GetPlacement(MemoryClass memoryClass, size_t size) const
+		{
+			MemoryPlacement placement{};
+
+			if (memoryClass == MemoryClass::Default)
+				return placement;
+
+			const MemoryPoolDesc& desc = m_Descs[(int)memoryClass];
+
+			// Fixed block pools can't hold dedicated allocations so those come from the default pools
+			if (size >= desc.dedicatedThreshold)
+			{
+				placement.dedicated = true;
+				return placement;
+			}
+
+			placement.pool = m_Pools[(int)memoryClass];
+			return placement;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "VulkanInclude.h"
+#include <array>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		// Which pool a resource's memory comes from
+		enum class MemoryClass
+		{
+			Default,			/* VMA's own pools for buffers, textures pick SampledTexture or RenderTarget */
+			StaticGeometry,		/* Device local vertex, index and storage data */
+			SampledTexture,
+			RenderTarget,
+			Staging,			/* Host visible, written sequentially by the CPU and read by transfers */
+			Readback,			/* Host visible and cached, written by the GPU and read by the CPU */
+		};
+
+		static const uint32_t MemoryClassCount = 6;
+
+		struct MemoryPoolDesc
+		{
+			// Size of each VkDeviceMemory block the pool allocates
+			size_t blockSize = 64 * 1024 * 1024;
+
+			// Resources at least this big get their own allocation instead, 0 makes every resource dedicated and creates no pool
+			size_t dedicatedThreshold = 16 * 1024 * 1024;
+		};
+
+		// Indexed by MemoryClass, Default is unused
+		static constexpr std::array<MemoryPoolDesc, MemoryClassCount> DefaultMemoryPools()
+		{
+			std::array<MemoryPoolDesc, MemoryClassCount> pools{};
+
+			pools[(int)MemoryClass::StaticGeometry] = { 64 * 1024 * 1024, 32 * 1024 * 1024 };
+			pools[(int)MemoryClass::SampledTexture] = { 64 * 1024 * 1024, 16 * 1024 * 1024 };
+			pools[(int)MemoryClass::RenderTarget] = { 0, 0 };
+			pools[(int)MemoryClass::Staging] = { 32 * 1024 * 1024, 16 * 1024 * 1024 };
+			pools[(int)MemoryClass::Readback] = { 16 * 1024 * 1024, 8 * 1024 * 1024 };
+
+			return pools;
+		}
+
+		// Where a resource should be allocated from
+		struct MemoryPlacement
+		{
+			VmaPool pool = VK_NULL_HANDLE;
+			bool dedicated = false;
+		};
+
+		/*
+			One VMA pool per resource class so small resources share big blocks rather than each paying for a vkAllocateMemory,
+			while the ones worth it (render targets, anything large) still get dedicated memory.
+			A pool's memory type is worked out from a typical resource of its class, resources that can't live in it fall back to VMA's default pools.
+		*/
+		class MemoryPools
+		{
+		public:
+
+			MemoryPlacement GetPlacement(MemoryClass memoryClass, size_t size) const;
+
+			// Whether the class's memory can be mapped
+			bool IsHostVisible(MemoryClass memoryClass) const { return m_HostVisible[(int)memoryClass]; }
+
+		private:
+
+			friend class Device;
+			friend class Defragmenter;
+
+			void Init(VmaAllocator allocator, const std::array<MemoryPoolDesc, MemoryClassCount>& descs);
+
+			void Dispose();
+
+			VmaAllocator m_Allocator;
+
+			std::array<MemoryPoolDesc, MemoryClassCount> m_Descs;
+			std::array<VmaPool, MemoryClassCount> m_Pools{};
+			std::array<bool, MemoryClassCount> m_HostVisible{};
+		};
+	}
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <string_view>
+#include "VulkanInclude.h"
+#include "GraphicsPipeline.h"
+#include "../Core/Util.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		/*
+			Keys used by the device to deduplicate pipelines and the objects they are built from.
+			Shader modules and layouts are deduplicated first so pipeline keys can refer to them by handle,
+			every key is compared in full so a hash collision can never hand back the wrong object.
+		*/
+
+		struct ShaderBytecodeHash
+		{
+			size_t operator()(const std::vector<uint8_t>& bytecode) const
+			{
+				return std::hash<std::string_view>()(std::string_view((const char*)bytecode.data(), bytecode.size()));
+			}
+		};
+
+		struct PipelineLayoutKey
+		{
+			std::vector<VkDescriptorSetLayout> setLayouts;
+			std::vector<VkPushConstantRange> pushConstants;
+
+			bool operator==(const PipelineLayoutKey& rh) const
+			{
+				if (setLayouts != rh.setLayouts || pushConstants.size() != rh.pushConstants.size())
+					return false;
+
+				for (size_t i = 0; i < pushConstants.size(); i++)
+				{
+					const VkPushConstantRange& a = pushConstants[i];
+					const VkPushConstantRange& b = rh.pushConstants[i];
+
+					if (a.stageFlags != b.stageFlags || a.offset != b.offset || a.size != b.size)
+						return false;
+				}
+
+				return true;
+			}
+		};
+
+		struct PipelineLayoutKeyHash
+		{
+			size_t operator()(const PipelineLayoutKey& key) const
+			{
+				size_t hash = 0;
+				for (auto& setLayout : key.setLayouts)
+					hash_combine(hash, setLayout);
+
+				for (auto& range : key.pushConstants)
+				{
+					hash_combine(hash, range.stageFlags);
+					hash_combine(hash, range.offset);
+					hash_combine(hash, range.size);
+				}
+
+				return hash;
+			}
+		};
+
+		struct GraphicsPipelineKey
+		{
+			VkShaderModule vertexShader = VK_NULL_HANDLE;
+			VkShaderModule fragmentShader = VK_NULL_HANDLE;
+			VkPipelineLayout layout = VK_NULL_HANDLE;
+
+			// Fixed function state packed into a single word:
+			// [0-1] topology, [2-3] cull mode, [4] depth test, [5] depth write, [8-15] depth format, [16-23] colour target count
+			uint64_t state = 0;
+
+			// Colour formats four to a word followed by the vertex layout.
+			// Each binding is a header word (binding, input rate, attribute count) then its stride,
+			// then one word per attribute (location, format, offset)
+			std::vector<uint32_t> packed;
+
+			static GraphicsPipelineKey Create(const GraphicsPipelineDesc& desc, VkShaderModule vertexShader, VkShaderModule fragmentShader, VkPipelineLayout layout)
+			{
+				GraphicsPipelineKey key;
+				key.vertexShader = vertexShader;
+				key.fragmentShader = fragmentShader;
+				key.layout = layout;
+
+				key.state |= (uint64_t)desc.topologyMode & 0x3;
+				key.state |= ((uint64_t)desc.cullMode & 0x3) << 2;
+				key.state |= (uint64_t)desc.depthTest << 4;
+				key.state |= (uint64_t)desc.depthWrite << 5;
+				key.state |= ((uint64_t)desc.depthTargetFormat & 0xFF) << 8;
+				key.state |= ((uint64_t)desc.colourTargetFormats.size() & 0xFF) << 16;
+
+				for (size_t i = 0; i < desc.colourTargetFormats.size(); i += 4)
+				{
+					uint32_t word = 0;
+					for (size_t j = i; j < i + 4 && j < desc.colourTargetFormats.size(); j++)
+						word |= ((uint32_t)desc.colourTargetFormats[j] & 0xFF) << (8 * (j - i));
+
+					key.packed.push_back(word);
+				}
+
+				for (auto& binding : desc.vertexLayout)
+				{
+					key.packed.push_back((binding.binding & 0xFF) | ((uint32_t)binding.inputRate << 8) | ((uint32_t)binding.attributes.size() << 16));
+					key.packed.push_back(binding.stride);
+
+					// Attribute offsets are limited to a few thousand bytes by the spec so 16 bits is plenty
+					for (auto& attr : binding.attributes)
+						key.packed.push_back((attr.location & 0xFF) | (((uint32_t)attr.format & 0xFF) << 8) | ((attr.offset & 0xFFFF) << 16));
+				}
+
+				return key;
+			}
+
+			bool operator==(const GraphicsPipelineKey& rh) const
+			{
+				return (state == rh.state && layout == rh.layout && vertexShader == rh.vertexShader && fragmentShader == rh.fragmentShader && packed == rh.packed);
+			}
+		};
+
+		struct GraphicsPipelineKeyHash
+		{
+			size_t operator()(const GraphicsPipelineKey& key) const
+			{
+				size_t hash = 0;
+				hash_combine(hash, key.state);
+				hash_combine(hash, key.layout);
+				hash_combine(hash, key.vertexShader);
+				hash_combine(hash, key.fragmentShader);
+
+				for (auto& word : key.packed)
+					hash_combine(hash, word);
+
+				return hash;
+			}
+		};
+
+		struct ComputePipelineKey
+		{
+			VkShaderModule shader = VK_NULL_HANDLE;
+			VkPipelineLayout layout = VK_NULL_HANDLE;
+
+			bool operator==(const ComputePipelineKey& rh) const
+			{
+				return (shader == rh.shader && layout == rh.layout);
+			}
+		};
+
+		struct ComputePipelineKeyHash
+		{
+			size_t operator()(const ComputePipelineKey& key) const
+			{
+				size_t hash = 0;
+				hash_combine(hash, key.shader);
+				hash_combine(hash, key.layout);
+				return hash;
+			}
+		};
+	}
+}
@@ -0,0 +1,447 @@
+#include "ResidencyManager.h"
+#include "Device.h"
+#include "TextureUtil.h"
+#include <algorithm>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void ResidencyManager::Init(Device* device, float highWatermark, float lowWatermark, uint32_t minMipSize)
+		{
+			m_Device = device;
+			m_Allocator = device->m_Allocator;
+			m_HighWatermark = highWatermark;
+			m_LowWatermark = std::min(lowWatermark, highWatermark);
+			m_MinMipSize = std::max(minMipSize, 1u);
+
+			const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+			vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+			m_Budgets.resize(memoryProperties->memoryHeapCount);
+			m_Stats.heaps.resize(memoryProperties->memoryHeapCount);
+
+			for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+				m_Stats.heaps[i].deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+			m_CommandList = device->AllocateCommandLists(Queue::Graphics, CommandListType::Primary, 1)[0];
+
+			Log::Info("Created Residency Manager (watermarks %.0f%% / %.0f%% of budget, %s)", m_HighWatermark * 100.0f, m_LowWatermark * 100.0f,
+				device->GetSupportedFeatures().memoryBudget ? "driver budget" : "estimated budget");
+		}
+
+		void ResidencyManager::Dispose()
+		{
+			// The device is idle by now
+			for (auto& retired : m_Retired)
+			{
+				vkDestroyImageView(m_Device->m_Device, retired.view, nullptr);
+				vmaDestroyImage(m_Allocator, retired.image, retired.allocation);
+			}
+
+			m_Retired.clear();
+
+			for (auto& [object, entry] : m_Entries)
+			{
+				if (entry.buffer)
+					entry.buffer->m_Residency = nullptr;
+				else
+					entry.texture->m_Residency = nullptr;
+			}
+
+			m_Entries.clear();
+		}
+
+		void ResidencyManager::Register(Buffer* buffer)
+		{
+			buffer->m_Residency = Register(buffer, buffer, nullptr);
+		}
+
+		void ResidencyManager::Register(Texture* texture)
+		{
+			if (texture->m_InternallyManaged)
+				return;
+
+			texture->m_Residency = Register(texture, nullptr, texture);
+		}
+
+		void ResidencyManager::Unregister(Buffer* buffer)
+		{
+			Unregister((const void*)buffer);
+			buffer->m_Residency = nullptr;
+		}
+
+		void ResidencyManager::Unregister(Texture* texture)
+		{
+			Unregister((const void*)texture);
+			texture->m_Residency = nullptr;
+		}
+
+		ResidencyEntry* ResidencyManager::Register(const void* object, Buffer* buffer, Texture* texture)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			ResidencyEntry& entry = m_Entries[object];
+			entry.buffer = buffer;
+			entry.texture = texture;
+			entry.manager = this;
+			entry.frame = &m_Frame;
+			entry.lastUsedFrame = m_Frame.load();
+			entry.evictionRequested = false;
+
+			return &entry;
+		}
+
+		void ResidencyManager::Unregister(const void* object)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			auto it = m_Entries.find(object);
+			if (it == m_Entries.end())
+				return;
+
+			// A texture that just lost a mip is still being copied into
+			if (it->second.texture)
+				m_Device->WaitForSubmit(Queue::Graphics, m_LastSubmitValue);
+
+			m_Entries.erase(it);
+		}
+
+		ResidencyStats ResidencyManager::GetStats()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Stats;
+		}
+
+		void ResidencyManager::BeginFrame()
+		{
+			uint64_t frame = ++m_Frame;
+
+			// VMA only refreshes its budget from the driver when the frame index changes
+			vmaSetCurrentFrameIndex(m_Allocator, (uint32_t)frame);
+
+			// Copied out so the callback doesn't depend on the entries, it may unregister them
+			std::vector<std::pair<Buffer*, Texture*>> released;
+
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+
+				// Old images go once the copy out of them and compute work submitted before it have finished, they retire in order
+				size_t retiredCount = 0;
+				while (retiredCount < m_Retired.size() && m_Device->HasCompleted(Queue::Graphics, m_Retired[retiredCount].submitValue) &&
+					m_Device->HasCompleted(Queue::Compute, m_Retired[retiredCount].computeValue))
+				{
+					vkDestroyImageView(m_Device->m_Device, m_Retired[retiredCount].view, nullptr);
+					vmaDestroyImage(m_Allocator, m_Retired[retiredCount].image, m_Retired[retiredCount].allocation);
+					retiredCount++;
+				}
+
+				m_Retired.erase(m_Retired.begin(), m_Retired.begin() + retiredCount);
+
+				vmaGetHeapBudgets(m_Allocator, m_Budgets.data());
+
+				// Already released but still allocated, counting them would release more every frame until they go
+				std::vector<VkDeviceSize> pending(m_Budgets.size(), 0);
+
+				for (const RetiredImage& retired : m_Retired)
+					pending[retired.heapIndex] += retired.size;
+
+				for (auto& [object, entry] : m_Entries)
+				{
+					if (!entry.buffer || !entry.evictionRequested)
+						continue;
+
+					VmaAllocationInfo allocationInfo{};
+					vmaGetAllocationInfo(m_Allocator, entry.buffer->m_Allocation, &allocationInfo);
+					pending[GetHeapIndex(entry.buffer->m_Allocation)] += allocationInfo.size;
+				}
+
+				// How much each heap needs to give back to get under the low watermark
+				std::vector<VkDeviceSize> excess(m_Budgets.size(), 0);
+				bool overBudget = false;
+
+				for (size_t i = 0; i < m_Budgets.size(); i++)
+				{
+					// Freeing into a pool block doesn't shrink the block, so free space inside blocks isn't counted
+					const VmaStatistics& statistics = m_Budgets[i].statistics;
+					VkDeviceSize unused = statistics.blockBytes - statistics.allocationBytes + pending[i];
+					VkDeviceSize usage = m_Budgets[i].usage > unused ? m_Budgets[i].usage - unused : 0;
+
+					m_Stats.heaps[i].usage = usage;
+					m_Stats.heaps[i].budget = m_Budgets[i].budget;
+
+					if (!m_Stats.heaps[i].deviceLocal || usage <= (VkDeviceSize)(m_Budgets[i].budget * m_HighWatermark))
+						continue;
+
+					excess[i] = usage - (VkDeviceSize)(m_Budgets[i].budget * m_LowWatermark);
+					overBudget = true;
+				}
+
+				m_OverBudget = overBudget;
+
+				if (!overBudget)
+				{
+					m_WarnedNothingToRelease = false;
+					return;
+				}
+
+				// Least recently used first
+				std::vector<ResidencyEntry*> candidates;
+
+				for (auto& [object, entry] : m_Entries)
+				{
+					if (entry.lastUsedFrame.load(std::memory_order_relaxed) + ProtectedFrames >= frame)
+						continue;
+
+					if (entry.buffer ? entry.evictionRequested : !CanDropTopMip(entry.texture))
+						continue;
+
+					candidates.push_back(&entry);
+				}
+
+				std::sort(candidates.begin(), candidates.end(), [](const ResidencyEntry* lh, const ResidencyEntry* rh)
+					{
+						return lh->lastUsedFrame.load(std::memory_order_relaxed) < rh->lastUsedFrame.load(std::memory_order_relaxed);
+					});
+
+				for (ResidencyEntry* entry : candidates)
+				{
+					if (released.size() == MaxReleasesPerFrame)
+						break;
+
+					VmaAllocation allocation = entry->buffer ? entry->buffer->m_Allocation : entry->texture->m_Allocation;
+					uint32_t heap = GetHeapIndex(allocation);
+
+					if (excess[heap] == 0)
+						continue;
+
+					VkDeviceSize releasedBytes = 0;
+
+					if (entry->buffer)
+					{
+						VmaAllocationInfo allocationInfo{};
+						vmaGetAllocationInfo(m_Allocator, allocation, &allocationInfo);
+
+						entry->evictionRequested = true;
+						releasedBytes = allocationInfo.size;
+						m_Stats.buffersEvicted++;
+					}
+					else
+					{
+						if (!DropTopMip(entry->texture, releasedBytes))
+							continue;
+
+						m_Stats.texturesDowngraded++;
+					}
+
+					m_Stats.bytesReleased += releasedBytes;
+					excess[heap] -= std::min(excess[heap], releasedBytes);
+					released.push_back({ entry->buffer, entry->texture });
+				}
+
+				if (m_Recording)
+				{
+					// Later work reads the smaller images in the layout they were left in
+					VkMemoryBarrier barrier{};
+					barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+					barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+					barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+					vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+					m_CommandList.End();
+					m_Recording = false;
+
+					// Graphics work already submitted finishes before the copies, compute work could still read the old images
+					uint64_t computeValue = m_Device->GetTimeline(Queue::Compute).GetSubmittedValue();
+
+					// Copies still running on the transfer queue could be writing the images being copied
+					TimelineWait transferWait{};
+					transferWait.queue = Queue::Transfer;
+					transferWait.value = m_Device->GetTimeline(Queue::Transfer).GetSubmittedValue();
+
+					m_LastSubmitValue = m_Device->QueueSubmit(Queue::Graphics, { &m_CommandList }, std::vector<Semaphore*>{}, nullptr, { transferWait });
+
+					for (size_t i = m_Retired.size(); i > 0 && m_Retired[i - 1].submitValue == 0; i--)
+					{
+						m_Retired[i - 1].submitValue = m_LastSubmitValue;
+						m_Retired[i - 1].computeValue = computeValue;
+					}
+				}
+
+				if (released.empty() && !m_WarnedNothingToRelease)
+				{
+					Log::Warn("Device memory is over budget and no registered resource can be released");
+					m_WarnedNothingToRelease = true;
+				}
+			}
+
+			// Outside the lock so the callback can dispose what it is handed
+			if (m_EvictionCallback)
+			{
+				for (auto& [buffer, texture] : released)
+					m_EvictionCallback(buffer, texture);
+			}
+		}
+
+		uint32_t ResidencyManager::GetHeapIndex(VmaAllocation allocation)
+		{
+			const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+			vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+			VmaAllocationInfo allocationInfo{};
+			vmaGetAllocationInfo(m_Allocator, allocation, &allocationInfo);
+
+			return memoryProperties->memoryTypes[allocationInfo.memoryType].heapIndex;
+		}
+
+		bool ResidencyManager::CanDropTopMip(const Texture* texture) const
+		{
+			if (texture->m_MipLevels < 2)
+				return false;
+
+			if (texture->m_Width / 2 < m_MinMipSize || texture->m_Height / 2 < m_MinMipSize)
+				return false;
+
+			// Released by the transfer queue but not yet acquired by graphics, the copy would read an image graphics doesn't own
+			if (texture->m_OwnershipPending)
+				return false;
+
+			// Anything else is mid upload or being written to
+			return texture->m_Layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+
+		bool ResidencyManager::DropTopMip(Texture* texture, VkDeviceSize& releasedBytes)
+		{
+			// A defragmentation pass could be moving it, it is registered again once it has its new image
+			Defragmenter* defragmenter = texture->m_Defragmenter;
+			if (defragmenter)
+				defragmenter->Unregister(texture);
+
+			VkImageCreateInfo imageInfo = texture->GetImageInfo();
+			imageInfo.extent.width = std::max(texture->m_Width >> 1, 1u);
+			imageInfo.extent.height = std::max(texture->m_Height >> 1, 1u);
+			imageInfo.extent.depth = std::max(texture->m_Depth >> 1, 1u);
+			imageInfo.mipLevels = texture->m_MipLevels - 1;
+
+			VmaAllocationCreateInfo allocInfo{};
+			allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+			allocInfo.pool = texture->m_Placement.pool;
+
+			if (texture->m_Placement.dedicated)
+				allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+			VkImage newImage = VK_NULL_HANDLE;
+			VmaAllocation newAllocation = VK_NULL_HANDLE;
+			VmaAllocationInfo newAllocationInfo{};
+
+			if (vmaCreateImage(m_Allocator, &imageInfo, &allocInfo, &newImage, &newAllocation, &newAllocationInfo) != VK_SUCCESS)
+			{
+				if (defragmenter)
+					defragmenter->Register(texture);
+
+				return false;
+			}
+
+			if (!m_Recording)
+			{
+				m_CommandList.Begin();
+				m_Recording = true;
+			}
+
+			VkImageSubresourceRange range{};
+			range.aspectMask = GetAspectMask(texture);
+			range.levelCount = texture->m_MipLevels;
+			range.layerCount = texture->m_ArrayLayers;
+
+			VkImageMemoryBarrier barriers[2]{};
+			barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[0].oldLayout = texture->m_Layout;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[0].image = texture->m_Image;
+			barriers[0].subresourceRange = range;
+
+			barriers[1] = barriers[0];
+			barriers[1].srcAccessMask = 0;
+			barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].image = newImage;
+			barriers[1].subresourceRange.levelCount = imageInfo.mipLevels;
+
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+			// Mip n of the old image becomes mip n - 1 of the new one
+			std::vector<VkImageCopy> regions(imageInfo.mipLevels);
+
+			for (uint32_t mip = 0; mip < imageInfo.mipLevels; mip++)
+			{
+				VkImageCopy& region = regions[mip];
+				region.srcSubresource.aspectMask = range.aspectMask;
+				region.srcSubresource.mipLevel = mip + 1;
+				region.srcSubresource.layerCount = texture->m_ArrayLayers;
+				region.dstSubresource = region.srcSubresource;
+				region.dstSubresource.mipLevel = mip;
+				region.extent.width = std::max(texture->m_Width >> (mip + 1), 1u);
+				region.extent.height = std::max(texture->m_Height >> (mip + 1), 1u);
+				region.extent.depth = std::max(texture->m_Depth >> (mip + 1), 1u);
+			}
+
+			vkCmdCopyImage(m_CommandList.m_Buffer, texture->m_Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+
+			VkImageMemoryBarrier toLayout = barriers[1];
+			toLayout.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			toLayout.dstAccessMask = 0;
+			toLayout.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			toLayout.newLayout = texture->m_Layout;
+
+			vkCmdPipelineBarrier(m_CommandList.m_Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toLayout);
+
+			VmaAllocationInfo oldAllocationInfo{};
+			vmaGetAllocationInfo(m_Allocator, texture->m_Allocation, &oldAllocationInfo);
+
+			// Sets still holding the old view are refreshed when they are next bound, so nothing recorded after this reads it.
+			// The submit values are filled in once the frame's copies are submitted
+			RetiredImage retired{};
+			retired.image = texture->m_Image;
+			retired.view = texture->m_ImageView;
+			retired.allocation = texture->m_Allocation;
+			retired.size = oldAllocationInfo.size;
+			retired.heapIndex = GetHeapIndex(texture->m_Allocation);
+			m_Retired.push_back(retired);
+
+			texture->m_Image = newImage;
+			texture->m_Allocation = newAllocation;
+			texture->m_HandleId = NextHandleId();
+			texture->m_Width = imageInfo.extent.width;
+			texture->m_Height = imageInfo.extent.height;
+			texture->m_Depth = imageInfo.extent.depth;
+			texture->m_MipLevels = imageInfo.mipLevels;
+
+			if (texture->CreateView(newImage, &texture->m_ImageView) != VK_SUCCESS)
+			{
+				Log::Fatal("Failed to create Image View");
+			}
+
+			// Pending work could still read the old slot, so the new view goes in a slot of its own and the old one retires on the timeline
+			if (texture->m_Heap && texture->m_HeapIndex != BindlessHeap::InvalidIndex)
+			{
+				uint32_t heapIndex = texture->m_Heap->AddTexture(texture->m_ImageView);
+				if (heapIndex == BindlessHeap::InvalidIndex)
+					Log::Warn("Bindless heap is full, the downgraded texture has no slot");
+
+				texture->m_Heap->Release(BindlessHeap::TextureBinding, texture->m_HeapIndex);
+				texture->m_HeapIndex = heapIndex;
+			}
+
+			if (defragmenter)
+				defragmenter->Register(texture);
+
+			releasedBytes = oldAllocationInfo.size > newAllocationInfo.size ? oldAllocationInfo.size - newAllocationInfo.size : 0;
+			return true;
+		}
+	}
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include "VulkanInclude.h"
+#include "Buffer.h"
+#include "Texture.h"
+#include "CommandList.h"
+#include "Swapchain.h"
+#include "../Core/Log.h"
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		class Device;
+		class ResidencyManager;
+
+		// Tracking for a registered resource, the resource points back at it to stamp when it is used
+		struct ResidencyEntry
+		{
+			Buffer* buffer = nullptr;
+			Texture* texture = nullptr;
+			ResidencyManager* manager = nullptr;
+
+			const std::atomic<uint64_t>* frame = nullptr;
+			std::atomic<uint64_t> lastUsedFrame = 0;
+
+			// Buffers are only handed to the eviction callback once, the owner disposes them when it can
+			bool evictionRequested = false;
+
+			void MarkUsed() { lastUsedFrame.store(frame->load(std::memory_order_relaxed), std::memory_order_relaxed); }
+		};
+
+		struct MemoryHeapBudget
+		{
+			uint64_t usage = 0;
+			uint64_t budget = 0;
+			bool deviceLocal = false;
+		};
+
+		struct ResidencyStats
+		{
+			std::vector<MemoryHeapBudget> heaps;
+			uint64_t texturesDowngraded = 0;
+			uint64_t buffersEvicted = 0;
+			uint64_t bytesReleased = 0;
+
+			void Print()
+			{
+				Log::Info("Residency Stats:");
+
+				for (size_t i = 0; i < heaps.size(); i++)
+					Log::Info(" - Heap %zu%s: %llu / %llu MB", i, heaps[i].deviceLocal ? " (Device Local)" : "", heaps[i].usage / (1024 * 1024), heaps[i].budget / (1024 * 1024));
+
+				Log::Info(" - Top Mips Dropped: %llu", texturesDowngraded);
+				Log::Info(" - Buffers Evicted: %llu", buffersEvicted);
+				Log::Info(" - Released: %llu KB", bytesReleased / 1024);
+			}
+		};
+
+		/*
+			Keeps device local memory inside the budget the driver reports (VK_EXT_memory_budget through VMA, or an estimate without it).
+			Registered resources are stamped with the frame they were last bound in, and once a heap's usage goes over the high watermark
+			the least recently used ones are released until the usage would be back under the low watermark.
+			Textures lose their top mip, which frees about three quarters of them, buffers can't be shrunk so their owner is asked to dispose them.
+
+			Only streamable resources the app can bring back should be registered. Binding a descriptor set stamps everything it references,
+			anything used through the bindless heap has to call MarkUsed itself. Resources used in the last few frames are never touched.
+			Like the defragmenter, handles are swapped in place and sets holding the old ones are refreshed the next time they are bound,
+			a smaller texture also gets a new bindless slot. Usage is measured by allocation so freed space left in pool blocks,
+			images waiting to retire and buffers already handed to the eviction callback count as released.
+		*/
+		class ResidencyManager
+		{
+		public:
+
+			// Exactly one of the two is set. A texture has already lost its top mip and has a new heap index, a buffer should be disposed by its owner
+			using EvictionCallback = std::function<void(Buffer* buffer, Texture* texture)>;
+
+			void Register(Buffer* buffer);
+
+			void Register(Texture* texture);
+
+			// Called by Dispose
+			void Unregister(Buffer* buffer);
+
+			void Unregister(Texture* texture);
+
+			void SetEvictionCallback(EvictionCallback callback) { m_EvictionCallback = callback; }
+
+			/// <summary>
+			/// Moves the stamp on, refreshes the heap budgets and releases resources from any heap over the high watermark.
+			/// Command lists recorded before this must already be submitted since they hold the old handles
+			/// </summary>
+			void BeginFrame();
+
+			// True while a device local heap is over the high watermark, streaming should hold off on new loads
+			bool IsOverBudget() const { return m_OverBudget; }
+
+			uint64_t GetFrame() const { return m_Frame.load(); }
+
+			ResidencyStats GetStats();
+
+		private:
+
+			friend class Device;
+
+			void Init(Device* device, float highWatermark, float lowWatermark, uint32_t minMipSize);
+
+			void Dispose();
+
+			// Old image of a texture that lost a mip, destroyed once the copy and any work still reading it have finished
+			struct RetiredImage
+			{
+				VkImage image;
+				VkImageView view;
+				VmaAllocation allocation;
+				VkDeviceSize size;
+				uint32_t heapIndex;
+				uint64_t submitValue;
+				uint64_t computeValue;
+			};
+
+			Device* m_Device = nullptr;
+			VmaAllocator m_Allocator = VK_NULL_HANDLE;
+
+			float m_HighWatermark = 0.9f;
+			float m_LowWatermark = 0.8f;
+
+			// Textures aren't shrunk below this in either dimension
+			uint32_t m_MinMipSize = 64;
+
+			// A resource used this recently may still be in flight, or be read through a bindless slot by work in flight
+			static const uint32_t ProtectedFrames = MaxImagesInFlight + 1;
+
+			// Bounds the work done in a single frame when a lot needs releasing at once
+			static const uint32_t MaxReleasesPerFrame = 16;
+
+			std::atomic<uint64_t> m_Frame = 0;
+
+			// Node based so resources can point at their entries
+			std::unordered_map<const void*, ResidencyEntry> m_Entries;
+
+			EvictionCallback m_EvictionCallback;
+
+			CommandList m_CommandList;
+			bool m_Recording = false;
+			uint64_t m_LastSubmitValue = 0;
+			std::vector<RetiredImage> m_Retired;
+
+			std::vector<VmaBudget> m_Budgets;
+			std::atomic<bool> m_OverBudget = false;
+			bool m_WarnedNothingToRelease = false;
+
+			ResidencyStats m_Stats;
+
+			std::mutex m_Mutex;
+
+			ResidencyEntry* Register(const void* object, Buffer* buffer, Texture* texture);
+
+			void Unregister(const void* object);
+
+			uint32_t GetHeapIndex(VmaAllocation allocation);
+
+			bool CanDropTopMip(const Texture* texture) const;
+
+			// Records the copy into a smaller image and swaps it in
+			bool DropTopMip(Texture* texture, VkDeviceSize& releasedBytes);
+		};
+	}
+}
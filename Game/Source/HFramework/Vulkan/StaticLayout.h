@@ -0,0 +1,172 @@
+#pragma once
+#include <array>
+#include "DescriptorSetLayout.h"
+#include "DescriptorSet.h"
+#include "GraphicsPipeline.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		/*
+			Layouts described by types so their bindings and hashes are worked out by the compiler.
+
+				using MaterialLayout = StaticSetLayout<UniformBufferBinding<0, ShaderStage::Vertex>, TextureSamplerBinding<1, ShaderStage::Fragment>>;
+				using MeshVertex = StaticVertexInput<Vertex, Format::RGB32F, Format::RGBA32F, Format::RG32F>;
+
+				desc.setLayouts = { MaterialLayout::Get() };
+				desc.vertexLayout = { MeshVertex::Get() };
+				MaterialLayout::BindTextureSampler<1>(set, texture, sampler);
+
+			Duplicate bindings, binding to a slot of the wrong type or vertex formats that don't add up to the vertex struct fail to compile.
+		*/
+
+		template<VkDescriptorType Type, uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		struct StaticBinding
+		{
+			static constexpr VkDescriptorSetLayoutBinding value = { Index, Type, Count, ToShaderStageFlags(Stage), nullptr };
+		};
+
+		template<uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		using UniformBufferBinding = StaticBinding<VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, Index, Stage, Count>;
+
+		template<uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		using DynamicUniformBufferBinding = StaticBinding<VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, Index, Stage, Count>;
+
+		template<uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		using TextureSamplerBinding = StaticBinding<VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, Index, Stage, Count>;
+
+		template<uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		using StorageBufferBinding = StaticBinding<VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, Index, Stage, Count>;
+
+		template<uint32_t Index, ShaderStage Stage, uint32_t Count = 1>
+		using StorageImageBinding = StaticBinding<VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, Index, Stage, Count>;
+
+		// Returns count if the binding isn't there
+		constexpr size_t FindLayoutBinding(const VkDescriptorSetLayoutBinding* bindings, size_t count, uint32_t binding)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (bindings[i].binding == binding)
+					return i;
+			}
+
+			return count;
+		}
+
+		constexpr bool HasUniqueBindings(const VkDescriptorSetLayoutBinding* bindings, size_t count)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (FindLayoutBinding(bindings, i, bindings[i].binding) != i)
+					return false;
+			}
+
+			return true;
+		}
+
+		template<typename... Bindings>
+		class StaticSetLayout
+		{
+		public:
+
+			static constexpr std::array<VkDescriptorSetLayoutBinding, sizeof...(Bindings)> bindings = { Bindings::value... };
+
+			static constexpr size_t hash = HashLayoutBindings(bindings.data(), bindings.size(), false);
+
+			static_assert(HasUniqueBindings(bindings.data(), bindings.size()), "StaticSetLayout has more than one binding with the same index");
+
+			// Built once and shared, the hash is the one computed above
+			static const DescriptorSetLayout& Get()
+			{
+				static const DescriptorSetLayout layout(bindings.data(), bindings.size(), hash);
+				return layout;
+			}
+
+			template<uint32_t Index>
+			static constexpr VkDescriptorType TypeOf()
+			{
+				constexpr size_t i = FindLayoutBinding(bindings.data(), bindings.size(), Index);
+				static_assert(i < bindings.size(), "StaticSetLayout has no binding at this index");
+
+				return bindings[i].descriptorType;
+			}
+
+			/* -- Checked Binding -- */
+
+			template<uint32_t Index>
+			static void BindUniformBuffer(DescriptorSet& set, Buffer& buffer, uint32_t arrayElement = 0, size_t offset = 0, size_t range = 0)
+			{
+				static_assert(TypeOf<Index>() == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, "Binding isn't a uniform buffer");
+				set.BindUniformBuffer(buffer, Index, arrayElement, offset, range);
+			}
+
+			template<uint32_t Index>
+			static void BindDynamicUniformBuffer(DescriptorSet& set, Buffer& buffer, size_t range, uint32_t arrayElement = 0, size_t offset = 0)
+			{
+				static_assert(TypeOf<Index>() == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, "Binding isn't a dynamic uniform buffer");
+				set.BindDynamicUniformBuffer(buffer, Index, range, arrayElement, offset);
+			}
+
+			template<uint32_t Index>
+			static void BindTextureSampler(DescriptorSet& set, Texture& texture, SamplerState& samplerState, uint32_t arrayElement = 0)
+			{
+				static_assert(TypeOf<Index>() == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, "Binding isn't a texture sampler");
+				set.BindTextureSampler(texture, samplerState, Index, arrayElement);
+			}
+
+			template<uint32_t Index>
+			static void BindStorageBuffer(DescriptorSet& set, Buffer& buffer, uint32_t arrayElement = 0, size_t offset = 0, size_t range = 0)
+			{
+				static_assert(TypeOf<Index>() == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, "Binding isn't a storage buffer");
+				set.BindStorageBuffer(buffer, Index, arrayElement, offset, range);
+			}
+
+			template<uint32_t Index>
+			static void BindStorageImage(DescriptorSet& set, Texture& texture, uint32_t arrayElement = 0)
+			{
+				static_assert(TypeOf<Index>() == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, "Binding isn't a storage image");
+				set.BindStorageImage(texture, Index, arrayElement);
+			}
+		};
+
+		// Attributes get consecutive locations from 0 and are packed one after another
+		template<Format... Formats>
+		constexpr std::array<VertexAttribute, sizeof...(Formats)> MakeVertexAttributes()
+		{
+			std::array<VertexAttribute, sizeof...(Formats)> attributes{};
+			const Format formats[] = { Formats... };
+
+			uint32_t offset = 0;
+			for (uint32_t i = 0; i < sizeof...(Formats); i++)
+			{
+				attributes[i] = VertexAttribute(i, formats[i], offset);
+				offset += GetFormatSize(formats[i]);
+			}
+
+			return attributes;
+		}
+
+		template<typename VertexType, Format... Formats>
+		class StaticVertexInput
+		{
+		public:
+
+			static_assert(sizeof...(Formats) > 0, "StaticVertexInput needs at least one attribute");
+
+			static constexpr std::array<VertexAttribute, sizeof...(Formats)> attributes = MakeVertexAttributes<Formats...>();
+
+			static constexpr uint32_t stride = (GetFormatSize(Formats) + ...);
+
+			static_assert(stride == sizeof(VertexType), "Vertex formats don't add up to the size of the vertex struct");
+
+			static VertexInput Get(uint32_t binding = 0, InputRate inputRate = InputRate::Vertex)
+			{
+				VertexInput input(binding, stride, inputRate);
+				input.attributes.assign(attributes.begin(), attributes.end());
+
+				return input;
+			}
+		};
+	}
+}
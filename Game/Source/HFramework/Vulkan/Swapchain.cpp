@@ -252,6 +252,7 @@ namespace hf
 			for (size_t i = 0; i < m_Images.size(); i++)
 			{
 				m_Images[i].m_Image = images[i];
+				m_Images[i].m_HandleId = NextHandleId();
 				m_Images[i].m_Format = surfaceFormat.format;
 				m_Images[i].m_InternallyManaged = true;
 				m_Images[i].m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
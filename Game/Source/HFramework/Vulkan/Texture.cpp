@@ -3,6 +3,10 @@
 #include "FormatConvert.h"
 #include "../Core/Log.h"
 #include "TextureUtil.h"
+#include "CommandList.h"
+#include "Defragmenter.h"
+#include "ResidencyManager.h"
+#include "Device.h"
 
 namespace hf
 {
@@ -10,11 +14,20 @@ namespace hf
 	{
         void Texture::Dispose()
         {
+            if (m_Defragmenter)
+                m_Defragmenter->Unregister(this);
+
+            if (m_Residency)
+                m_Residency->manager->Unregister(this);
+
             if (!m_InternallyManaged)
             {
                 vkDestroyImageView(m_AssociatedDevice, m_ImageView, nullptr);
                 vmaDestroyImage(m_AssociatedAllocator, m_Image, m_Allocation);
             }
+
+            if (m_Heap)
+                m_Heap->Release(BindlessHeap::TextureBinding, m_HeapIndex);
         }
 
         void Texture::Create(const TextureDesc& desc)
@@ -37,52 +50,193 @@ namespace hf
             else
                 usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-            VkImageCreateInfo imageInfo{};
-            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-            imageInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageInfo.extent.width = desc.width;
-            imageInfo.extent.height = desc.height;
-            imageInfo.extent.depth = desc.depth;
-            imageInfo.mipLevels = desc.mipLevels;
-            imageInfo.arrayLayers = desc.arrayLevels;
-            imageInfo.format = m_Format;
-            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageInfo.usage = usageFlags;
-            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            if (m_CopyMemoryToImage)
+                usageFlags |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
 
+            if (desc.isStorage)
+                usageFlags |= VK_IMAGE_USAGE_STORAGE_BIT;
+
+            // Pooled images can be moved by the defragmenter, which copies them
+            if (m_Placement.pool)
+                usageFlags |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+            m_Usage = usageFlags;
+            m_Width = desc.width;
+            m_Height = desc.height;
+            m_Depth = desc.depth;
+            m_MipLevels = desc.mipLevels;
+            m_ArrayLayers = desc.arrayLevels;
+
+            VkImageCreateInfo imageInfo = GetImageInfo();
 
             // For textures we create them on GPU only 
             VmaAllocationCreateInfo allocCreateInfo = {};
             allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
-            allocCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+            allocCreateInfo.pool = m_Placement.pool;
+
+            if (m_Placement.dedicated)
+                allocCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+            VkResult result = vmaCreateImage(m_AssociatedAllocator, &imageInfo, &allocCreateInfo, &m_Image, &m_Allocation, nullptr);
+
+            // The pool's memory type may not suit this image's format or usage
+            if (result != VK_SUCCESS && allocCreateInfo.pool)
+            {
+                // The image isn't in the pool, the defragmenter and residency manager mustn't treat it as if it were
+                allocCreateInfo.pool = VK_NULL_HANDLE;
+                m_Placement.pool = VK_NULL_HANDLE;
+                result = vmaCreateImage(m_AssociatedAllocator, &imageInfo, &allocCreateInfo, &m_Image, &m_Allocation, nullptr);
+            }
 
-            if (vmaCreateImage(m_AssociatedAllocator, &imageInfo, &allocCreateInfo, &m_Image, &m_Allocation, nullptr) != VK_SUCCESS)
+            if (result != VK_SUCCESS)
             {
                 Log::Fatal("Failed to create vulkan Image");
             }
 
+            m_HandleId = NextHandleId();
+
+            if (CreateView(m_Image, &m_ImageView) != VK_SUCCESS) 
+            {
+                Log::Fatal("Failed to create Image View");
+            }
+
+            m_Layout = imageInfo.initialLayout;
+		}
+
+        VkImageCreateInfo Texture::GetImageInfo() const
+        {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width = m_Width;
+            imageInfo.extent.height = m_Height;
+            imageInfo.extent.depth = m_Depth;
+            imageInfo.mipLevels = m_MipLevels;
+            imageInfo.arrayLayers = m_ArrayLayers;
+            imageInfo.format = m_Format;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = m_Usage;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            return imageInfo;
+        }
+
+        VkResult Texture::CreateView(VkImage image, VkImageView* view)
+        {
             VkImageViewCreateInfo viewInfo{};
             viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            viewInfo.image = m_Image;
+            viewInfo.image = image;
             viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
             viewInfo.format = m_Format;
             viewInfo.subresourceRange.aspectMask = GetAspectMask(this);
             viewInfo.subresourceRange.baseMipLevel = 0;
-            viewInfo.subresourceRange.levelCount = desc.mipLevels;
+            viewInfo.subresourceRange.levelCount = m_MipLevels;
             viewInfo.subresourceRange.baseArrayLayer = 0;
-            viewInfo.subresourceRange.layerCount = desc.arrayLevels;
+            viewInfo.subresourceRange.layerCount = m_ArrayLayers;
 
-            if (vkCreateImageView(m_AssociatedDevice, &viewInfo, nullptr, &m_ImageView) != VK_SUCCESS) 
+            return vkCreateImageView(m_AssociatedDevice, &viewInfo, nullptr, view);
+        }
+
+        void Texture::MarkUsed()
+        {
+            if (m_Device)
+                std::atomic_ref<uint64_t>(m_LastUsedFrame).store(m_Device->GetFrame(), std::memory_order_relaxed);
+
+            if (m_Residency)
+                m_Residency->MarkUsed();
+        }
+
+        bool Texture::IsInFlight() const
+        {
+            if (!m_Device)
+                return false;
+
+            uint64_t frame = std::atomic_ref<uint64_t>(const_cast<uint64_t&>(m_LastUsedFrame)).load(std::memory_order_relaxed);
+            return !m_Device->HasCompletedFrame(frame);
+        }
+
+        bool Texture::CopyFromHost(const void* data, const std::vector<BufferImageCopy>& regions)
+        {
+            if (!m_CopyMemoryToImage)
             {
-                Log::Fatal("Failed to create Image View");
+                Log::Error("Texture doesn't support host copies, upload it through the upload queue instead");
+                return false;
             }
 
-            m_Layout = imageInfo.initialLayout;
-            m_Width = desc.width;
-            m_Height = desc.height;
-            m_Depth = desc.depth;
-		}
+            // The host writes the image as soon as this is called, nothing orders it after the GPU's reads
+            if (IsInFlight())
+            {
+                Log::Warn("Texture is still in use on the GPU, upload it through the upload queue instead");
+                return false;
+            }
+
+            // Another queue owns the image until graphics acquires it
+            if (m_OwnershipPending)
+            {
+                Log::Warn("Texture is being handed between queues, upload it through the upload queue instead");
+                return false;
+            }
+
+            if (m_Layout != m_HostCopyLayout)
+                TransitionOnHost(m_HostCopyLayout);
+
+            std::vector<VkMemoryToImageCopyEXT> copies(regions.size());
+
+            for (size_t i = 0; i < regions.size(); i++)
+            {
+                const BufferImageCopy& region = regions[i];
+
+                copies[i].sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+                copies[i].pHostPointer = (const uint8_t*)data + region.bufferOffset;
+                copies[i].memoryRowLength = (uint32_t)region.bufferRowLength;
+                copies[i].memoryImageHeight = (uint32_t)region.bufferImageHeight;
+
+                copies[i].imageSubresource.aspectMask = GetAspectMask(this);
+                copies[i].imageSubresource.mipLevel = region.mipLevel;
+                copies[i].imageSubresource.baseArrayLayer = region.baseArrayLayer;
+                copies[i].imageSubresource.layerCount = region.layerCount;
+
+                copies[i].imageOffset = { region.offset.x, region.offset.y, region.offset.z };
+                copies[i].imageExtent = { region.extent.width, region.extent.height, region.extent.depth };
+            }
+
+            VkCopyMemoryToImageInfoEXT copyInfo{};
+            copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+            copyInfo.dstImage = m_Image;
+            copyInfo.dstImageLayout = m_HostCopyLayout;
+            copyInfo.regionCount = (uint32_t)copies.size();
+            copyInfo.pRegions = copies.data();
+
+            if (m_CopyMemoryToImage(m_AssociatedDevice, &copyInfo) != VK_SUCCESS)
+            {
+                Log::Error("Failed to copy to texture from host memory");
+                return false;
+            }
+
+            if (m_Layout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+                TransitionOnHost(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+            return true;
+        }
+
+        void Texture::TransitionOnHost(VkImageLayout layout)
+        {
+            VkHostImageLayoutTransitionInfoEXT transition{};
+            transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+            transition.image = m_Image;
+            transition.oldLayout = m_Layout;
+            transition.newLayout = layout;
+            transition.subresourceRange.aspectMask = GetAspectMask(this);
+            transition.subresourceRange.baseMipLevel = 0;
+            transition.subresourceRange.levelCount = m_MipLevels;
+            transition.subresourceRange.baseArrayLayer = 0;
+            transition.subresourceRange.layerCount = m_ArrayLayers;
+
+            m_TransitionImageLayout(m_AssociatedDevice, 1, &transition);
+
+            m_Layout = layout;
+        }
 	}
-}
\ No newline at end of file
+}
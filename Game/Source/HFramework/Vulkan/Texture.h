@@ -1,6 +1,11 @@
 #pragma once
 #include "VulkanInclude.h"
 #include "../Graphics/Format.h"
+#include "BindlessHeap.h"
+#include "MemoryPools.h"
+#include "HandleId.h"
+#include <atomic>
+#include <vector>
 
 namespace hf
 {
@@ -23,14 +28,54 @@ namespace hf
 			uint32_t arrayLevels = 1;
 			TextureType type;
 			bool isRenderTarget = false;
+			bool isStorage = false;		/* Can be written by compute shaders as a storage image */
+			MemoryClass memoryClass = MemoryClass::Default;		/* Default picks RenderTarget or SampledTexture */
+			bool forceHostCopy = false;		/* Allow host copies even where the device says they would slow down GPU access */
 		};
 
+		struct BufferImageCopy;
+		class Device;
+		class Defragmenter;
+		class ResidencyManager;
+		struct ResidencyEntry;
+
 		class Texture
 		{
 		public:
 
 			void Dispose();
 
+			uint32_t GetWidth() const { return m_Width; }
+			uint32_t GetHeight() const { return m_Height; }
+			uint32_t GetDepth() const { return m_Depth; }
+			uint32_t GetMipLevels() const { return m_MipLevels; }
+			uint32_t GetArrayLayers() const { return m_ArrayLayers; }
+
+			// The layout the last recorded barrier leaves the texture in, Undefined until its contents have been written
+			VkImageLayout GetLayout() const { return m_Layout; }
+
+			// Changes whenever the image and view do, including when the texture is moved or loses a mip
+			uint64_t GetHandleId() const { return m_HandleId; }
+
+			// Index into the bindless heap's texture array, InvalidIndex if the heap isn't enabled
+			uint32_t GetHeapIndex() const { return m_HeapIndex; }
+
+			// Stamps the frame for the residency manager. Binding and descriptor writes do it already, bindless users call it themselves
+			void MarkUsed();
+
+			// True while a frame the texture was last used in may still be running on the GPU
+			bool IsInFlight() const;
+
+			// True when VK_EXT_host_image_copy is enabled, supports the texture's format and keeps GPU access optimal
+			bool SupportsHostCopy() const { return m_CopyMemoryToImage != nullptr; }
+
+			/// <summary>
+			/// Writes regions straight from CPU memory with vkCopyMemoryToImageEXT, no queue or staging buffer is involved.
+			/// Each region's bufferOffset is an offset into data. The texture is left in ShaderReadOnlyOptimal.
+			/// Fails while the texture is in flight or being handed between queues, so upload through the queue then. Thread safe as long as each thread writes its own textures
+			/// </summary>
+			bool CopyFromHost(const void* data, const std::vector<BufferImageCopy>& regions);
+
 			bool IsColourFormat()
 			{
 				if (m_Format >= VK_FORMAT_R4G4_UNORM_PACK8 && m_Format <= VK_FORMAT_B10G11R11_UFLOAT_PACK32)
@@ -59,23 +104,60 @@ namespace hf
 			friend class CommandList;
 			friend class DescriptorSet;
 			friend class Device;
+			friend class Defragmenter;
+			friend class ResidencyManager;
+			friend class TransientAttachments;
 
 			VkDevice m_AssociatedDevice;
 			VmaAllocator m_AssociatedAllocator;
 
+			// Set by the device, textures it didn't create are never considered in flight
+			Device* m_Device = nullptr;
+			alignas(std::atomic_ref<uint64_t>::required_alignment) uint64_t m_LastUsedFrame = 0;
+
 			VkImage m_Image;
 			VkImageView m_ImageView;
 			VmaAllocation m_Allocation;
+			uint64_t m_HandleId = 0;
 
 			VkImageLayout m_Layout;
 			VkFormat m_Format;
+			VkImageUsageFlags m_Usage = 0;
 
 			uint32_t m_Width, m_Height, m_Depth = 1;
+			uint32_t m_MipLevels = 1, m_ArrayLayers = 1;
 
 			bool m_SwapchainImage = false;
 
+			// Released by one queue family and not yet acquired by the other
+			bool m_OwnershipPending = false;
+
 			bool m_InternallyManaged = false;
 
+			BindlessHeap* m_Heap = nullptr;
+			uint32_t m_HeapIndex = BindlessHeap::InvalidIndex;
+
+			// Set by the device when the texture can be host copied into
+			PFN_vkCopyMemoryToImageEXT m_CopyMemoryToImage = nullptr;
+			PFN_vkTransitionImageLayoutEXT m_TransitionImageLayout = nullptr;
+			VkImageLayout m_HostCopyLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			// Set by the device from the desc's memory class
+			MemoryPlacement m_Placement;
+
+			// Set while the texture is registered as movable
+			Defragmenter* m_Defragmenter = nullptr;
+
+			// Set while the texture is registered as streamable
+			ResidencyEntry* m_Residency = nullptr;
+
+			void TransitionOnHost(VkImageLayout layout);
+
+			// Describes the image from the texture's members, used again when the image is recreated somewhere else in memory
+			VkImageCreateInfo GetImageInfo() const;
+
+			VkResult CreateView(VkImage image, VkImageView* view);
+
 			void Create(const TextureDesc& desc);
 		};
 	}
@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include "VulkanInclude.h"
+#include "../Core/Log.h"
+
+namespace hf
+{
+	namespace vulkan
+	{
+		/*
+			A timeline semaphore owned by the device, one per queue.
+			Every submit to the queue signals the next value so a single counter
+			tells us how much of the queue's work has finished.
+		*/
+		class Timeline
+		{
+		public:
+
+			void Initialise(VkDevice device)
+			{
+				m_ParentDevice = device;
+
+				VkSemaphoreTypeCreateInfo typeInfo{};
+				typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+				typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+				typeInfo.initialValue = 0;
+
+				VkSemaphoreCreateInfo semaphoreInfo{};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				semaphoreInfo.pNext = &typeInfo;
+
+				if (vkCreateSemaphore(m_ParentDevice, &semaphoreInfo, nullptr, &m_Semaphore) != VK_SUCCESS)
+				{
+					Log::Fatal("Failed to create timeline semaphore");
+				}
+			}
+
+			void Dispose()
+			{
+				vkDestroySemaphore(m_ParentDevice, m_Semaphore, nullptr);
+			}
+
+			// Reserves the value the next submit will signal, only called under the device queue lock together with the submit
+			uint64_t NextValue()
+			{
+				return ++m_SubmittedValue;
+			}
+
+			uint64_t GetSubmittedValue() const
+			{
+				return m_SubmittedValue.load();
+			}
+
+			// Queries the driver and caches the result
+			uint64_t GetCompletedValue()
+			{
+				uint64_t value = 0;
+				vkGetSemaphoreCounterValue(m_ParentDevice, m_Semaphore, &value);
+
+				uint64_t cached = m_CompletedValue.load();
+				while (value > cached && !m_CompletedValue.compare_exchange_weak(cached, value)) {}
+
+				return value;
+			}
+
+			bool IsComplete(uint64_t value)
+			{
+				// Only hit the driver if the cached value isn't far enough along
+				if (value <= m_CompletedValue.load())
+					return true;
+
+				return value <= GetCompletedValue();
+			}
+
+			void Wait(uint64_t value)
+			{
+				if (IsComplete(value))
+					return;
+
+				VkSemaphoreWaitInfo waitInfo{};
+				waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+				waitInfo.semaphoreCount = 1;
+				waitInfo.pSemaphores = &m_Semaphore;
+				waitInfo.pValues = &value;
+
+				vkWaitSemaphores(m_ParentDevice, &waitInfo, UINT64_MAX);
+
+				uint64_t cached = m_CompletedValue.load();
+				while (value > cached && !m_CompletedValue.compare_exchange_weak(cached, value)) {}
+			}
+
+			void WaitIdle()
+			{
+				Wait(m_SubmittedValue.load());
+			}
+
+		private:
+
+			friend class Device;
+
+			VkDevice m_ParentDevice;
+
+			VkSemaphore m_Semaphore;
+
+			std::atomic<uint64_t> m_SubmittedValue = 0;
+			std::atomic<uint64_t> m_CompletedValue = 0;
+		};
+	}
+}
@@ -0,0 +1,350 @@
+#include "TransientAttachments.h"
+#include "Device.h"
+#include "FormatConvert.h"
+#include "TextureUtil.h"
+#include <algorithm>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		void TransientAttachments::Init(Device* device)
+		{
+			m_Device = device;
+			m_Allocator = device->m_Allocator;
+			m_VkDevice = device->m_Device;
+
+			// Tilers and UMA devices expose lazily allocated memory, render targets in it may never be backed by anything but tile memory
+			VmaAllocationCreateInfo lazyInfo{};
+			lazyInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+
+			uint32_t memoryTypeIndex = 0;
+			m_LazyMemory = vmaFindMemoryTypeIndex(m_Allocator, UINT32_MAX, &lazyInfo, &memoryTypeIndex) == VK_SUCCESS;
+
+			Log::Info("Created Transient Attachments (%s)", m_LazyMemory ? "lazily allocated memory" : "no lazily allocated memory");
+		}
+
+		void TransientAttachments::Dispose()
+		{
+			// The device is idle by now
+			for (auto& frame : m_Frames)
+			{
+				Release(frame);
+
+				frame.textures.clear();
+				frame.built.clear();
+				frame.declarations.clear();
+			}
+		}
+
+		bool TransientAttachments::Declaration::operator==(const Declaration& other) const
+		{
+			return desc.format == other.desc.format && desc.width == other.desc.width && desc.height == other.desc.height &&
+				desc.depth == other.desc.depth && desc.mipLevels == other.desc.mipLevels && desc.arrayLevels == other.desc.arrayLevels &&
+				desc.type == other.desc.type && desc.isStorage == other.desc.isStorage &&
+				firstPass == other.firstPass && lastPass == other.lastPass && lazy == other.lazy;
+		}
+
+		void TransientAttachments::BeginFrame()
+		{
+			m_Frame = (m_Frame + 1) % MaxImagesInFlight;
+
+			Frame& frame = m_Frames[m_Frame];
+
+			// Usually long finished by the time we come back round to it
+			m_Device->WaitForSubmit(Queue::Graphics, frame.retireValue);
+
+			frame.declarations.clear();
+		}
+
+		void TransientAttachments::EndFrame(uint64_t graphicsSubmitValue)
+		{
+			m_Frames[m_Frame].retireValue = graphicsSubmitValue;
+		}
+
+		Texture* TransientAttachments::Declare(const TextureDesc& desc, uint32_t firstPass, uint32_t lastPass, bool lazy)
+		{
+			Frame& frame = m_Frames[m_Frame];
+
+			Declaration declaration;
+			declaration.desc = desc;
+			declaration.firstPass = std::min(firstPass, lastPass);
+			declaration.lastPass = std::max(firstPass, lastPass);
+
+			// Lazily allocated memory can only back attachments, a storage image has to be real memory
+			declaration.lazy = lazy && !desc.isStorage;
+
+			frame.declarations.push_back(declaration);
+
+			// The same texture is handed out for the same declaration index, so a steady frame keeps its pointers
+			if (frame.textures.size() < frame.declarations.size())
+				frame.textures.emplace_back();
+
+			return &frame.textures[frame.declarations.size() - 1];
+		}
+
+		void TransientAttachments::Build()
+		{
+			Frame& frame = m_Frames[m_Frame];
+
+			if (frame.declarations == frame.built)
+			{
+				// Whatever was in the memory belonged to another target
+				for (size_t i = 0; i < frame.declarations.size(); i++)
+					frame.textures[i].m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+				return;
+			}
+
+			Release(frame);
+
+			// Shrinking from the back leaves the pointers to the rest alone
+			frame.textures.resize(frame.declarations.size());
+
+			size_t count = frame.declarations.size();
+
+			std::vector<VkImageCreateInfo> imageInfos(count);
+			std::vector<VkMemoryRequirements> requirements(count);
+
+			TransientAttachmentStats& stats = frame.stats;
+			stats = {};
+			stats.targets = (uint32_t)count;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				imageInfos[i] = GetImageInfo(frame.textures[i], frame.declarations[i]);
+
+				VkDeviceImageMemoryRequirements requirementsInfo{};
+				requirementsInfo.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+				requirementsInfo.pCreateInfo = &imageInfos[i];
+
+				VkMemoryRequirements2 requirements2{};
+				requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+
+				vkGetDeviceImageMemoryRequirements(m_VkDevice, &requirementsInfo, &requirements2);
+
+				requirements[i] = requirements2.memoryRequirements;
+				stats.requestedBytes += requirements[i].size;
+			}
+
+			// Where each target lives, targets with memory of their own get an allocation and offset 0
+			std::vector<VmaAllocation> allocations(count, VK_NULL_HANDLE);
+			std::vector<VkDeviceSize> offsets(count, 0);
+			std::vector<bool> shared(count, false);
+
+			VmaAllocationCreateInfo lazyInfo{};
+			lazyInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+			lazyInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+			VmaAllocationCreateInfo dedicatedInfo{};
+			dedicatedInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			dedicatedInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+			std::vector<size_t> order;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				uint32_t memoryTypeIndex = 0;
+
+				if (frame.declarations[i].lazy && m_LazyMemory &&
+					vmaFindMemoryTypeIndex(m_Allocator, requirements[i].memoryTypeBits, &lazyInfo, &memoryTypeIndex) == VK_SUCCESS)
+				{
+					if (vmaAllocateMemory(m_Allocator, &requirements[i], &lazyInfo, &allocations[i], nullptr) == VK_SUCCESS)
+					{
+						frame.dedicatedMemory.push_back(allocations[i]);
+						stats.lazyTargets++;
+						continue;
+					}
+				}
+
+				order.push_back(i);
+			}
+
+			// Biggest first, the small ones then fill the gaps left between them
+			std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return requirements[a].size > requirements[b].size; });
+
+			VkMemoryRequirements heapRequirements{};
+			heapRequirements.memoryTypeBits = UINT32_MAX;
+			heapRequirements.alignment = 1;
+
+			std::vector<size_t> placed;
+
+			for (size_t i : order)
+			{
+				// A target no memory type can share with the others gets its own allocation
+				if ((heapRequirements.memoryTypeBits & requirements[i].memoryTypeBits) == 0)
+				{
+					if (vmaAllocateMemory(m_Allocator, &requirements[i], &dedicatedInfo, &allocations[i], nullptr) != VK_SUCCESS)
+						Log::Fatal("Failed to allocate memory for a transient attachment");
+
+					frame.dedicatedMemory.push_back(allocations[i]);
+					stats.allocatedBytes += requirements[i].size;
+					continue;
+				}
+
+				const Declaration& declaration = frame.declarations[i];
+
+				// Ranges taken by placed targets alive in any of the same passes
+				std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+
+				for (size_t j : placed)
+				{
+					const Declaration& other = frame.declarations[j];
+
+					if (declaration.firstPass <= other.lastPass && other.firstPass <= declaration.lastPass)
+						taken.push_back({ offsets[j], offsets[j] + requirements[j].size });
+				}
+
+				std::sort(taken.begin(), taken.end());
+
+				// Lowest offset that fits between the ranges
+				VkDeviceSize alignment = requirements[i].alignment;
+				VkDeviceSize offset = 0;
+
+				for (auto& [begin, end] : taken)
+				{
+					if (offset + requirements[i].size <= begin)
+						break;
+
+					offset = std::max(offset, (end + alignment - 1) / alignment * alignment);
+				}
+
+				offsets[i] = offset;
+				shared[i] = true;
+				placed.push_back(i);
+
+				heapRequirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+				heapRequirements.alignment = std::max(heapRequirements.alignment, alignment);
+				heapRequirements.size = std::max(heapRequirements.size, offset + requirements[i].size);
+			}
+
+			if (!placed.empty())
+			{
+				if (vmaAllocateMemory(m_Allocator, &heapRequirements, &dedicatedInfo, &frame.memory, nullptr) != VK_SUCCESS)
+					Log::Fatal("Failed to allocate memory for transient attachments");
+
+				stats.allocatedBytes += heapRequirements.size;
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				Texture& texture = frame.textures[i];
+
+				VmaAllocation allocation = shared[i] ? frame.memory : allocations[i];
+
+				if (vmaCreateAliasingImage2(m_Allocator, allocation, offsets[i], &imageInfos[i], &texture.m_Image) != VK_SUCCESS)
+					Log::Fatal("Failed to create transient attachment image");
+
+				if (texture.CreateView(texture.m_Image, &texture.m_ImageView) != VK_SUCCESS)
+					Log::Fatal("Failed to create transient attachment image view");
+
+				texture.m_HandleId = NextHandleId();
+
+				texture.m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			}
+
+			frame.built = frame.declarations;
+
+			Log::Info("Transient attachments placed %u targets in %llu KB (%llu KB without aliasing)", stats.targets,
+				stats.allocatedBytes / 1024, stats.requestedBytes / 1024);
+		}
+
+		void TransientAttachments::Acquire(CommandList& cmd, Texture* texture, ImageLayout layout)
+		{
+			if (layout == ImageLayout::Undefined)
+				layout = texture->IsColourFormat() ? ImageLayout::ColourAttachmentOptimal : ImageLayout::DepthStencilAttachmentOptimal;
+
+			VkImageMemoryBarrier imgBarrier = {};
+			imgBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imgBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imgBarrier.newLayout = static_cast<VkImageLayout>(layout);
+			imgBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imgBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imgBarrier.image = texture->m_Image;
+			imgBarrier.subresourceRange.aspectMask = GetAspectMask(texture);
+			imgBarrier.subresourceRange.baseMipLevel = 0;
+			imgBarrier.subresourceRange.levelCount = texture->m_MipLevels;
+			imgBarrier.subresourceRange.baseArrayLayer = 0;
+			imgBarrier.subresourceRange.layerCount = texture->m_ArrayLayers;
+
+			// Unlike a plain barrier out of Undefined this waits on the target that had the memory before
+			imgBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+			imgBarrier.dstAccessMask = GetAccessMaskFromLayout(imgBarrier.newLayout, true);
+
+			vkCmdPipelineBarrier
+			(
+				cmd.m_Buffer,
+				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				AccessFlagsToPipelineStage(imgBarrier.dstAccessMask),
+				0,
+				0,
+				nullptr,
+				0,
+				nullptr,
+				1,
+				&imgBarrier
+			);
+
+			texture->m_Layout = imgBarrier.newLayout;
+		}
+
+		void TransientAttachments::Release(Frame& frame)
+		{
+			for (size_t i = 0; i < frame.built.size(); i++)
+			{
+				Texture& texture = frame.textures[i];
+
+				vkDestroyImageView(m_VkDevice, texture.m_ImageView, nullptr);
+				vkDestroyImage(m_VkDevice, texture.m_Image, nullptr);
+
+				texture.m_ImageView = VK_NULL_HANDLE;
+				texture.m_Image = VK_NULL_HANDLE;
+			}
+
+			frame.built.clear();
+
+			for (VmaAllocation allocation : frame.dedicatedMemory)
+				vmaFreeMemory(m_Allocator, allocation);
+
+			frame.dedicatedMemory.clear();
+
+			if (frame.memory)
+			{
+				vmaFreeMemory(m_Allocator, frame.memory);
+				frame.memory = VK_NULL_HANDLE;
+			}
+		}
+
+		VkImageCreateInfo TransientAttachments::GetImageInfo(Texture& texture, const Declaration& declaration)
+		{
+			const TextureDesc& desc = declaration.desc;
+
+			texture.m_AssociatedDevice = m_VkDevice;
+			texture.m_AssociatedAllocator = m_Allocator;
+			texture.m_Allocation = VK_NULL_HANDLE;
+			texture.m_InternallyManaged = true;
+
+			texture.m_Format = FormatTable[(int)desc.format];
+			texture.m_Width = desc.width;
+			texture.m_Height = desc.height;
+			texture.m_Depth = desc.depth;
+			texture.m_MipLevels = desc.mipLevels;
+			texture.m_ArrayLayers = desc.arrayLevels;
+
+			VkImageUsageFlags usageFlags = texture.IsColourFormat() ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+			// A lazy target never leaves its passes so it can't be sampled either
+			if (declaration.lazy)
+				usageFlags |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			else
+				usageFlags |= VK_IMAGE_USAGE_SAMPLED_BIT;
+
+			if (desc.isStorage)
+				usageFlags |= VK_IMAGE_USAGE_STORAGE_BIT;
+
+			texture.m_Usage = usageFlags;
+
+			return texture.GetImageInfo();
+		}
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "VulkanInclude.h"
+#include "Texture.h"
+#include "CommandList.h"
+#include "Swapchain.h"
+#include "../Core/Log.h"
+#include <deque>
+#include <vector>
+
+namespace hf
+{
+	namespace vulkan
+	{
+		class Device;
+
+		struct TransientAttachmentStats
+		{
+			uint32_t targets = 0;
+			uint32_t lazyTargets = 0;
+			uint64_t requestedBytes = 0;	/* What the targets would take with memory of their own */
+			uint64_t allocatedBytes = 0;	/* What they take sharing it, lazily allocated memory isn't counted */
+
+			void Print()
+			{
+				Log::Info("Transient Attachment Stats:");
+				Log::Info(" - Targets: %u (%u lazily allocated)", targets, lazyTargets);
+				Log::Info(" - Memory: %llu KB (%llu KB without aliasing)", allocatedBytes / 1024, requestedBytes / 1024);
+			}
+		};
+
+		/*
+			Render targets that only live for part of a frame. Each frame the targets are declared with the first and last pass
+			that uses them, targets whose pass ranges don't overlap are placed at the same offset of one allocation with
+			vmaCreateAliasingImage2, so the frame only pays for the most memory alive at once rather than every target.
+			Targets whose contents never leave their passes (cleared or not loaded, never stored) can be lazy, on tilers and
+			UMA devices with lazily allocated memory those are only ever backed by tile memory.
+
+			Images are kept for as long as a frame slot declares the same targets, so a steady frame costs nothing after the first.
+			Since the memory was just used by another target, call Acquire before a target's first use instead of a plain barrier.
+			The textures belong to the allocator, they aren't disposed by the caller and are only used on the graphics queue.
+
+			Usage per frame:
+				Texture* gbuffer = attachments.Declare(desc, 0, 1);
+				Texture* bloom = attachments.Declare(desc, 2, 3);
+				attachments.Build();
+				...
+				attachments.Acquire(cmd, gbuffer);
+		*/
+		class TransientAttachments
+		{
+		public:
+
+			// Waits for the GPU to finish the last frame that used this frame's slot
+			void BeginFrame();
+
+			void EndFrame(uint64_t graphicsSubmitValue);
+
+			/// <summary>
+			/// Declares a render target used from firstPass to lastPass inclusive, pass indices are whatever order the frame records in.
+			/// The texture is only valid once Build has been called and only until the end of the frame
+			/// </summary>
+			Texture* Declare(const TextureDesc& desc, uint32_t firstPass, uint32_t lastPass, bool lazy = false);
+
+			// Places and creates the frame's targets, reusing last time's if the same targets were declared
+			void Build();
+
+			/// <summary>
+			/// Transitions the target out of Undefined for its first use, waiting on everything before it
+			/// since the previous target in its memory may still be being written
+			/// </summary>
+			void Acquire(CommandList& cmd, Texture* texture, ImageLayout layout = ImageLayout::Undefined);
+
+			TransientAttachmentStats GetStats() const { return m_Frames[m_Frame].stats; }
+
+		private:
+
+			friend class Device;
+
+			void Init(Device* device);
+
+			void Dispose();
+
+			struct Declaration
+			{
+				TextureDesc desc;
+				uint32_t firstPass = 0;
+				uint32_t lastPass = 0;
+				bool lazy = false;
+
+				bool operator==(const Declaration& other) const;
+			};
+
+			struct Frame
+			{
+				std::vector<Declaration> declarations;
+				std::vector<Declaration> built;
+
+				// A deque so the pointers handed out by Declare stay valid
+				std::deque<Texture> textures;
+
+				// Shared by the aliased targets
+				VmaAllocation memory = VK_NULL_HANDLE;
+
+				// Lazy targets and any target that can't share the memory type of the others
+				std::vector<VmaAllocation> dedicatedMemory;
+
+				TransientAttachmentStats stats;
+				uint64_t retireValue = 0;
+			};
+
+			Device* m_Device = nullptr;
+			VmaAllocator m_Allocator = VK_NULL_HANDLE;
+			VkDevice m_VkDevice = VK_NULL_HANDLE;
+
+			bool m_LazyMemory = false;
+
+			Frame m_Frames[MaxImagesInFlight];
+			uint32_t m_Frame = 0;
+
+			void Release(Frame& frame);
+
+			VkImageCreateInfo GetImageInfo(Texture& texture, const Declaration& declaration);
+		};
+	}
+}
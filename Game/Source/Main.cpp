@@ -6,6 +6,7 @@
 
 #include "HFramework/Graphics/Renderer.h"
 #include "HFramework/Graphics/Vulkan/RendererVk.h"
+#include "HFramework/Vulkan/StaticLayout.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -36,6 +37,12 @@ public:
 		float u, v;
 	};
 
+	using VertexLayout = hf::vulkan::StaticVertexInput<Vertex, hf::Format::RGB32F, hf::Format::RGBA32F, hf::Format::RG32F>;
+
+	using BaseSetLayout = hf::vulkan::StaticSetLayout<
+		hf::vulkan::DynamicUniformBufferBinding<0, hf::ShaderStage::Vertex>,
+		hf::vulkan::TextureSamplerBinding<1, hf::ShaderStage::Fragment>>;
+
 	void Start() override
 	{
 		GetMainWindow()->SetUseDarkMode(true);
@@ -46,24 +53,15 @@ public:
 
 
 
-		hf::vulkan::DescriptorSetLayout layout1;
-		layout1.AddUniformBuffer(hf::ShaderStage::Vertex, 0, 1);
-		layout1.AddTextureSampler(hf::ShaderStage::Fragment, 1, 1);
-
 		hf::vulkan::GraphicsPipelineDesc pipelineDesc{};
 		pipelineDesc.colourTargetFormats = { renderer->GetSwapchainFormat(GetMainWindow()) };
 		pipelineDesc.shaders[hf::ShaderStage::Vertex].bytecode = readFile("Assets/Shaders/base.vert.spv");
 		pipelineDesc.shaders[hf::ShaderStage::Fragment].bytecode = readFile("Assets/Shaders/base.frag.spv");
 		pipelineDesc.topologyMode = hf::TopologyMode::Triangles;
 		pipelineDesc.cullMode = hf::CullMode::None;
-		pipelineDesc.setLayouts = { layout1 };
+		pipelineDesc.setLayouts = { BaseSetLayout::Get() };
 
-		pipelineDesc.vertexLayout.push_back(
-			hf::vulkan::VertexInput(0, sizeof(Vertex)) 
-			.AddAttribute(hf::vulkan::VertexAttribute(0, hf::Format::RGB32F, 0))
-			.AddAttribute(hf::vulkan::VertexAttribute(1, hf::Format::RGBA32F, 3 * sizeof(float)))
-			.AddAttribute(hf::vulkan::VertexAttribute(2, hf::Format::RG32F, 7 * sizeof(float)))
-		);
+		pipelineDesc.vertexLayout.push_back(VertexLayout::Get());
 
 		graphicsPipeline = ((hf::RendererVk*)renderer)->m_Device.RetrieveGraphicsPipeline(pipelineDesc);
 
@@ -80,33 +78,11 @@ public:
 
 		
 
-		hf::BufferDesc bufferDesc{};
-		bufferDesc.bufferType = hf::BufferType::Vertex;
-		bufferDesc.cpuVisible = false;
-		bufferDesc.size = sizeof(Vertex) * vertices.size();
-
-		vertexBuffer = renderer->CreateBuffer(bufferDesc);
-		vertexBuffer->Upload(vertices.data(), sizeof(Vertex) * vertices.size());
-
-		hf::BufferDesc indexDesc{};
-		indexDesc.bufferType = hf::BufferType::Index;
-		indexDesc.cpuVisible = false;
-		indexDesc.size = sizeof(uint16_t) * indices.size();
-
-		indexBuffer = renderer->CreateBuffer(indexDesc);
-		indexBuffer->Upload(indices.data(), sizeof(uint16_t) * indices.size());
+		quad = ((hf::RendererVk*)renderer)->m_Geometry.Allocate(vertices.data(), sizeof(Vertex), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size());
 		
 		proj = glm::perspective(glm::radians(70.0f), (float)GetMainWindow()->GetWidth() / (float)GetMainWindow()->GetHeight(), 0.01f, 100.0f);
 
 
-		hf::BufferDesc uniformDesc{};
-		uniformDesc.bufferType = hf::BufferType::Uniform;
-		uniformDesc.cpuVisible = true;
-		uniformDesc.size = sizeof(glm::mat4);
-
-		uniformBuffer = renderer->CreateBuffer(uniformDesc);
-
-
 		/* texture load */
 
 		int w, h, c;
@@ -121,37 +97,23 @@ public:
 		textureDesc.format = hf::Format::RGBA8_SRGB;
 		textureDesc.type = hf::vulkan::TextureType::Flat2D;
 
-		testTexture = ((hf::RendererVk*)renderer)->m_Device.CreateTexture(textureDesc);
-
-		hf::vulkan::BufferDesc bufferDesc2{};
-		bufferDesc2.usage = hf::vulkan::BufferUsage::TransferSrc;
-		bufferDesc2.visibility = hf::vulkan::BufferVisibility::HostVisible;
-		bufferDesc2.bufferSize = w * h * 4;
+		((hf::RendererVk*)renderer)->m_Device.CreateTexture(textureDesc, &testTexture);
 
-		hf::vulkan::Buffer imgStaging = ((hf::RendererVk*)renderer)->m_Device.CreateBuffer(bufferDesc2);
+		hf::vulkan::BufferImageCopy imgCopy{};
+		imgCopy.extent.width = w;
+		imgCopy.extent.height = h;
 
-		void* imgMem = imgStaging.Map();
-		memcpy(imgMem, pixels, bufferDesc2.bufferSize);
-		imgStaging.Unmap();
-
-		((hf::RendererVk*)renderer)->m_Device.ExecuteSingleUsageCommandList(hf::vulkan::Queue::Graphics, [&](hf::vulkan::CommandList& cmd)
-			{
-				cmd.ResourceBarrier(&testTexture, hf::vulkan::ImageLayout::TransferDst);
-				hf::vulkan::BufferImageCopy imgCopy{};
-				imgCopy.extent.width = w;
-				imgCopy.extent.height = h;
-				cmd.CopyBufferToTexture(&imgStaging, &testTexture, imgCopy);
-				cmd.ResourceBarrier(&testTexture, hf::vulkan::ImageLayout::ShaderReadOnlyOptimal);
-			});
+		((hf::RendererVk*)renderer)->UploadTexture(&testTexture, pixels, w * h * 4, { imgCopy });
 
 		hf::vulkan::SamplerState samplerState;
 		samplerState.min = hf::FilterMode::Linear;
 		samplerState.mag = hf::FilterMode::Linear;
 		samplerState.maxAnisotropy = ((hf::RendererVk*)renderer)->m_Device.GetSupportedFeatures().maxAnis otropy;
 
-		descriptorSet = ((hf::RendererVk*)renderer)->m_Device.AllocateDescriptorSet(layout1);
-		descriptorSet.BindUniformBuffer(((hf::BufferVk*)uniformBuffer.get())->m_Buffer, 0);
-		descriptorSet.BindTextureSampler(testTexture, samplerState, 1);
+		descriptorSet = ((hf::RendererVk*)renderer)->m_Device.AllocateDescriptorSet(BaseSetLayout::Get());
+		// The view projection lives in the renderer's uniform ring, only the dynamic offset changes each frame
+		BaseSetLayout::BindDynamicUniformBuffer<0>(descriptorSet, ((hf::RendererVk*)renderer)->m_UniformRing.GetBuffer(), sizeof(glm::mat4));
+		BaseSetLayout::BindTextureSampler<1>(descriptorSet, testTexture, samplerState);
 		descriptorSet.Write();
 
 		
@@ -161,12 +123,14 @@ public:
 				proj = glm::perspective(glm::radians(70.0f), (float)GetMainWindow()->GetWidth() / (float)GetMainWindow()->GetHeight(), 0.01f, 100.0f);
 			});
 
-		imgStaging.Dispose();
+		// Both upload paths have copied the pixels by the time UploadTexture returns
+		stbi_image_free(pixels);
 
 	
 	}
 
 	glm::mat4 proj;
+	glm::mat4 vp;
 
 	void Update(float deltaTime) override
 	{
@@ -174,9 +138,7 @@ public:
 		camera.Update(deltaTime);
 
 		glm::mat4 view = camera.GetMatrix();
-		glm::mat4 vp = proj * view;
-
-		uniformBuffer->Upload(&vp, sizeof(vp));
+		vp = proj * view;
 
 	}
 
@@ -212,12 +174,13 @@ public:
 
 			cmdList.BindPipeline(&graphicsPipeline);
 
-			cmdList.BindDescriptorSets({ &descriptorSet }, 0);
+			hf::UniformAllocation vpAllocation = ((hf::RendererVk*)renderer)->m_UniformRing.Allocate(&vp, sizeof(vp));
+
+			cmdList.BindDescriptorSets({ &descriptorSet }, 0, { vpAllocation.dynamicOffset });
 
-			cmdList.BindVertexBuffer(&((hf::BufferVk*)vertexBuffer.get())->m_Buffer, 0);
-			cmdList.BindIndexBuffer(&((hf::BufferVk*)indexBuffer.get())->m_Buffer, hf::IndexType::Uint16);
+			((hf::RendererVk*)renderer)->m_Geometry.Bind(cmdList);
 
-			cmdList.DrawIndexed(6, 0);
+			hf::GeometryPool::Draw(cmdList, quad);
 
 			cmdList.EndRenderpass();
 
@@ -234,10 +197,8 @@ public:
 	{
 		((hf::RendererVk*)renderer)->WaitIdle();
 
-		vertexBuffer->Dispose();
-		indexBuffer->Dispose();
-		uniformBuffer->Dispose();
-		graphicsPipeline.Dispose();
+		((hf::RendererVk*)renderer)->m_Geometry.Free(quad);
+		descriptorSet.Dispose();
 		testTexture.Dispose();
 
 
@@ -253,9 +214,7 @@ public:
 	hf::vulkan::DescriptorSet descriptorSet;
 	hf::vulkan::Texture testTexture;
 
-	std::shared_ptr<hf::Buffer> vertexBuffer;
-	std::shared_ptr<hf::Buffer> uniformBuffer;
-	std::shared_ptr<hf::Buffer> indexBuffer;
+	hf::MeshAllocation quad;
 
 	hf::vulkan::GraphicsPipeline graphicsPipeline;
 